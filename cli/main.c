@@ -5,22 +5,31 @@
 
 #include "liblokatt/lokatt.h"
 
+#define BATCH_SIZE 64
+
 int main(int argc, char **argv)
 {
+	static struct lokatt_event events[BATCH_SIZE];
 	struct lokatt_device *dev = NULL;
-	struct lokatt_event event;
+	size_t i, count;
 	struct lokatt_filter *filter;
-	const char *filter_spec = NULL;
+	const char *filter_spec = NULL, *serialno = NULL;
 	uint64_t id = 0;
 
 	if (argc > 1 && !strcmp(argv[1], "--dummy")) {
 		if (argc > 2)
-			dev = lokatt_open_dummy_device(argv[2]);
+			dev = lokatt_open_dummy_device(argv[2], NULL);
 	} else if (argc > 1 && !strcmp(argv[1], "--file")) {
 		if (argc > 2)
-			dev = lokatt_open_file(argv[2]);
+			dev = lokatt_open_file(argv[2], NULL);
 	} else {
-		dev = lokatt_open_adb_device("some-serial-number");
+		/* no serial: the one device adb would pick */
+		if (argc > 2 && !strcmp(argv[1], "-s")) {
+			serialno = argv[2];
+			argc -= 2;
+			argv += 2;
+		}
+		dev = lokatt_open_adb_device(serialno, NULL);
 		if (argc > 1)
 			filter_spec = argv[1];
 	}
@@ -38,11 +47,19 @@ int main(int argc, char **argv)
 	}
 
 	for (;;) {
-		lokatt_next_event(dev, id, filter, &event);
-		id = event.id + 1;
-		fprintf(stdout, "pid=%-4" PRIu32 " tid=%-4" PRIu32 " tag='%s' text='%s'\n",
-			event.msg.pid, event.msg.tid, event.msg.tag,
-			event.msg.text);
+		if (lokatt_next_events(dev, id, filter, events, BATCH_SIZE,
+				       &count)) {
+			/* some events were evicted: skip ahead */
+			id = events[0].id;
+			continue;
+		}
+		for (i = 0; i < count; i++) {
+			const struct lokatt_message *msg = &events[i].msg;
+			fprintf(stdout, "pid=%-4" PRIu32 " tid=%-4" PRIu32
+				" tag='%s' text='%s'\n",
+				msg->pid, msg->tid, msg->tag, msg->text);
+		}
+		id = events[count - 1].id + 1;
 		fflush(stdout);
 	}
 
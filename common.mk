@@ -41,8 +41,12 @@ ifndef V
 	QUIET_LEX = @echo "    LEX $@";
 endif
 
+# several executables may share a prefix, and its directory
+ifndef mkdir_$(out)
+mkdir_$(out) := 1
 $(out):
 	$(QUIET_MKDIR)mkdir -p $@
+endif
 
 .PRECIOUS: $(out)/%.h $(out)/%.c
 $(out)/%.h $(out)/%.c: $(local_prefix)/%.lex | $(out)
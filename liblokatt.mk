@@ -4,13 +4,23 @@ local_shared_library := liblokatt.so
 
 local_objects += adb-backend.o
 local_objects += adb.o
+local_objects += cache.o
+local_objects += column.o
 local_objects += device.o
 local_objects += dummy-backend.o
 local_objects += error.o
 local_objects += file-backend.o
 local_objects += filter-lexer.o
 local_objects += filter.o
+local_objects += group.o
 local_objects += index.o
+local_objects += intern.o
+local_objects += lz.o
+local_objects += merge.o
+local_objects += pool.o
+local_objects += procs.o
+local_objects += search.o
+local_objects += session.o
 local_objects += stack.o
 local_objects += strbuf.o
 
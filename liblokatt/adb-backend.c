@@ -1,103 +1,750 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "adb.h"
 #include "backend.h"
+#include "error.h"
 #include "lokatt.h"
+#include "strbuf.h"
 
+/* delay before starting adb again, doubled on each failure */
+#define MIN_BACKOFF_MS 100
+#define MAX_BACKOFF_MS 5000
+
+/* the adb server's default port, on localhost */
+#define ADB_SERVER_PORT "5037"
+/* how long to wait for the server to answer a request */
+#define REQUEST_TIMEOUT_MS 2000
+/* how long ps may take to list the processes, once running */
+#define PS_TIMEOUT_MS 5000
+
+/*
+ * The ps of toolbox, up to Android 7, and that of toybox both print the pid
+ * second and the name last. Only toybox needs -A to list all processes,
+ * and toolbox takes it for a name to look for, and lists none: run both,
+ * the processes listed twice get the same name.
+ */
+#define PS_COMMAND "ps -A 2>/dev/null; ps"
+#define PS_MAX_BYTES (4 * 1024 * 1024)
+
+enum {
+	EXEC_IDLE,
+	/* waiting for the connection to the server */
+	EXEC_CONNECTING,
+	/* asking the server for the device, then for the command */
+	EXEC_TRANSPORT,
+	EXEC_COMMAND,
+	/* 'fd' carries the output of the command */
+	EXEC_RUNNING,
+};
+
+/*
+ * A command run on the device. The handshake with the server never blocks:
+ * 'fd' is in the epoll set, for writing or reading as the handshake goes,
+ * and so is 'timer', which bounds the whole handshake. 'buf' holds the
+ * request being sent, then the status being received, 'done' bytes of
+ * 'size' so far.
+ */
+struct exec {
+	int state;
+	int fd;
+	/* the adb client, -1 if talking to the server directly */
+	pid_t pid;
+	int timer;
+	uint32_t events;
+	int receiving;
+	char buf[512];
+	size_t size, done;
+	char command[128];
+};
+
+/*
+ * Messages are read from the adb server over a socket, as the adb client
+ * would: the server is asked for the device, then for 'logcat -B' on it,
+ * and the socket then carries the output of logcat. If there is no server,
+ * the adb client is run instead, as 'adb exec-out logcat -B', and starts
+ * one.
+ *
+ * logcat is restarted whenever it exits, eg. when the device is
+ * unplugged or reboots, after a delay that grows while it keeps failing.
+ * The restarted logcat is asked for the messages since the last one read,
+ * and those it sends again are skipped.
+ *
+ * Processes are listed by running ps alongside logcat, its output read as
+ * it comes, and parsed once it's all there.
+ *
+ * The backend never blocks, other than to poll in blocking mode. The
+ * stream, the handshakes with the server, ps and the timers are all in an
+ * epoll set, whose fd is the one to poll for messages, so that it stays
+ * the same across restarts.
+ */
 struct self {
-	struct {
-		pid_t pid;
-		int stdout[2];
-		int stderr[2];
-	} adb;
+	char *serialno;
+	int epfd;
+	int timer;
+	int nonblock;
+
+	/* the server's address, resolved once */
+	struct sockaddr_storage server;
+	socklen_t server_size;
+
+	struct exec logcat;
+	/* the reader is reading logcat's output */
+	int reading;
+	struct adb_reader reader;
+
+	int connected;
+	int backoff_ms;
+
+	/* the timestamp of the last message, and how many had it */
+	int have_last;
+	int32_t last_sec, last_nsec;
+	unsigned long last_count;
+	/* after a restart: messages at the last timestamp still to skip */
+	int resuming;
+	unsigned long skip;
+
+	/* read, but held back to report the reconnection first */
+	struct adb_message held;
+	int has_held;
+
+	/* the listing of processes under way, if any, and its output */
+	struct exec ps;
+	int ps_running;
+	struct strbuf ps_output;
 };
 
+/*
+ * Find the adb server: at ADB_SERVER_SOCKET if set, as in "tcp:[host:]port"
+ * or "localfilesystem:path", else on localhost at ANDROID_ADB_SERVER_PORT
+ * or the default port. Leaves 'server_size' 0 if there is none to try.
+ */
+static void resolve_server(struct self *self)
+{
+	struct addrinfo hints = { 0 }, *res;
+	struct sockaddr_un *sun = (struct sockaddr_un *)&self->server;
+	const char *spec = getenv("ADB_SERVER_SOCKET"), *colon;
+	const char *port = getenv("ANDROID_ADB_SERVER_PORT");
+	char host[256] = "127.0.0.1";
+
+	self->server_size = 0;
+	if (spec && !strncmp(spec, "localfilesystem:", 16)) {
+		if (strlen(spec + 16) >= sizeof(sun->sun_path))
+			return;
+		sun->sun_family = AF_UNIX;
+		strcpy(sun->sun_path, spec + 16);
+		self->server_size = sizeof(*sun);
+		return;
+	}
+
+	if (spec && !strncmp(spec, "tcp:", 4)) {
+		port = spec + 4;
+		colon = strrchr(port, ':');
+		if (colon) {
+			if ((size_t)(colon - port) >= sizeof(host))
+				return;
+			memcpy(host, port, colon - port);
+			host[colon - port] = '\0';
+			port = colon + 1;
+		}
+	} else if (spec) {
+		return;
+	}
+	if (!port)
+		port = ADB_SERVER_PORT;
+
+	/* may block, but only here */
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICSERV;
+	if (getaddrinfo(host, port, &hints, &res))
+		return;
+	if (res->ai_addrlen <= sizeof(self->server)) {
+		memcpy(&self->server, res->ai_addr, res->ai_addrlen);
+		self->server_size = res->ai_addrlen;
+	}
+	freeaddrinfo(res);
+}
+
 /* read and write ends of a pipe */
 #define R 0
 #define W 1
 
-static int start_adb_logcat(struct self *self)
+/*
+ * Without a server, fall back to 'adb exec-out', as the adb client starts
+ * one. Returns the read end of its stdout, or -1.
+ */
+static int fork_adb_exec(struct self *self, char *command, pid_t *pid)
 {
-	self->adb.stdout[R] = 0;
-	self->adb.stdout[W] = 0;
-	self->adb.stderr[R] = 0;
-	self->adb.stderr[W] = 0;
+	char *argv[6];
+	int fds[2], argc = 0, null;
 
-	if (pipe(self->adb.stdout) < 0)
-		goto bail;
-	if (pipe(self->adb.stderr) < 0)
-		goto bail;
+	argv[argc++] = "adb";
+	if (self->serialno) {
+		argv[argc++] = "-s";
+		argv[argc++] = self->serialno;
+	}
+	argv[argc++] = "exec-out";
+	argv[argc++] = command;
+	argv[argc] = NULL;
+
+	/* close on exec: children of other devices mustn't hold the pipe */
+	if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0)
+		return -1;
 
-	self->adb.pid = fork();
-	switch (self->adb.pid) {
+	*pid = fork();
+	switch (*pid) {
 	case -1:
 		/* error */
-		goto bail;
+		close(fds[R]);
+		close(fds[W]);
+		return -1;
 	case 0:
-		/* child */
-		close(self->adb.stdout[R]);
-		close(self->adb.stderr[R]);
-
-		dup2(self->adb.stdout[W], STDOUT_FILENO);
-		dup2(self->adb.stderr[W], STDERR_FILENO);
+		/* child: nobody reads stderr, so it mustn't fill up a pipe */
+		null = open("/dev/null", O_WRONLY);
+		dup2(fds[W], STDOUT_FILENO);
+		if (null >= 0) {
+			dup2(null, STDERR_FILENO);
+			close(null);
+		}
+		/* the pipe was made non-blocking for the parent only */
+		fcntl(STDOUT_FILENO, F_SETFL, 0);
 
-		execlp("adb", "adb", "exec-out", "logcat", "-B", NULL);
+		execvp("adb", argv);
 
-		exit(EXIT_FAILURE);
+		_exit(EXIT_FAILURE);
 	default:
 		/* parent */
-		close(self->adb.stdout[W]);
-		close(self->adb.stderr[W]);
-		break;
+		close(fds[W]);
+		return fds[R];
+	}
+}
+
+/* Kill and reap the adb client of an exec, if there is one. */
+static void reap(pid_t pid)
+{
+	if (pid <= 0)
+		return;
+	kill(pid, SIGKILL);
+	while (waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+		;
+}
+
+static void arm(int timer, int ms)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	timerfd_settime(timer, 0, &its, NULL);
+}
+
+/* Wait for 'events' on the exec's fd. */
+static void exec_watch(struct self *self, struct exec *e, uint32_t events)
+{
+	struct epoll_event ev = { .events = events };
+
+	if (e->events == events)
+		return;
+	epoll_ctl(self->epfd, e->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+		  e->fd, &ev);
+	e->events = events;
+}
+
+/*
+ * Prepare a request to the adb server: its length as four hex digits, then
+ * the request itself. The server answers "OKAY", or "FAIL" followed by a
+ * message with its length.
+ */
+static int exec_request(struct exec *e, const char *fmt, ...)
+{
+	char length[5];
+	va_list ap;
+	int size;
+
+	va_start(ap, fmt);
+	size = vsnprintf(e->buf + 4, sizeof(e->buf) - 4, fmt, ap);
+	va_end(ap);
+	if (size < 0 || size >= (int)sizeof(e->buf) - 4)
+		return -1;
+	snprintf(length, sizeof(length), "%04x", size);
+	memcpy(e->buf, length, 4);
+	e->size = 4 + size;
+	e->done = 0;
+	e->receiving = 0;
+	return 0;
+}
+
+static void exec_stop(struct exec *e)
+{
+	if (e->state == EXEC_IDLE)
+		return;
+	close(e->fd);
+	e->fd = -1;
+	e->events = 0;
+	reap(e->pid);
+	e->pid = -1;
+	arm(e->timer, 0);
+	e->state = EXEC_IDLE;
+}
+
+/* Run the adb client instead. Returns -1 if it can't be started. */
+static int exec_fork(struct self *self, struct exec *e)
+{
+	e->fd = fork_adb_exec(self, e->command, &e->pid);
+	if (e->fd < 0) {
+		e->state = EXEC_IDLE;
+		return -1;
 	}
+	e->state = EXEC_RUNNING;
+	arm(e->timer, 0);
+	exec_watch(self, e, EPOLLIN);
 	return 0;
-bail:
-	close(self->adb.stdout[R]);
-	close(self->adb.stdout[W]);
-	close(self->adb.stderr[R]);
-	close(self->adb.stderr[W]);
+}
+
+/*
+ * Start running 'command' on the device: connect to the server, or run
+ * the adb client if there is no server to connect to. Returns 0 if the
+ * exec is under way, see exec_step, or -1.
+ */
+static int exec_start(struct self *self, struct exec *e, const char *command)
+{
+	const struct sockaddr *addr = (struct sockaddr *)&self->server;
+
+	snprintf(e->command, sizeof(e->command), "%s", command);
+	e->pid = -1;
+	e->events = 0;
+	if (!self->server_size)
+		return exec_fork(self, e);
+
+	e->fd = socket(addr->sa_family,
+		       SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (e->fd < 0)
+		return -1;
+	if (connect(e->fd, addr, self->server_size) < 0 &&
+	    errno != EINPROGRESS) {
+		close(e->fd);
+		return exec_fork(self, e);
+	}
+	/* connected or not, writable once it's done */
+	e->state = EXEC_CONNECTING;
+	arm(e->timer, REQUEST_TIMEOUT_MS);
+	exec_watch(self, e, EPOLLOUT);
+	return 0;
+}
+
+/*
+ * Move the handshake forward as far as it goes without blocking. Returns 0
+ * once the command is running, 1 if the handshake is still under way, or
+ * -1 if it failed, eg. the server refused or didn't answer in time, in
+ * which case the exec is stopped.
+ */
+static int exec_step(struct self *self, struct exec *e)
+{
+	uint64_t expirations;
+	socklen_t size = sizeof(int);
+	int error = 0;
+	ssize_t n;
+
+	if (e->state == EXEC_RUNNING)
+		return 0;
+	if (read(e->timer, &expirations, sizeof(expirations)) > 0)
+		goto fail;
+
+	for (;;) {
+		switch (e->state) {
+		case EXEC_CONNECTING:
+			getsockopt(e->fd, SOL_SOCKET, SO_ERROR, &error, &size);
+			if (error == EINPROGRESS || error == EALREADY)
+				return 1;
+			if (error) {
+				/* no server after all */
+				close(e->fd);
+				e->events = 0;
+				return exec_fork(self, e) < 0 ? -1 : 0;
+			}
+			if ((self->serialno ?
+			     exec_request(e, "host:transport:%s",
+					  self->serialno) :
+			     exec_request(e, "host:transport-any")) < 0)
+				goto fail;
+			e->state = EXEC_TRANSPORT;
+			continue;
+		case EXEC_TRANSPORT:
+		case EXEC_COMMAND:
+			break;
+		default:
+			return e->state == EXEC_RUNNING ? 0 : -1;
+		}
+
+		if (!e->receiving) {
+			/* a server gone away mustn't kill the host process */
+			n = send(e->fd, e->buf + e->done, e->size - e->done,
+				 MSG_NOSIGNAL);
+			if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+				exec_watch(self, e, EPOLLOUT);
+				return 1;
+			}
+			if (n <= 0)
+				goto fail;
+			e->done += n;
+			if (e->done == e->size) {
+				e->receiving = 1;
+				e->size = 4;
+				e->done = 0;
+			}
+			continue;
+		}
+
+		n = read(e->fd, e->buf + e->done, e->size - e->done);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR)) {
+			exec_watch(self, e, EPOLLIN);
+			return 1;
+		}
+		if (n <= 0)
+			goto fail;
+		e->done += n;
+		if (e->done < e->size)
+			continue;
+		if (memcmp(e->buf, "OKAY", 4))
+			goto fail;
+		if (e->state == EXEC_TRANSPORT) {
+			if (exec_request(e, "exec:%s", e->command) < 0)
+				goto fail;
+			e->state = EXEC_COMMAND;
+			continue;
+		}
+		e->state = EXEC_RUNNING;
+		arm(e->timer, 0);
+		exec_watch(self, e, EPOLLIN);
+		return 0;
+	}
+fail:
+	exec_stop(e);
 	return -1;
-};
+}
 
-void *create_adb_backend(const char *serialno)
+static int start_adb_logcat(struct self *self)
 {
-	(void)serialno; /* TODO: use this */
-	struct self *self = calloc(1, sizeof(*self));
+	char command[64] = "logcat -B";
+
+	if (self->have_last)
+		snprintf(command, sizeof(command), "logcat -B -T %d.%09d",
+			 self->last_sec, self->last_nsec);
+	return exec_start(self, &self->logcat, command);
+}
+
+/* logcat is running: read its output from the start. */
+static void read_adb_logcat(struct self *self)
+{
+	adb_reader_init(&self->reader, self->logcat.fd);
+	self->reading = 1;
+	self->resuming = self->have_last;
+	self->skip = self->last_count;
+}
+
+/*
+ * Close the stream, and kill and reap the adb client if there is one: once
+ * this returns, the child is gone.
+ */
+static void stop_adb_logcat(struct self *self)
+{
+	if (self->reading)
+		adb_reader_destroy(&self->reader);
+	self->reading = 0;
+	exec_stop(&self->logcat);
+}
+
+/* Stop adb, and start it again after the backoff delay. */
+static void restart_later(struct self *self)
+{
+	stop_adb_logcat(self);
+	arm(self->timer, self->backoff_ms);
+	self->backoff_ms *= 2;
+	if (self->backoff_ms > MAX_BACKOFF_MS)
+		self->backoff_ms = MAX_BACKOFF_MS;
+}
 
-	if (start_adb_logcat(self) < 0) {
-		free(self);
-		return NULL;
+static int create_timer(struct self *self)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	int timer = timerfd_create(CLOCK_MONOTONIC,
+				   TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (timer >= 0 &&
+	    epoll_ctl(self->epfd, EPOLL_CTL_ADD, timer, &ev) < 0) {
+		close(timer);
+		timer = -1;
 	}
+	return timer;
+}
 
+/*
+ * Start logcat right away. A server refusing or not answering isn't an
+ * error here, but only found out later, like any disconnection.
+ */
+void *create_adb_backend(const char *serialno)
+{
+	struct self *self = calloc(1, sizeof(*self));
+
+	if (!self)
+		die("calloc");
+	self->logcat.state = self->ps.state = EXEC_IDLE;
+	self->logcat.fd = self->ps.fd = -1;
+	self->backoff_ms = MIN_BACKOFF_MS;
+	self->serialno = serialno ? strdup(serialno) : NULL;
+	resolve_server(self);
+	strbuf_init(&self->ps_output, 0);
+	self->timer = self->logcat.timer = self->ps.timer = -1;
+	self->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (self->epfd < 0 ||
+	    (self->timer = create_timer(self)) < 0 ||
+	    (self->logcat.timer = create_timer(self)) < 0 ||
+	    (self->ps.timer = create_timer(self)) < 0 ||
+	    start_adb_logcat(self) < 0)
+		goto bail;
+	self->connected = 1;
 	return self;
+bail:
+	if (self->epfd >= 0)
+		close(self->epfd);
+	if (self->timer >= 0)
+		close(self->timer);
+	if (self->logcat.timer >= 0)
+		close(self->logcat.timer);
+	if (self->ps.timer >= 0)
+		close(self->ps.timer);
+	strbuf_destroy(&self->ps_output);
+	free(self->serialno);
+	free(self);
+	return NULL;
 }
 
 static void destroy(void *userdata)
 {
-	free(userdata);
+	struct self *self = userdata;
+
+	stop_adb_logcat(self);
+	exec_stop(&self->ps);
+	close(self->logcat.timer);
+	close(self->ps.timer);
+	close(self->timer);
+	close(self->epfd);
+	strbuf_destroy(&self->ps_output);
+	free(self->serialno);
+	free(self);
 }
 
-static int next_logcat_message(void *userdata, struct lokatt_message *out)
+/* Returns non-zero if 'msg' was read before adb was restarted. */
+static int seen(struct self *self, const struct adb_message *msg)
+{
+	if (!self->resuming)
+		return 0;
+	if (msg->sec < self->last_sec ||
+	    (msg->sec == self->last_sec && msg->nsec < self->last_nsec))
+		return 1;
+	if (msg->sec == self->last_sec && msg->nsec == self->last_nsec &&
+	    self->skip > 0) {
+		self->skip--;
+		return 1;
+	}
+	self->resuming = 0;
+	return 0;
+}
+
+static void remember(struct self *self, const struct adb_message *msg)
+{
+	self->backoff_ms = MIN_BACKOFF_MS;
+	if (self->have_last && msg->sec == self->last_sec &&
+	    msg->nsec == self->last_nsec) {
+		self->last_count++;
+	} else {
+		self->have_last = 1;
+		self->last_sec = msg->sec;
+		self->last_nsec = msg->nsec;
+		self->last_count = 1;
+	}
+}
+
+/* logcat failed or exited: report it once, and try again later */
+static int lost(struct self *self)
+{
+	restart_later(self);
+	if (!self->connected)
+		return BACKEND_AGAIN;
+	self->connected = 0;
+	return BACKEND_DISCONNECTED;
+}
+
+static int try_next(struct self *self, struct adb_message *out)
+{
+	uint64_t expirations;
+	int status;
+
+	if (self->has_held) {
+		*out = self->held;
+		self->has_held = 0;
+		remember(self, out);
+		return 0;
+	}
+	if (!self->reading) {
+		if (self->logcat.state == EXEC_IDLE) {
+			if (read(self->timer, &expirations,
+				 sizeof(expirations)) < 0)
+				return BACKEND_AGAIN;
+			if (start_adb_logcat(self) < 0) {
+				restart_later(self);
+				return BACKEND_AGAIN;
+			}
+		}
+		status = exec_step(self, &self->logcat);
+		if (status > 0)
+			return BACKEND_AGAIN;
+		if (status < 0)
+			return lost(self);
+		read_adb_logcat(self);
+	}
+
+	do {
+		status = adb_reader_next(&self->reader, out);
+	} while (status == 0 && seen(self, out));
+
+	if (status == 1)
+		return BACKEND_AGAIN;
+	if (status != 0)
+		return lost(self);
+
+	if (!self->connected) {
+		/* the payload stays valid until the reader is used again */
+		self->connected = 1;
+		self->held = *out;
+		self->has_held = 1;
+		return BACKEND_CONNECTED;
+	}
+	remember(self, out);
+	return 0;
+}
+
+static int next_logcat_message(void *userdata, struct adb_message *out)
 {
 	struct self *self = userdata;
-	return adb_read_lokatt_message(self->adb.stdout[R], out);
+	struct pollfd pfd = { .fd = self->epfd, .events = POLLIN };
+	int status;
+
+	while ((status = try_next(self, out)) == BACKEND_AGAIN &&
+	       !self->nonblock)
+		poll(&pfd, 1, -1);
+	return status;
 }
 
-static int pid_to_name(void *userdata, uint32_t pid, char out[128])
+/*
+ * Read what ps has output so far. Returns 0 at the end of it, 1 if there
+ * is more to come, or -1 on error or if ps is taking too long.
+ */
+static int read_ps_output(struct self *self)
 {
-	/* TODO: implement this */
-	(void)userdata;
-	(void)pid;
-	(void)out;
-	return -1;
+	uint64_t expirations;
+	char buf[4096];
+	ssize_t n;
+
+	if (read(self->ps.timer, &expirations, sizeof(expirations)) > 0)
+		return -1;
+	for (;;) {
+		n = read(self->ps.fd, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == EAGAIN)
+			return 1;
+		if (n <= 0)
+			return n;
+		if (self->ps_output.str_size + n > PS_MAX_BYTES)
+			return -1;
+		strbuf_add(&self->ps_output, buf, n);
+	}
+}
+
+/* Call 'fn' for each line of 'ps' with a pid second and a name last. */
+static void parse_ps(char *output,
+		     void (*fn)(void *data, int32_t pid, const char *name),
+		     void *data)
+{
+	char *line, *field, *pid, *name, *lines, *fields;
+	int i;
+
+	for (line = strtok_r(output, "\n", &lines); line;
+	     line = strtok_r(NULL, "\n", &lines)) {
+		pid = name = NULL;
+		i = 0;
+		for (field = strtok_r(line, " \t\r", &fields); field;
+		     field = strtok_r(NULL, " \t\r", &fields)) {
+			if (i++ == 1)
+				pid = field;
+			name = field;
+		}
+		/* the header has PID where the pid goes */
+		if (i < 3 || strspn(pid, "0123456789") != strlen(pid))
+			continue;
+		fn(data, atoi(pid), name);
+	}
+}
+
+static int list_processes(void *userdata,
+			  void (*fn)(void *data, int32_t pid, const char *name),
+			  void *data)
+{
+	struct self *self = userdata;
+	int status;
+
+	if (self->ps.state == EXEC_IDLE &&
+	    exec_start(self, &self->ps, PS_COMMAND) < 0)
+		return -1;
+	status = exec_step(self, &self->ps);
+	if (status < 0)
+		return -1;
+	if (status > 0)
+		return BACKEND_AGAIN;
+	if (!self->ps_running) {
+		self->ps_running = 1;
+		arm(self->ps.timer, PS_TIMEOUT_MS);
+	}
+
+	status = read_ps_output(self);
+	if (status > 0)
+		return BACKEND_AGAIN;
+	exec_stop(&self->ps);
+	self->ps_running = 0;
+	if (status == 0)
+		parse_ps(self->ps_output.buf, fn, data);
+	strbuf_destroy(&self->ps_output);
+	strbuf_init(&self->ps_output, 0);
+	return status;
+}
+
+static int pollable_fd(void *userdata)
+{
+	struct self *self = userdata;
+
+	self->nonblock = 1;
+	return self->epfd;
 }
 
 struct backend_ops adb_backend_ops = {
 	.destroy = destroy,
 	.next_logcat_message = next_logcat_message,
-	.pid_to_name = pid_to_name,
+	.list_processes = list_processes,
+	.pollable_fd = pollable_fd,
 };
@@ -1,14 +1,15 @@
-#include <unistd.h>
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "adb.h"
-#include "lokatt.h"
+#include "error.h"
 
 /*
  * This struct is taken from Android (system/core/include/log/logger.h); lokatt
- * silently discards the extra uint32_t present in logger_entry_v2 and
- * logger_entry_v3 structs so as to coalesce all three versions into one and
- * the same.
+ * silently discards the extra fields present in logger_entry_v2 and later
+ * structs so as to coalesce all versions into one and the same.
  */
 struct logger_entry {
 	uint16_t len;
@@ -28,48 +29,113 @@ struct logger_entry {
 	 } while (_rc == -1 && errno == EINTR); \
 	 _rc; })
 
-static ssize_t xread(int fd, void *buf, size_t count)
+static size_t header_size(const struct logger_entry *header)
 {
-	ssize_t bytes_left = count;
-	while (bytes_left > 0) {
-		ssize_t r;
+	/*
+	 * Try to guess if we're reading v2 or later headers by looking at the
+	 * padding, which is used to store the header size in v2 and later. If
+	 * we actually are reading any of the newer formats, skip the extra
+	 * fields present just before the payload.
+	 */
+	if (header->__pad > sizeof(*header))
+		return header->__pad;
+	return sizeof(*header);
+}
 
-		r = TEMP_FAILURE_RETRY(read(fd, buf + count - bytes_left,
-					    bytes_left));
-		if (r < 0)
-			return -1;
-		bytes_left -= r;
-	}
-	return count;
+/* 'buf' must hold at least a complete struct logger_entry */
+static size_t message_size(const char *buf)
+{
+	struct logger_entry header;
+
+	memcpy(&header, buf, sizeof(header));
+	return header_size(&header) + header.len;
 }
 
-ssize_t adb_read_lokatt_message(int fd, struct lokatt_message *out)
+size_t adb_parse_message(const char *buf, size_t size,
+			 struct adb_message *out)
 {
 	struct logger_entry header;
-	ssize_t r;
-	uint32_t skip;
+	size_t hdr_size;
 
-	r = xread(fd, &header, sizeof(header));
-	if (r != sizeof(header))
-		return -1;
+	if (size < sizeof(header))
+		return 0;
+	memcpy(&header, buf, sizeof(header));
+	hdr_size = header_size(&header);
+	if (size < hdr_size + header.len)
+		return 0;
 
 	out->pid = header.pid;
 	out->tid = header.tid;
 	out->sec = header.sec;
-	out->nsec = header.sec;
+	out->nsec = header.nsec;
+	out->payload = buf + hdr_size;
+	out->payload_size = header.len;
+	out->persistent = 0;
 
-	/*
-	 * Try to guess if we're reading v2 or v3 headers by looking at the
-	 * padding, which is used to store the header size in v2 and v3. If we
-	 * actually are reading any of the newer formats, skip the extra
-	 * uint32_t present just before the payload.
-	 */
-	if (header.__pad != 0)
-		xread(fd, (char *)&skip, sizeof(skip));
+	return hdr_size + header.len;
+}
 
-	r = xread(fd, out->payload, header.len);
-	if (r != header.len)
-		return -1;
+void adb_reader_init(struct adb_reader *reader, int fd)
+{
+	reader->fd = fd;
+	reader->buf = malloc(ADB_READER_BUFFER_SIZE);
+	if (!reader->buf)
+		die("malloc");
+	reader->begin = reader->end = 0;
+}
 
+void adb_reader_destroy(struct adb_reader *reader)
+{
+	free(reader->buf);
+}
+
+/*
+ * Make sure at least 'count' bytes of unparsed data are buffered. Only read
+ * as much as is available: if the fd is a pipe, don't block waiting for the
+ * buffer to fill up. Returns 1 if a non-blocking fd has no more data.
+ */
+static int fill(struct adb_reader *reader, size_t count)
+{
+	while (reader->end - reader->begin < count) {
+		ssize_t r;
+
+		if (reader->begin + count > ADB_READER_BUFFER_SIZE) {
+			memmove(reader->buf, reader->buf + reader->begin,
+				reader->end - reader->begin);
+			reader->end -= reader->begin;
+			reader->begin = 0;
+		}
+
+		r = TEMP_FAILURE_RETRY(read(reader->fd,
+					    reader->buf + reader->end,
+					    ADB_READER_BUFFER_SIZE -
+					    reader->end));
+		if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 1;
+		if (r <= 0)
+			return -1;
+		reader->end += r;
+	}
 	return 0;
 }
+
+int adb_reader_next(struct adb_reader *reader, struct adb_message *out)
+{
+	size_t size = sizeof(struct logger_entry);
+
+	for (;;) {
+		size_t r;
+		int status = fill(reader, size);
+
+		if (status)
+			return status;
+		r = adb_parse_message(reader->buf + reader->begin,
+				      reader->end - reader->begin, out);
+		if (r) {
+			reader->begin += r;
+			return 0;
+		}
+		/* incomplete message: the header tells how much is needed */
+		size = message_size(reader->buf + reader->begin);
+	}
+}
@@ -1,9 +1,56 @@
 #ifndef LIBLOKATT_ADB_H
 #define LIBLOKATT_ADB_H
-#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
 
-struct lokatt_message;
+/*
+ * A message as parsed from a stream of logger_entry structs, as produced by
+ * 'logcat -B'. The payload points into the data that was parsed and is laid
+ * out as "<level><tag>\0<text>\0", although the nul chars are not guaranteed
+ * to be there.
+ */
+struct adb_message {
+	int32_t pid;
+	int32_t tid;
+	int32_t sec;
+	int32_t nsec;
+	const char *payload;
+	size_t payload_size;
 
-ssize_t adb_read_lokatt_message(int fd, struct lokatt_message *out);
+	/* the payload stays valid until the backend is destroyed */
+	int persistent;
+};
+
+/*
+ * Parse one message at the start of 'buf'. Returns the number of bytes
+ * consumed, or 0 if 'buf' does not hold a complete message.
+ */
+size_t adb_parse_message(const char *buf, size_t size,
+			 struct adb_message *out);
+
+/* large enough to always hold at least one complete message */
+#define ADB_READER_BUFFER_SIZE (128 * 1024)
+
+/*
+ * Buffered reader for a stream of logger_entry structs. Data is read from
+ * the file descriptor in large blocks and as many messages as possible are
+ * parsed from each block.
+ */
+struct adb_reader {
+	int fd;
+	char *buf;
+	/* unparsed data is buf[begin, end) */
+	size_t begin, end;
+};
+
+void adb_reader_init(struct adb_reader *reader, int fd);
+void adb_reader_destroy(struct adb_reader *reader);
+
+/*
+ * Returns 0 on success, -1 on error or end of file. If the fd is
+ * non-blocking, returns 1 if no complete message can be read without
+ * blocking. The payload of 'out' is valid until the next call.
+ */
+int adb_reader_next(struct adb_reader *reader, struct adb_message *out);
 
 #endif
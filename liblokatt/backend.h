@@ -2,12 +2,41 @@
 #define LOKATT_BACKEND_H
 #include <stdint.h>
 
-struct lokatt_message;
+struct adb_message;
+
+/* what next_logcat_message returns, other than 0 for a message */
+enum {
+	/* non-blocking mode: no message can be read without blocking */
+	BACKEND_AGAIN = 1,
+	/* the device went away, or came back: no message */
+	BACKEND_DISCONNECTED,
+	BACKEND_CONNECTED,
+};
 
 struct backend_ops {
 	void (*destroy)(void *userdata);
-	int (*next_logcat_message)(void *userdata, struct lokatt_message *out);
-	int (*pid_to_name)(void *userdata, uint32_t pid, char out[128]);
+	/* returns 0 on success, -1 on error or end of file, or see above */
+	int (*next_logcat_message)(void *userdata, struct adb_message *out);
+
+	/*
+	 * List the processes on the device, without blocking: the first call
+	 * starts a listing, and the next ones carry on with it, returning
+	 * BACKEND_AGAIN until it's done; the fd of pollable_fd becomes ready
+	 * as it goes. Then call 'fn' with the pid and name of each process,
+	 * all from the one listing, and return 0, or -1 on error or if the
+	 * backend has no processes, eg. a capture file.
+	 */
+	int (*list_processes)(void *userdata,
+			      void (*fn)(void *data, int32_t pid,
+					 const char *name),
+			      void *data);
+
+	/*
+	 * Switch to non-blocking mode, in which next_logcat_message returns
+	 * BACKEND_AGAIN instead of blocking, and return an fd to poll, or
+	 * -1 if messages can always be read without blocking.
+	 */
+	int (*pollable_fd)(void *userdata);
 };
 
 extern void *create_dummy_backend(const char *path);
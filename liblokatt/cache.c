@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "error.h"
+
+static size_t entry_size(const struct cache_entry *entry)
+{
+	return sizeof(*entry) + strlen(entry->key) + 1 +
+		entry->alloc * sizeof(uint64_t);
+}
+
+static void unlink_entry(struct cache *cache, struct cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+}
+
+static void push_front(struct cache *cache, struct cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->head;
+	if (cache->head)
+		cache->head->prev = entry;
+	else
+		cache->tail = entry;
+	cache->head = entry;
+}
+
+static void free_entry(struct cache *cache, struct cache_entry *entry)
+{
+	cache->size -= entry_size(entry);
+	unlink_entry(cache, entry);
+	free(entry->key);
+	free(entry->ids);
+	free(entry);
+}
+
+/* make room for 'extra' ids, with the matches moved to the start */
+static void reserve(struct cache *cache, struct cache_entry *entry,
+		    size_t extra)
+{
+	size_t count = entry->count - entry->first;
+	size_t alloc = entry->alloc;
+
+	while (alloc < count + extra)
+		alloc = alloc ? alloc * 2 : 64;
+	if (entry->first) {
+		memmove(entry->ids, entry->ids + entry->first,
+			count * sizeof(uint64_t));
+		entry->first = 0;
+		entry->count = count;
+	}
+	if (alloc == entry->alloc)
+		return;
+	entry->ids = realloc(entry->ids, alloc * sizeof(uint64_t));
+	if (!entry->ids)
+		die("realloc");
+	cache->size += (alloc - entry->alloc) * sizeof(uint64_t);
+	entry->alloc = alloc;
+}
+
+void cache_init(struct cache *cache, size_t max_size)
+{
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->head = cache->tail = NULL;
+	cache->size = 0;
+	cache->max_size = max_size;
+}
+
+void cache_destroy(struct cache *cache)
+{
+	while (cache->head)
+		free_entry(cache, cache->head);
+	pthread_mutex_destroy(&cache->lock);
+}
+
+struct cache_entry *cache_get(struct cache *cache, const char *key)
+{
+	struct cache_entry *entry;
+
+	for (entry = cache->head; entry; entry = entry->next) {
+		if (!strcmp(entry->key, key)) {
+			unlink_entry(cache, entry);
+			push_front(cache, entry);
+			return entry;
+		}
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		die("calloc");
+	entry->key = strdup(key);
+	if (!entry->key)
+		die("strdup");
+	push_front(cache, entry);
+	cache->size += entry_size(entry);
+	return entry;
+}
+
+void cache_prepend(struct cache *cache, struct cache_entry *entry,
+		   const uint64_t *ids, size_t count)
+{
+	if (count == 0)
+		return;
+	if (entry->first < count) {
+		reserve(cache, entry, count);
+		memmove(entry->ids + count, entry->ids,
+			entry->count * sizeof(uint64_t));
+		entry->first = count;
+		entry->count += count;
+	}
+	entry->first -= count;
+	memcpy(entry->ids + entry->first, ids, count * sizeof(uint64_t));
+}
+
+void cache_append(struct cache *cache, struct cache_entry *entry,
+		  const uint64_t *ids, size_t count)
+{
+	if (count == 0)
+		return;
+	if (entry->alloc - entry->count < count)
+		reserve(cache, entry, count);
+	memcpy(entry->ids + entry->count, ids, count * sizeof(uint64_t));
+	entry->count += count;
+}
+
+size_t cache_lower_bound(const struct cache_entry *entry, uint64_t id)
+{
+	size_t lo = entry->first, hi = entry->count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (entry->ids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void cache_trim(struct cache_entry *entry, uint64_t first_id)
+{
+	entry->first = cache_lower_bound(entry, first_id);
+	if (entry->begin < first_id)
+		entry->begin = first_id;
+	if (entry->end < entry->begin)
+		entry->end = entry->begin;
+}
+
+void cache_shrink(struct cache *cache)
+{
+	while (cache->tail && cache->size > cache->max_size)
+		free_entry(cache, cache->tail);
+}
@@ -0,0 +1,62 @@
+#ifndef LIBLOKATT_CACHE_H
+#define LIBLOKATT_CACHE_H
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Cache of filter results, ie. the ids of the events a filter matches, keyed
+ * by the filter's canonical form (see filter_key). Each entry covers a
+ * contiguous range of ids, which the user of the cache extends as needed.
+ * Entries are kept in least recently used order, and the least recently
+ * used ones are dropped when the total size exceeds the budget.
+ *
+ * The cache doesn't lock by itself: users hold 'lock' around any access.
+ */
+struct cache_entry {
+	/* in LRU order, most recently used first */
+	struct cache_entry *prev, *next;
+	char *key;
+
+	/* ids [begin, end) have been scanned */
+	uint64_t begin, end;
+
+	/* the matches, in ascending order: ids[first] to ids[count - 1] */
+	uint64_t *ids;
+	size_t first, count, alloc;
+};
+
+struct cache {
+	pthread_mutex_t lock;
+	struct cache_entry *head, *tail;
+	size_t size, max_size;
+};
+
+void cache_init(struct cache *cache, size_t max_size);
+void cache_destroy(struct cache *cache);
+
+/*
+ * Return the entry for 'key', creating an empty one if there is none, and
+ * mark it as the most recently used.
+ */
+struct cache_entry *cache_get(struct cache *cache, const char *key);
+
+/* add matches below entry->first, or above the last one */
+void cache_prepend(struct cache *cache, struct cache_entry *entry,
+		   const uint64_t *ids, size_t count);
+void cache_append(struct cache *cache, struct cache_entry *entry,
+		  const uint64_t *ids, size_t count);
+
+/* index in entry->ids of the first match with an id >= 'id' */
+size_t cache_lower_bound(const struct cache_entry *entry, uint64_t id);
+
+/* forget the matches with ids below 'first_id', eg. evicted events */
+void cache_trim(struct cache_entry *entry, uint64_t first_id);
+
+/*
+ * Drop least recently used entries until the cache is within budget. Any
+ * pointer to an entry may be invalid afterwards.
+ */
+void cache_shrink(struct cache *cache);
+
+#endif
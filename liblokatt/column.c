@@ -0,0 +1,108 @@
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "column.h"
+
+/* EQ, LT and GT are computed directly, the others as their complements */
+static inline int is_complement(int op)
+{
+	return op == COLUMN_NE || op == COLUMN_LE || op == COLUMN_GE;
+}
+
+#ifdef __SSE2__
+uint64_t column_compare(const int32_t *values, int op, int32_t value)
+{
+	const __m128i v = _mm_set1_epi32(value);
+	uint64_t bits = 0;
+	int i;
+
+	for (i = 0; i < COLUMN_BLOCK; i += 4) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(values + i));
+		__m128i m;
+
+		switch (op) {
+		case COLUMN_EQ:
+		case COLUMN_NE:
+			m = _mm_cmpeq_epi32(x, v);
+			break;
+		case COLUMN_LT:
+		case COLUMN_GE:
+			m = _mm_cmplt_epi32(x, v);
+			break;
+		default:
+			m = _mm_cmpgt_epi32(x, v);
+			break;
+		}
+		bits |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(m)) << i;
+	}
+	return is_complement(op) ? ~bits : bits;
+}
+
+uint64_t column_test(const uint8_t *values, uint8_t mask)
+{
+	const __m128i m = _mm_set1_epi8(mask);
+	const __m128i zero = _mm_setzero_si128();
+	uint64_t bits = 0;
+	int i;
+
+	for (i = 0; i < COLUMN_BLOCK; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(values + i));
+
+		x = _mm_cmpeq_epi8(_mm_and_si128(x, m), zero);
+		bits |= (uint64_t)(uint16_t)_mm_movemask_epi8(x) << i;
+	}
+	return ~bits;
+}
+#else
+uint64_t column_compare(const int32_t *values, int op, int32_t value)
+{
+	uint64_t bits = 0;
+	int i;
+
+	for (i = 0; i < COLUMN_BLOCK; i++) {
+		int hit;
+
+		switch (op) {
+		case COLUMN_EQ:
+		case COLUMN_NE:
+			hit = values[i] == value;
+			break;
+		case COLUMN_LT:
+		case COLUMN_GE:
+			hit = values[i] < value;
+			break;
+		default:
+			hit = values[i] > value;
+			break;
+		}
+		bits |= (uint64_t)hit << i;
+	}
+	return is_complement(op) ? ~bits : bits;
+}
+
+uint64_t column_test(const uint8_t *values, uint8_t mask)
+{
+	uint64_t bits = 0;
+	int i;
+
+	for (i = 0; i < COLUMN_BLOCK; i++)
+		bits |= (uint64_t)((values[i] & mask) != 0) << i;
+	return bits;
+}
+#endif
+
+uint64_t column_in_set(const uint32_t *values, const uint64_t *set,
+		       uint32_t size)
+{
+	uint64_t bits = 0;
+	int i;
+
+	for (i = 0; i < COLUMN_BLOCK; i++) {
+		uint32_t v = values[i];
+
+		if (v < size && (set[v / 64] >> (v % 64)) & 1)
+			bits |= (uint64_t)1 << i;
+	}
+	return bits;
+}
@@ -0,0 +1,31 @@
+#ifndef LIBLOKATT_COLUMN_H
+#define LIBLOKATT_COLUMN_H
+#include <stdint.h>
+
+/*
+ * Kernels scanning a block of COLUMN_BLOCK consecutive values of a column of
+ * the index (see struct index_columns), producing a selection bitmap: bit i
+ * of the result is set if values[i] satisfies the predicate.
+ */
+#define COLUMN_BLOCK 64
+
+enum {
+	COLUMN_EQ,
+	COLUMN_NE,
+	COLUMN_LT,
+	COLUMN_LE,
+	COLUMN_GT,
+	COLUMN_GE,
+};
+
+/* values[i] <op> value */
+uint64_t column_compare(const int32_t *values, int op, int32_t value);
+
+/* values[i] is in the bitmap 'set' of 'size' bits */
+uint64_t column_in_set(const uint32_t *values, const uint64_t *set,
+		       uint32_t size);
+
+/* (values[i] & mask) != 0 */
+uint64_t column_test(const uint8_t *values, uint8_t mask);
+
+#endif
@@ -1,122 +1,113 @@
 #include <inttypes.h>
 #include <pthread.h>
 #include <search.h>
-#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "adb.h"
 #include "backend.h"
+#include "cache.h"
+#include "device.h"
+#include "error.h"
+#include "filter.h"
+#include "group.h"
 #include "index.h"
 #include "lokatt.h"
+#include "pool.h"
+#include "session.h"
 
 struct lokatt_device {
 	void *backend;
 	struct backend_ops *ops;
 
-	pthread_t logcat_thread;
-	pthread_rwlock_t lock;
-	pthread_mutex_t mutex;
-	pthread_cond_t cond;
+	/*
+	 * Read by a group's thread: the user's, or if none was given, one of
+	 * its own, so that closing the device is bounded in time.
+	 */
+	struct lokatt_group *group;
+	int own_group;
+	struct group_member *member;
 
 	struct index index;
+	struct cache cache;
 };
 
-static pthread_key_t key;
-static pthread_once_t key_once = PTHREAD_ONCE_INIT;
-
-static void logcat_thread_sighandler(int signum)
-{
-	(void)signum;
-	pthread_setspecific(key, (void *)1);
-}
-
-static void *logcat_thread_main(void *arg)
-{
-	struct lokatt_device *dev = (struct lokatt_device *)arg;
-	struct lokatt_message msg;
-	struct lokatt_event event;
-	int status;
-	int (*fn)(void *, struct lokatt_message *) = dev->ops->next_logcat_message;
-
-	signal(SIGQUIT, logcat_thread_sighandler);
-	event.type = EVENT_LOGCAT_MESSAGE;
-
-	while (!pthread_getspecific(key)) {
-		status = fn(dev->backend, &msg);
-		if (status != 0)
-			continue;
-
-		pthread_rwlock_wrlock(&dev->lock);
-
-		memcpy(&event.msg, &msg, sizeof(struct lokatt_message));
-		index_append(&dev->index, &event);
-
-		pthread_mutex_lock(&dev->mutex);
-		pthread_cond_broadcast(&dev->cond);
-		pthread_mutex_unlock(&dev->mutex);
-		pthread_rwlock_unlock(&dev->lock);
-	}
-	return NULL;
-}
-
-static void init_pthreads()
-{
-	pthread_key_create(&key, NULL);
-}
+#define DEFAULT_CACHE_BYTES (16 << 20)
 
 static struct lokatt_device *create_device(void *initialized_backend,
-					   struct backend_ops *ops)
+					   struct backend_ops *ops,
+					   const struct lokatt_options *opts)
 {
+	static const struct lokatt_options default_opts;
 	struct lokatt_device *dev;
 
-	pthread_once(&key_once, init_pthreads);
+	if (!opts)
+		opts = &default_opts;
 
 	dev = calloc(1, sizeof(*dev));
 	dev->backend = initialized_backend;
 	dev->ops = ops;
-	index_init(&dev->index);
-	pthread_rwlock_init(&dev->lock, NULL);
-	pthread_cond_init(&dev->cond, NULL);
-	pthread_mutex_init(&dev->mutex, NULL);
-	pthread_create(&dev->logcat_thread, NULL, logcat_thread_main, dev);
+	index_init(&dev->index, opts->max_events, opts->max_bytes);
+	if (opts->spill_dir && index_spill(&dev->index, opts->spill_dir)) {
+		index_destroy(&dev->index);
+		free(dev);
+		return NULL;
+	}
+	dev->group = opts->group;
+	if (!dev->group) {
+		dev->group = lokatt_create_group();
+		if (!dev->group) {
+			index_destroy(&dev->index);
+			free(dev);
+			return NULL;
+		}
+		dev->own_group = 1;
+	}
+	cache_init(&dev->cache, opts->max_cache_bytes ?
+		   opts->max_cache_bytes : DEFAULT_CACHE_BYTES);
+	dev->member = group_add(dev->group, dev->backend, dev->ops,
+				&dev->index);
 
 	return dev;
 }
 
-struct lokatt_device *lokatt_open_adb_device(const char *serialno)
+struct lokatt_device *lokatt_open_adb_device(const char *serialno,
+					     const struct lokatt_options *opts)
 {
 	struct lokatt_device *dev;
 	void *backend = create_adb_backend(serialno);
 	if (!backend)
 		return NULL;
-	dev = create_device(backend, &adb_backend_ops);
+	dev = create_device(backend, &adb_backend_ops, opts);
 	if (!dev) {
 		adb_backend_ops.destroy(backend);
 	}
 	return dev;
 }
 
-struct lokatt_device *lokatt_open_dummy_device(const char *path)
+struct lokatt_device *lokatt_open_dummy_device(const char *path,
+					const struct lokatt_options *opts)
 {
 	struct lokatt_device *dev;
 	void *backend = create_dummy_backend(path);
 	if (!backend)
 		return NULL;
-	dev = create_device(backend, &dummy_backend_ops);
+	dev = create_device(backend, &dummy_backend_ops, opts);
 	if (!dev) {
 		dummy_backend_ops.destroy(backend);
 	}
 	return dev;
 }
 
-struct lokatt_device *lokatt_open_file(const char *path)
+struct lokatt_device *lokatt_open_file(const char *path,
+				       const struct lokatt_options *opts)
 {
 	struct lokatt_device *dev;
 	void *backend = create_file_backend(path);
 	if (!backend)
 		return NULL;
-	dev = create_device(backend, &file_backend_ops);
+	dev = create_device(backend, &file_backend_ops, opts);
 	if (!dev) {
 		file_backend_ops.destroy(backend);
 	}
@@ -125,50 +116,395 @@ struct lokatt_device *lokatt_open_file(const char *path)
 
 void lokatt_close_device(struct lokatt_device *dev)
 {
-	pthread_kill(dev->logcat_thread, SIGQUIT);
-	pthread_join(dev->logcat_thread, NULL);
-	pthread_cond_destroy(&dev->cond);
-	pthread_mutex_destroy(&dev->mutex);
-	pthread_rwlock_destroy(&dev->lock);
+	group_remove(dev->group, dev->member);
+	if (dev->own_group)
+		lokatt_destroy_group(dev->group);
+	cache_destroy(&dev->cache);
 	index_destroy(&dev->index);
 	dev->ops->destroy(dev->backend);
 
 	free(dev);
 }
 
-uint64_t lokatt_next_event(struct lokatt_device *dev,
-			   uint64_t id,
-			   const struct lokatt_filter *filter,
-			   struct lokatt_event *out)
+/*
+ * The next event from '*id' on that matches 'filter', or NULL if there is
+ * none yet; '*id' is left at the id to continue from. Call within
+ * index_read_begin and index_read_end.
+ */
+static const struct index_event *next_match(struct lokatt_device *dev,
+					    uint64_t *id,
+					    const struct lokatt_filter *filter)
 {
-	const struct lokatt_event *event = NULL;
+	const struct index_event *event;
+	struct lokatt_message msg;
 
 	for (;;) {
-		pthread_rwlock_rdlock(&dev->lock);
-		event = index_get(&dev->index, id);
+		uint64_t next = filter_seek(filter, &dev->index, *id);
 
-		/* found matching event: we're done */
-		if (event && lokatt_filter_match(filter, event))
-			break;
+		/* don't skip events evicted while seeking */
+		if (index_first_id(&dev->index) > *id)
+			return NULL;
+		*id = next;
+		event = index_get(&dev->index, *id);
+		if (!event)
+			return NULL;
+		*id += 1;
+		index_event_to_message(event, &msg);
+		if (filter_match_event(filter, event->type, &msg,
+				       event->tag_id,
+				       index_event_pname_id(event)))
+			return event;
+	}
+}
 
-		/* found non-matching event: try next event */
-		if (event) {
-			pthread_rwlock_unlock(&dev->lock);
-			id += 1;
-			continue;
-		}
+int device_poll_events(struct lokatt_device *dev, uint64_t *id,
+		       const struct lokatt_filter *filter,
+		       struct lokatt_event *out, size_t count, size_t *out_count)
+{
+	const struct index_event *event;
+	unsigned long epoch;
+	uint64_t first_id;
+	size_t n = 0;
+
+	epoch = index_read_begin(&dev->index);
+	first_id = index_first_id(&dev->index);
+	if (*id < first_id) {
+		out->id = first_id;
+		index_read_end(&dev->index, epoch);
+		*out_count = 0;
+		return LOKATT_EVICTED;
+	}
+
+	while (n < count && (event = next_match(dev, id, filter)))
+		index_event_copy(event, &out[n++]);
+	index_read_end(&dev->index, epoch);
+
+	*out_count = n;
+	return 0;
+}
+
+int lokatt_next_events(struct lokatt_device *dev,
+		       uint64_t id,
+		       const struct lokatt_filter *filter,
+		       struct lokatt_event *out,
+		       size_t count,
+		       size_t *out_count)
+{
+	int ret;
+
+	if (count == 0) {
+		*out_count = 0;
+		return 0;
+	}
+
+	for (;;) {
+		ret = device_poll_events(dev, &id, filter, out, count,
+					 out_count);
+
+		/*
+		 * Found at least one matching event: we're done. Any events
+		 * evicted while scanning will be reported by the next call.
+		 */
+		if (ret || *out_count > 0)
+			return ret;
 
 		/* at last event: wait for new event to arrive */
-		pthread_mutex_lock(&dev->mutex);
-		pthread_rwlock_unlock(&dev->lock);
-		pthread_cond_wait(&dev->cond, &dev->mutex);
-		pthread_mutex_unlock(&dev->mutex);
+		index_wait(&dev->index, id);
 	}
-	memcpy(out, event, sizeof(*out));
-	pthread_rwlock_unlock(&dev->lock);
-	if (event->type == EVENT_LOGCAT_MESSAGE)
-		decode_logcat_payload(out->msg.payload, &out->msg.level,
-				      out->msg.tag, out->msg.text);
+}
 
+int lokatt_next_views(struct lokatt_device *dev,
+		      uint64_t id,
+		      const struct lokatt_filter *filter,
+		      struct lokatt_view *out,
+		      size_t count,
+		      size_t *out_count,
+		      unsigned long *out_guard)
+{
+	const struct index_event *event;
+	uint64_t first_id;
+	size_t n = 0;
+
+	for (;;) {
+		*out_guard = index_read_begin(&dev->index);
+		first_id = index_first_id(&dev->index);
+		if (id < first_id) {
+			out->id = first_id;
+			*out_count = 0;
+			return LOKATT_EVICTED;
+		}
+
+		while (n < count && (event = next_match(dev, &id, filter)))
+			index_event_to_view(event, &out[n++]);
+		if (n > 0 || count == 0) {
+			*out_count = n;
+			return 0;
+		}
+
+		/* don't hold back reclaiming memory while waiting */
+		index_read_end(&dev->index, *out_guard);
+		index_wait(&dev->index, id);
+	}
+}
+
+void lokatt_release_views(struct lokatt_device *dev, unsigned long guard)
+{
+	index_read_end(&dev->index, guard);
+}
+
+void device_add_waker(struct lokatt_device *dev, struct index_waker *w)
+{
+	index_add_waker(&dev->index, w);
+}
+
+void device_remove_waker(struct lokatt_device *dev, struct index_waker *w)
+{
+	index_remove_waker(&dev->index, w);
+}
+
+#define SCAN_MIN_CHUNK 1024
+
+struct scan_chunk {
+	uint64_t *ids;
+	size_t count;
+	size_t alloc;
+};
+
+/* a parallel scan: the workers grab chunks of ids off 'next_chunk' */
+struct scan {
+	struct index *idx;
+	const struct lokatt_filter *filter;
+	uint64_t begin, end;
+	uint64_t chunk_size;
+	size_t chunk_count;
+	size_t next_chunk;
+	struct scan_chunk *chunks;
+};
+
+static void add_match(struct scan_chunk *chunk, uint64_t id)
+{
+	if (chunk->count == chunk->alloc) {
+		chunk->alloc = chunk->alloc ? chunk->alloc * 2 : 64;
+		chunk->ids = realloc(chunk->ids, chunk->alloc * sizeof(uint64_t));
+		if (!chunk->ids)
+			die("realloc");
+	}
+	chunk->ids[chunk->count++] = id;
+}
+
+/* bitmap of the ids in [begin, end) within the block of 64 at 'block' */
+static uint64_t block_mask(uint64_t block, uint64_t begin, uint64_t end)
+{
+	uint64_t mask = ~(uint64_t)0;
+
+	if (begin >= block + 64 || end <= block)
+		return 0;
+	if (begin > block)
+		mask <<= begin - block;
+	if (end < block + 64)
+		mask &= ((uint64_t)1 << (end - block)) - 1;
+	return mask;
+}
+
+/*
+ * Scan the ids in ['id', 'end') 64 at a time, selecting candidates on the
+ * columns of the index, and only look at the events themselves if the
+ * selection isn't exact, or if they have been spilled.
+ */
+static void scan_chunk(struct scan *scan, struct scan_chunk *chunk,
+		       uint64_t id, uint64_t end)
+{
+	int exact = filter_select_exact(scan->filter);
+	const struct index_columns *columns;
+	const struct index_event *event;
+	struct lokatt_message msg;
+	unsigned long epoch;
+	uint64_t block, bits, resident;
+
+	epoch = index_read_begin(scan->idx);
+	/* holds all ids up to scan->end, which was loaded before */
+	columns = index_columns(scan->idx);
+	while ((id = filter_seek(scan->filter, scan->idx, id)) < end) {
+		block = id & ~(uint64_t)63;
+		bits = filter_select(scan->filter, columns, block);
+		/* the columns of spilled events are gone, loaded after them */
+		resident = index_resident_id(scan->idx);
+		bits |= ~block_mask(block, resident, block + 64);
+		/* events evicted during the scan are skipped */
+		bits &= block_mask(block, id, end) &
+			block_mask(block, index_first_id(scan->idx), end);
+		for (; bits; bits &= bits - 1) {
+			id = block + __builtin_ctzll(bits);
+			if (exact && id >= resident) {
+				add_match(chunk, id);
+				continue;
+			}
+			event = index_get(scan->idx, id);
+			if (!event)
+				continue;
+			index_event_to_message(event, &msg);
+			if (filter_match_event(scan->filter, event->type, &msg,
+					       event->tag_id,
+					       index_event_pname_id(event)))
+				add_match(chunk, id);
+		}
+		id = block + 64;
+	}
+	index_read_end(scan->idx, epoch);
+}
+
+static void scan_worker(void *arg)
+{
+	struct scan *scan = arg;
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&scan->next_chunk, 1,
+				       __ATOMIC_RELAXED)) <
+	       scan->chunk_count) {
+		uint64_t begin = scan->begin + i * scan->chunk_size;
+		uint64_t end = begin + scan->chunk_size;
+
+		if (end > scan->end)
+			end = scan->end;
+		scan_chunk(scan, &scan->chunks[i], begin, end);
+	}
+}
+
+/* store the ids of the events in ['begin', 'end') matching 'filter' */
+static void scan_range(struct index *idx, const struct lokatt_filter *filter,
+		       uint64_t begin, uint64_t end, struct scan_chunk *out)
+{
+	struct scan scan;
+	size_t i;
+
+	scan.idx = idx;
+	scan.filter = filter;
+	scan.begin = begin;
+	scan.end = end;
+
+	/* a few chunks per thread, to even out the load */
+	scan.chunk_size = (scan.end - scan.begin) / (pool_size() * 8);
+	if (scan.chunk_size < SCAN_MIN_CHUNK)
+		scan.chunk_size = SCAN_MIN_CHUNK;
+	scan.chunk_count = (scan.end - scan.begin + scan.chunk_size - 1) /
+		scan.chunk_size;
+	scan.next_chunk = 0;
+	scan.chunks = calloc(scan.chunk_count + 1, sizeof(*scan.chunks));
+	if (!scan.chunks)
+		die("calloc");
+
+	if (scan.chunk_count > 1)
+		pool_run(scan_worker, &scan);
+	else
+		scan_worker(&scan);
+
+	/* merge the matches, in order */
+	out->count = 0;
+	for (i = 0; i < scan.chunk_count; i++)
+		out->count += scan.chunks[i].count;
+	out->alloc = out->count ? out->count : 1;
+	out->ids = malloc(out->alloc * sizeof(uint64_t));
+	if (!out->ids)
+		die("malloc");
+	out->count = 0;
+	for (i = 0; i < scan.chunk_count; i++) {
+		if (!scan.chunks[i].count)
+			continue;
+		memcpy(out->ids + out->count, scan.chunks[i].ids,
+		       scan.chunks[i].count * sizeof(uint64_t));
+		out->count += scan.chunks[i].count;
+		free(scan.chunks[i].ids);
+	}
+	free(scan.chunks);
+}
+
+int lokatt_scan(struct lokatt_device *dev,
+		uint64_t current_id,
+		uint64_t end_id,
+		const struct lokatt_filter *filter,
+		uint64_t **out_ids,
+		size_t *out_count)
+{
+	struct strbuf key = STRBUF_INIT;
+	struct cache_entry *entry;
+	struct scan_chunk found;
+	uint64_t first_id, size, begin, end;
+	size_t from, to;
+
+	first_id = index_first_id(&dev->index);
+	size = index_size(&dev->index);
+	begin = current_id > first_id ? current_id : first_id;
+	end = end_id < size ? end_id : size;
+	if (end < begin)
+		end = begin;
+	filter_key(filter, &key);
+
+	pthread_mutex_lock(&dev->cache.lock);
+	entry = cache_get(&dev->cache, key.buf);
+	strbuf_destroy(&key);
+
+	/* only scan what the cache doesn't already cover */
+	cache_trim(entry, first_id);
+	if (entry->begin == entry->end)
+		entry->begin = entry->end = begin;
+	if (begin < entry->begin) {
+		scan_range(&dev->index, filter, begin, entry->begin, &found);
+		cache_prepend(&dev->cache, entry, found.ids, found.count);
+		free(found.ids);
+		entry->begin = begin;
+	}
+	if (end > entry->end) {
+		scan_range(&dev->index, filter, entry->end, end, &found);
+		cache_append(&dev->cache, entry, found.ids, found.count);
+		free(found.ids);
+		entry->end = end;
+	}
+
+	/* leave out anything evicted while scanning */
+	first_id = index_first_id(&dev->index);
+	from = cache_lower_bound(entry, begin > first_id ? begin : first_id);
+	to = cache_lower_bound(entry, end);
+	*out_count = to - from;
+	*out_ids = malloc((*out_count ? *out_count : 1) * sizeof(uint64_t));
+	if (!*out_ids)
+		die("malloc");
+	if (*out_count)
+		memcpy(*out_ids, entry->ids + from,
+		       *out_count * sizeof(uint64_t));
+
+	cache_shrink(&dev->cache);
+	pthread_mutex_unlock(&dev->cache.lock);
+
+	if (current_id < first_id)
+		return LOKATT_EVICTED;
 	return 0;
 }
+
+int lokatt_save_session(struct lokatt_device *dev, const char *path)
+{
+	return session_write(&dev->index, path);
+}
+
+uint64_t lokatt_seek_time(struct lokatt_device *dev,
+			  uint64_t current_id,
+			  int32_t sec,
+			  int32_t nsec)
+{
+	unsigned long epoch;
+	uint64_t id;
+
+	epoch = index_read_begin(&dev->index);
+	id = index_seek_time(&dev->index, sec, nsec, current_id);
+	index_read_end(&dev->index, epoch);
+	return id;
+}
+
+int lokatt_next_event(struct lokatt_device *dev,
+		      uint64_t id,
+		      const struct lokatt_filter *filter,
+		      struct lokatt_event *out)
+{
+	size_t count;
+
+	return lokatt_next_events(dev, id, filter, out, 1, &count);
+}
@@ -0,0 +1,24 @@
+#ifndef LIBLOKATT_DEVICE_H
+#define LIBLOKATT_DEVICE_H
+#include <stddef.h>
+#include <stdint.h>
+
+struct index_waker;
+struct lokatt_device;
+struct lokatt_event;
+struct lokatt_filter;
+
+/*
+ * Like lokatt_next_events, but only look at the events available now:
+ * '*out_count' may be 0. Stores the id to continue from in '*id'.
+ */
+int device_poll_events(struct lokatt_device *dev, uint64_t *id,
+		       const struct lokatt_filter *filter,
+		       struct lokatt_event *out, size_t count,
+		       size_t *out_count);
+
+/* Bump 'w' whenever an event is appended to 'dev', see index_add_waker. */
+void device_add_waker(struct lokatt_device *dev, struct index_waker *w);
+void device_remove_waker(struct lokatt_device *dev, struct index_waker *w);
+
+#endif
@@ -1,33 +1,97 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/timerfd.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "backend.h"
 
+/*
+ * A file backend that trickles its messages out at random intervals, like
+ * a device would. In non-blocking mode, a timer fd stands in for sleeping.
+ */
+struct self {
+	void *file;
+	int timer;
+};
+
+static int random_delay_ms(void)
+{
+	return (rand() % 200) + 100;
+}
+
+static void arm_timer(struct self *self)
+{
+	struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+	its.it_value.tv_nsec = random_delay_ms() * 1000000L;
+	timerfd_settime(self->timer, 0, &its, NULL);
+}
+
 void *create_dummy_backend(const char *path)
 {
+	struct self *self;
+	void *file;
+
 	srand(time(NULL));
-	return create_file_backend(path);
+	file = create_file_backend(path);
+	if (!file)
+		return NULL;
+	self = calloc(1, sizeof(*self));
+	self->file = file;
+	self->timer = -1;
+	return self;
 }
 
 static void destroy(void *userdata)
 {
-	file_backend_ops.destroy(userdata);
+	struct self *self = userdata;
+
+	if (self->timer >= 0)
+		close(self->timer);
+	file_backend_ops.destroy(self->file);
+	free(self);
+}
+
+static int next_logcat_message(void *userdata, struct adb_message *out)
+{
+	struct self *self = userdata;
+	uint64_t expirations;
+
+	if (self->timer < 0) {
+		usleep(random_delay_ms() * 1000);
+	} else {
+		if (read(self->timer, &expirations, sizeof(expirations)) < 0)
+			return errno == EAGAIN ? BACKEND_AGAIN : -1;
+		arm_timer(self);
+	}
+	return file_backend_ops.next_logcat_message(self->file, out);
 }
 
-static int next_logcat_message(void *userdata, struct lokatt_message *out)
+static int list_processes(void *userdata,
+			  void (*fn)(void *data, int32_t pid, const char *name),
+			  void *data)
 {
-	usleep((rand() % 200) * 1000 + 100 * 1000);
-	return file_backend_ops.next_logcat_message(userdata, out);
+	struct self *self = userdata;
+
+	return file_backend_ops.list_processes(self->file, fn, data);
 }
 
-static int pid_to_name(void *userdata, uint32_t pid, char out[128])
+static int pollable_fd(void *userdata)
 {
-	return file_backend_ops.pid_to_name(userdata, pid, out);
+	struct self *self = userdata;
+
+	self->timer = timerfd_create(CLOCK_MONOTONIC,
+				     TFD_NONBLOCK | TFD_CLOEXEC);
+	if (self->timer >= 0)
+		arm_timer(self);
+	return self->timer;
 }
 
 struct backend_ops dummy_backend_ops = {
 	.destroy = destroy,
 	.next_logcat_message = next_logcat_message,
-	.pid_to_name = pid_to_name,
+	.list_processes = list_processes,
+	.pollable_fd = pollable_fd,
 };
@@ -1,54 +1,98 @@
 #include <fcntl.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "adb.h"
 #include "backend.h"
-#include "lokatt.h"
 
 /*
- * If the file descriptor returned from open(2) in create_file_backend is 0,
- * the function return value is indistinguishable to NULL. Define two macros to
- * add/subtract a constant to the actual file descriptor value to eliminate
- * this ambiguity.
+ * The whole file is mapped into memory and parsed in place. The mapping is
+ * kept until the backend is destroyed, so the index can refer to the
+ * payloads directly instead of copying them.
  */
-#define FD_TO_VOIDP(fd) ((void *)((fd) + 1))
-#define VOIDP_TO_FD(p) ((int)((p) - 1))
+struct self {
+	const char *data;
+	size_t size;
+	size_t pos;
+};
 
 void *create_file_backend(const char *path)
 {
-	intptr_t fd;
+	struct self *self;
+	struct stat st;
+	void *data = NULL;
+	int fd;
+
 	fd = open(path, O_RDONLY);
 	if (fd < 0)
 		return NULL;
-	return FD_TO_VOIDP(fd);
+	if (fstat(fd, &st) < 0)
+		goto bail;
+	if (st.st_size > 0) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			goto bail;
+		madvise(data, st.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	self = calloc(1, sizeof(*self));
+	self->data = data;
+	self->size = st.st_size;
+	self->pos = 0;
+	return self;
+bail:
+	close(fd);
+	return NULL;
 }
 
 static void destroy(void *userdata)
 {
-	int fd = VOIDP_TO_FD(userdata);
-	close(fd);
+	struct self *self = userdata;
+	if (self->size > 0)
+		munmap((void *)self->data, self->size);
+	free(self);
 }
 
-static int next_logcat_message(void *userdata, struct lokatt_message *out)
+static int next_logcat_message(void *userdata, struct adb_message *out)
 {
-	int fd = VOIDP_TO_FD(userdata);
-	return adb_read_lokatt_message(fd, out);
+	struct self *self = userdata;
+	size_t r;
+
+	r = adb_parse_message(self->data + self->pos, self->size - self->pos,
+			      out);
+	if (r == 0)
+		return -1;
+	self->pos += r;
+	out->persistent = 1;
+	return 0;
+}
+
+static int list_processes(void *userdata,
+			  void (*fn)(void *data, int32_t pid, const char *name),
+			  void *data)
+{
+	/* a capture has no process table */
+	(void)userdata;
+	(void)fn;
+	(void)data;
+	return -1;
 }
 
-static int pid_to_name(void *userdata, uint32_t pid, char out[128])
+static int pollable_fd(void *userdata)
 {
-	/* TODO: implement this */
+	/* the file is mapped: reading never blocks */
 	(void)userdata;
-	(void)pid;
-	(void)out;
 	return -1;
 }
 
 struct backend_ops file_backend_ops = {
 	.destroy = destroy,
 	.next_logcat_message = next_logcat_message,
-	.pid_to_name = pid_to_name,
+	.list_processes = list_processes,
+	.pollable_fd = pollable_fd,
 };
@@ -1,11 +1,141 @@
+#include <regex.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "out/liblokatt/filter-lexer.h"
+#include "column.h"
 #include "filter.h"
+#include "index.h"
+#include "intern.h"
 #include "lokatt.h"
+#include "search.h"
 #include "stack.h"
 
+/*
+ * The RPN is compiled into code for a small machine once, when the filter is
+ * created. All type checking happens at compile time. At match time each
+ * comparison instruction stores its result in a single accumulator, and &&
+ * and || are implemented as conditional jumps past the remaining operands,
+ * so evaluation short-circuits.
+ */
+enum {
+	OP_INT_EQ,
+	OP_INT_NE,
+	OP_INT_LT,
+	OP_INT_LE,
+	OP_INT_GT,
+	OP_INT_GE,
+	OP_STR_EQ,
+	OP_STR_NE,
+	OP_TAG_EQ,
+	OP_TAG_NE,
+	OP_TAG_IN,
+	OP_TAG_NOT_IN,
+	OP_PNAME_EQ,
+	OP_PNAME_NE,
+	OP_PNAME_MATCH,
+	OP_PNAME_NMATCH,
+	OP_REGEX_MATCH,
+	OP_REGEX_NMATCH,
+	OP_CONTAINS,
+	OP_JUMP_IF_FALSE,
+	OP_JUMP_IF_TRUE,
+};
+
+enum {
+	FIELD_PID,
+	FIELD_TID,
+	FIELD_SEC,
+	FIELD_NSEC,
+	FIELD_LEVEL,
+	FIELD_TAG,
+	FIELD_TEXT,
+	FIELD_PNAME,
+};
+
+/* process names with ids below this have their regex results memoized */
+#define PNAME_MEMO_SIZE 4096
+
+enum {
+	MEMO_UNKNOWN,
+	MEMO_MATCH,
+	MEMO_NO_MATCH,
+};
+
+/*
+ * A regular expression, compiled once when the filter is created. 'literal'
+ * is a string that every match must contain (or start with, if 'anchored'),
+ * and is used to reject most strings before running the regex engine at
+ * all. If the pattern is nothing but the literal, the regex engine is never
+ * run. A regex on process names, which are interned and few, remembers its
+ * result for each name id in 'memo', so that it only runs once per name.
+ */
+struct regex {
+	regex_t re;
+	struct search literal;
+	int has_literal;
+	int anchored;
+	int exact;
+	uint8_t *memo;
+};
+
+/* a set of interned tag ids, see intern.h */
+struct tag_set {
+	uint32_t size;
+	uint64_t bits[];
+};
+
+struct insn {
+	int op;
+	int field;
+	/* OP_TAG_EQ and OP_TAG_NE compare ids, but keep the string too */
+	uint32_t value_id;
+	union {
+		int32_t value_int;
+		const char *value_string;
+		const struct tag_set *tag_set;
+		const struct regex *regex;
+		const struct search *search;
+		size_t target;
+	};
+};
+
+/*
+ * The filter again, as a program over the columns of the index (see
+ * index.h), evaluated on 64 events at a time: each instruction pushes a
+ * selection bitmap, or combines the top two. Comparisons on other fields
+ * select everything, so the program selects a superset of the matches.
+ */
+enum {
+	COL_COMPARE,
+	COL_IN_SET,
+	COL_NOT_IN_SET,
+	COL_AND,
+	COL_OR,
+};
+
+struct column_insn {
+	int op;
+	int field;
+	int compare;
+	union {
+		int32_t value;
+		const struct tag_set *tag_set;
+	};
+};
+
+#define FILTER_MAX_DEPTH 16
+
+#define FILTER_MAX_KEYS 4
+
+/* an equality the index has posting lists for, see index.h */
+struct filter_key {
+	int key;
+	int32_t value;
+	/* INDEX_KEY_TAG: the tag itself */
+	const char *tag;
+};
+
 struct lokatt_filter {
 	unsigned int event_bitmask;
 
@@ -14,6 +144,27 @@ struct lokatt_filter {
 
 	struct token **rpn;
 	size_t rpn_count;
+
+	struct insn *code;
+	size_t code_count;
+
+	struct regex *regexes;
+	size_t regex_count;
+
+	struct search *searches;
+	size_t search_count;
+
+	struct tag_set **tag_sets;
+	size_t tag_set_count;
+
+	/* indexed equalities every matching message satisfies */
+	struct filter_key keys[FILTER_MAX_KEYS];
+	size_t key_count;
+
+	struct column_insn *columns;
+	size_t column_count;
+	/* the column program selects exactly the matches */
+	int columns_exact;
 };
 
 /* Replace any pair of chars '\x' with 'x'. */
@@ -37,7 +188,7 @@ static void unescape(char *str)
 	((type) == TOKEN_KEY_PID || (type) == TOKEN_KEY_TID || \
 	 (type) == TOKEN_KEY_SEC || (type) == TOKEN_KEY_NSEC || \
 	 (type) == TOKEN_KEY_LEVEL || (type) == TOKEN_KEY_TAG || \
-	 (type) == TOKEN_KEY_TEXT)
+	 (type) == TOKEN_KEY_TEXT || (type) == TOKEN_KEY_PNAME)
 
 #define is_value(type) \
 	((type) == TOKEN_VALUE_INT || (type) == TOKEN_VALUE_STRING)
@@ -50,6 +201,7 @@ static void unescape(char *str)
 	 (type) == TOKEN_OP_LT || (type) == TOKEN_OP_LE || \
 	 (type) == TOKEN_OP_GT || (type) == TOKEN_OP_GE || \
 	 (type) == TOKEN_OP_MATCH || (type) == TOKEN_OP_NMATCH || \
+	 (type) == TOKEN_OP_CONTAINS || (type) == TOKEN_OP_ICONTAINS || \
 	 is_logical_operator(type))
 
 #define precedence_is_le(type1, type2) \
@@ -242,18 +394,738 @@ int filter_tokens_as_rpn(const struct token *tokens, size_t token_count,
 	return retval;
 }
 
+static int key_to_field(int type, int *is_string)
+{
+	*is_string = 0;
+	switch (type) {
+	case TOKEN_KEY_PID:
+		return FIELD_PID;
+	case TOKEN_KEY_TID:
+		return FIELD_TID;
+	case TOKEN_KEY_SEC:
+		return FIELD_SEC;
+	case TOKEN_KEY_NSEC:
+		return FIELD_NSEC;
+	case TOKEN_KEY_LEVEL:
+		return FIELD_LEVEL;
+	case TOKEN_KEY_TAG:
+		*is_string = 1;
+		return FIELD_TAG;
+	case TOKEN_KEY_TEXT:
+		*is_string = 1;
+		return FIELD_TEXT;
+	case TOKEN_KEY_PNAME:
+		*is_string = 1;
+		return FIELD_PNAME;
+	default:
+		return -1;
+	}
+}
+
+static int is_special(char c)
+{
+	return strchr("^$.[]()|*+?{}\\", c) != NULL;
+}
+
+/* Skip a ?, *, + or {} following an atom. Returns the repetition char. */
+static char skip_repetition(const char **p)
+{
+	char c = **p;
+
+	if (c == '?' || c == '*' || c == '+') {
+		(*p)++;
+	} else if (c == '{') {
+		while (**p && *(*p)++ != '}')
+			;
+	} else {
+		return '\0';
+	}
+	return c;
+}
+
+/*
+ * Find the longest string that any match of the extended regular expression
+ * 'pattern' must contain. Only simple patterns are analyzed: a top-level |
+ * gives up, and brackets, groups and the like just end the current run of
+ * literal characters. A character repeated by ?, * or {} is conservatively
+ * treated as optional.
+ */
+static void extract_literal(struct regex *r, const char *pattern)
+{
+	size_t size = strlen(pattern) + 1;
+	char *run = malloc(size), *best = malloc(size);
+	size_t run_size = 0, best_size = 0;
+	int run_is_prefix = 0, best_is_prefix = 0;
+	const char *p = pattern;
+	int exact = 1;
+
+	if (*p == '^') {
+		run_is_prefix = 1;
+		p++;
+	}
+
+	while (*p) {
+		char c = *p++, rep;
+		int is_literal = 1;
+
+		if (c == '\\' && *p && is_special(*p)) {
+			c = *p++;
+		} else if (c == '\\') {
+			/* \w and friends */
+			if (*p)
+				p++;
+			is_literal = 0;
+		} else if (c == '.' || c == '$') {
+			is_literal = 0;
+		} else if (c == '[') {
+			/* a ] right after [ or [^ is part of the set */
+			if (*p == '^')
+				p++;
+			if (*p == ']')
+				p++;
+			while (*p && *p++ != ']')
+				;
+			is_literal = 0;
+		} else if (c == '(') {
+			size_t depth = 1;
+
+			while (*p && depth) {
+				c = *p++;
+				if (c == '\\' && *p)
+					p++;
+				else if (c == '(')
+					depth++;
+				else if (c == ')')
+					depth--;
+			}
+			is_literal = 0;
+		} else if (is_special(c)) {
+			/* top-level | or a stray special character */
+			goto bail;
+		}
+
+		rep = skip_repetition(&p);
+		if (is_literal && (rep == '\0' || rep == '+'))
+			run[run_size++] = c;
+		if (is_literal && rep == '\0')
+			continue;
+
+		/* end of the current run */
+		exact = 0;
+		if (run_size > best_size) {
+			memcpy(best, run, run_size);
+			best_size = run_size;
+			best_is_prefix = run_is_prefix;
+		}
+		run_size = 0;
+		run_is_prefix = 0;
+	}
+
+	if (run_size > best_size) {
+		memcpy(best, run, run_size);
+		best_size = run_size;
+		best_is_prefix = run_is_prefix;
+	}
+	if (best_size > 0) {
+		best[best_size] = '\0';
+		search_init(&r->literal, best, 0);
+		r->has_literal = 1;
+		r->anchored = best_is_prefix;
+		r->exact = exact;
+	}
+bail:
+	free(run);
+	free(best);
+}
+
+static int compile_regex(struct lokatt_filter *f, const char *pattern,
+			 const struct regex **out)
+{
+	struct regex *r = &f->regexes[f->regex_count];
+
+	if (regcomp(&r->re, pattern, REG_EXTENDED | REG_NOSUB))
+		return -1;
+	f->regex_count++;
+	r->has_literal = 0;
+	r->anchored = 0;
+	r->exact = 0;
+	r->memo = NULL;
+	extract_literal(r, pattern);
+	*out = r;
+	return 0;
+}
+
+static int compile_comparison(struct lokatt_filter *f,
+			      const struct token *op,
+			      const struct token *key,
+			      const struct token *value,
+			      struct insn *out)
+{
+	int is_string;
+
+	if (!is_key(key->type) || !is_value(value->type))
+		return -1;
+	out->field = key_to_field(key->type, &is_string);
+	if (out->field < 0)
+		return -1;
+
+	if (is_string) {
+		if (value->type != TOKEN_VALUE_STRING)
+			return -1;
+		out->value_string = value->value_string.buf;
+		/*
+		 * Tags in the index are interned, compare ids. A literal
+		 * that isn't interned yet may still turn up: compare it as
+		 * a string rather than intern it.
+		 */
+		if (out->field == FIELD_TAG && (op->type == TOKEN_OP_EQ ||
+						op->type == TOKEN_OP_NE)) {
+			out->value_id = intern_find(value->value_string.buf);
+			if (out->value_id != INTERN_NONE) {
+				out->op = op->type == TOKEN_OP_EQ ?
+					OP_TAG_EQ : OP_TAG_NE;
+				return 0;
+			}
+		}
+		if (out->field == FIELD_PNAME &&
+		    (op->type == TOKEN_OP_EQ || op->type == TOKEN_OP_NE)) {
+			/* so are process names */
+			out->value_id = intern_find(value->value_string.buf);
+			if (out->value_id != INTERN_NONE) {
+				out->op = op->type == TOKEN_OP_EQ ?
+					OP_PNAME_EQ : OP_PNAME_NE;
+				return 0;
+			}
+		}
+		if (out->field == FIELD_PNAME &&
+		    (op->type == TOKEN_OP_MATCH ||
+		     op->type == TOKEN_OP_NMATCH)) {
+			out->op = op->type == TOKEN_OP_MATCH ?
+				OP_PNAME_MATCH : OP_PNAME_NMATCH;
+			if (compile_regex(f, value->value_string.buf,
+					  &out->regex))
+				return -1;
+			f->regexes[f->regex_count - 1].memo =
+				calloc(PNAME_MEMO_SIZE, 1);
+			return 0;
+		}
+		switch (op->type) {
+		case TOKEN_OP_EQ:
+			out->op = OP_STR_EQ;
+			return 0;
+		case TOKEN_OP_NE:
+			out->op = OP_STR_NE;
+			return 0;
+		case TOKEN_OP_MATCH:
+			out->op = OP_REGEX_MATCH;
+			return compile_regex(f, value->value_string.buf,
+					     &out->regex);
+		case TOKEN_OP_NMATCH:
+			out->op = OP_REGEX_NMATCH;
+			return compile_regex(f, value->value_string.buf,
+					     &out->regex);
+		case TOKEN_OP_CONTAINS:
+		case TOKEN_OP_ICONTAINS:
+			out->op = OP_CONTAINS;
+			out->search = &f->searches[f->search_count++];
+			search_init(&f->searches[f->search_count - 1],
+				    value->value_string.buf,
+				    op->type == TOKEN_OP_ICONTAINS);
+			return 0;
+		default:
+			return -1;
+		}
+	}
+
+	if (value->type != TOKEN_VALUE_INT)
+		return -1;
+	out->value_int = value->value_int;
+	switch (op->type) {
+	case TOKEN_OP_EQ:
+		out->op = OP_INT_EQ;
+		return 0;
+	case TOKEN_OP_NE:
+		out->op = OP_INT_NE;
+		return 0;
+	case TOKEN_OP_LT:
+		out->op = OP_INT_LT;
+		return 0;
+	case TOKEN_OP_LE:
+		out->op = OP_INT_LE;
+		return 0;
+	case TOKEN_OP_GT:
+		out->op = OP_INT_GT;
+		return 0;
+	case TOKEN_OP_GE:
+		out->op = OP_INT_GE;
+		return 0;
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Compile time representation of the filter: a tree with comparisons as
+ * leaves. Chains of the same logical operator are flattened into a single
+ * node, the children of which can then be freely reordered.
+ */
+struct node {
+	enum {
+		NODE_TOKEN,
+		NODE_COMPARISON,
+		NODE_AND,
+		NODE_OR,
+	} type;
+	unsigned int cost;
+	union {
+		/* NODE_TOKEN: a key or a value */
+		const struct token *token;
+		/* NODE_COMPARISON */
+		struct insn insn;
+		/* NODE_AND, NODE_OR */
+		struct {
+			struct node *first_child;
+			struct node *last_child;
+		};
+	};
+	struct node *next;
+};
+
+/* rough estimate of the relative cost of evaluating a comparison */
+static unsigned int comparison_cost(const struct insn *insn)
+{
+	unsigned int cost;
+
+	switch (insn->op) {
+	case OP_TAG_EQ:
+	case OP_TAG_NE:
+	case OP_PNAME_EQ:
+	case OP_PNAME_NE:
+		return 1;
+	case OP_TAG_IN:
+	case OP_TAG_NOT_IN:
+	case OP_PNAME_MATCH:
+	case OP_PNAME_NMATCH:
+		return 2;
+	}
+
+	switch (insn->field) {
+	case FIELD_TAG:
+		cost = 4;
+		break;
+	case FIELD_TEXT:
+		cost = 8;
+		break;
+	default:
+		return 1;
+	}
+	if (insn->op == OP_REGEX_MATCH || insn->op == OP_REGEX_NMATCH)
+		cost *= insn->regex->exact ? 2 : 8;
+	else if (insn->op == OP_CONTAINS)
+		cost *= 2;
+	return cost;
+}
+
+static void add_child(struct node *parent, struct node *child)
+{
+	struct node *first = child, *last = child;
+
+	/* flatten (a && b) && c into &&(a, b, c) */
+	if (child->type == parent->type) {
+		first = child->first_child;
+		last = child->last_child;
+	}
+	last->next = NULL;
+	if (parent->last_child)
+		parent->last_child->next = first;
+	else
+		parent->first_child = first;
+	parent->last_child = last;
+}
+
+/*
+ * Merge tag == "a" || tag == "b" || ... into a single lookup in a set of
+ * tag ids, and likewise tag != "a" && tag != "b" && ....
+ */
+static void merge_tag_sets(struct lokatt_filter *f, struct node *node)
+{
+	int op = node->type == NODE_OR ? OP_TAG_EQ : OP_TAG_NE;
+	struct node *child, *set = NULL, **p;
+	struct tag_set *ts;
+	uint32_t max_id = 0;
+	size_t count = 0;
+
+	for (child = node->first_child; child; child = child->next) {
+		if (child->type != NODE_COMPARISON || child->insn.op != op)
+			continue;
+		if (child->insn.value_id > max_id)
+			max_id = child->insn.value_id;
+		count++;
+	}
+	if (count < 2)
+		return;
+
+	ts = calloc(1, sizeof(*ts) + (max_id / 64 + 1) * sizeof(uint64_t));
+	ts->size = max_id + 1;
+	f->tag_sets[f->tag_set_count++] = ts;
+
+	/* keep the first comparison for the set, unlink the others */
+	p = &node->first_child;
+	while ((child = *p)) {
+		uint32_t id = child->insn.value_id;
+
+		if (child->type != NODE_COMPARISON || child->insn.op != op) {
+			p = &child->next;
+			continue;
+		}
+		ts->bits[id / 64] |= (uint64_t)1 << (id % 64);
+		if (set) {
+			*p = child->next;
+		} else {
+			set = child;
+			p = &child->next;
+		}
+	}
+	set->insn.op = node->type == NODE_OR ? OP_TAG_IN : OP_TAG_NOT_IN;
+	set->insn.tag_set = ts;
+}
+
+/*
+ * Rewrite && and || chains, then stable sort their operands by cost,
+ * cheapest first.
+ */
+static void optimize(struct lokatt_filter *f, struct node *node)
+{
+	struct node *sorted = NULL, *child, *next;
+
+	if (node->type == NODE_COMPARISON) {
+		node->cost = comparison_cost(&node->insn);
+		return;
+	}
+
+	for (child = node->first_child; child; child = child->next)
+		optimize(f, child);
+	merge_tag_sets(f, node);
+
+	node->cost = 0;
+	for (child = node->first_child; child; child = next) {
+		struct node **p = &sorted;
+
+		next = child->next;
+		node->cost += child->cost;
+		while (*p && (*p)->cost <= child->cost)
+			p = &(*p)->next;
+		child->next = *p;
+		*p = child;
+	}
+
+	node->first_child = sorted;
+	for (child = sorted; child->next; child = child->next)
+		;
+	node->last_child = child;
+}
+
+static void emit(struct lokatt_filter *f, const struct node *node)
+{
+	const struct node *child;
+	size_t start = f->code_count, i;
+	int op;
+
+	if (node->type == NODE_COMPARISON) {
+		f->code[f->code_count++] = node->insn;
+		return;
+	}
+
+	op = node->type == NODE_AND ? OP_JUMP_IF_FALSE : OP_JUMP_IF_TRUE;
+	for (child = node->first_child; child; child = child->next) {
+		emit(f, child);
+		if (child->next) {
+			struct insn *insn = &f->code[f->code_count++];
+			insn->op = op;
+			insn->target = 0;
+		}
+	}
+
+	/*
+	 * Point this node's jumps past its last operand. A jump never targets
+	 * position 0, so target 0 marks a jump that hasn't been resolved yet;
+	 * jumps belonging to child nodes have already been resolved.
+	 */
+	for (i = start; i < f->code_count; i++) {
+		struct insn *insn = &f->code[i];
+		if (insn->op == op && insn->target == 0)
+			insn->target = f->code_count;
+	}
+}
+
+static void add_key(struct lokatt_filter *f, const struct node *node)
+{
+	const struct insn *insn = &node->insn;
+	struct filter_key *k = &f->keys[f->key_count];
+
+	if (node->type != NODE_COMPARISON || f->key_count == FILTER_MAX_KEYS)
+		return;
+
+	if (insn->op == OP_TAG_EQ) {
+		k->key = INDEX_KEY_TAG;
+		k->value = insn->value_id;
+		k->tag = insn->value_string;
+	} else if (insn->op == OP_PNAME_EQ) {
+		k->key = INDEX_KEY_PNAME;
+		k->value = insn->value_id;
+	} else if (insn->op == OP_INT_EQ) {
+		switch (insn->field) {
+		case FIELD_PID:
+			k->key = INDEX_KEY_PID;
+			break;
+		case FIELD_TID:
+			k->key = INDEX_KEY_TID;
+			break;
+		case FIELD_LEVEL:
+			k->key = INDEX_KEY_LEVEL;
+			break;
+		default:
+			return;
+		}
+		k->value = insn->value_int;
+	} else {
+		return;
+	}
+	f->key_count++;
+}
+
+/*
+ * Find the indexed equalities that must hold for the filter to match: the
+ * root itself, or operands of a root && chain.
+ */
+static void plan(struct lokatt_filter *f, const struct node *root)
+{
+	const struct node *child;
+
+	f->key_count = 0;
+	if (root->type != NODE_AND) {
+		add_key(f, root);
+		return;
+	}
+	for (child = root->first_child; child; child = child->next)
+		add_key(f, child);
+}
+
+static int is_column_comparison(const struct node *node)
+{
+	switch (node->insn.op) {
+	case OP_INT_EQ:
+	case OP_INT_NE:
+	case OP_INT_LT:
+	case OP_INT_LE:
+	case OP_INT_GT:
+	case OP_INT_GE:
+	case OP_TAG_EQ:
+	case OP_TAG_NE:
+	case OP_TAG_IN:
+	case OP_TAG_NOT_IN:
+	case OP_PNAME_EQ:
+	case OP_PNAME_NE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* does the column program for 'node' select less than everything? */
+static int constrains(const struct node *node)
+{
+	const struct node *child;
+
+	if (node->type == NODE_COMPARISON)
+		return is_column_comparison(node);
+	for (child = node->first_child; child; child = child->next) {
+		if (node->type == NODE_AND && constrains(child))
+			return 1;
+		if (node->type == NODE_OR && !constrains(child))
+			return 0;
+	}
+	return node->type == NODE_OR;
+}
+
+/*
+ * Emit the column program for 'node', which leaves its result at stack
+ * position 'depth'. Operands that don't constrain anything are left out.
+ */
+static void emit_columns(struct lokatt_filter *f, const struct node *node,
+			 size_t depth, size_t *max_depth)
+{
+	struct column_insn *insn;
+	const struct node *child;
+	int first = 1;
+
+	if (depth > *max_depth)
+		*max_depth = depth;
+
+	if (node->type != NODE_COMPARISON) {
+		for (child = node->first_child; child; child = child->next) {
+			if (!constrains(child))
+				continue;
+			emit_columns(f, child, first ? depth : depth + 1,
+				     max_depth);
+			if (!first) {
+				insn = &f->columns[f->column_count++];
+				insn->op = node->type == NODE_AND ?
+					COL_AND : COL_OR;
+			}
+			first = 0;
+		}
+		return;
+	}
+
+	insn = &f->columns[f->column_count++];
+	switch (node->insn.op) {
+	case OP_TAG_IN:
+	case OP_TAG_NOT_IN:
+		insn->op = node->insn.op == OP_TAG_IN ?
+			COL_IN_SET : COL_NOT_IN_SET;
+		insn->tag_set = node->insn.tag_set;
+		break;
+	case OP_TAG_EQ:
+	case OP_TAG_NE:
+		insn->op = COL_COMPARE;
+		insn->field = FIELD_TAG;
+		insn->compare = node->insn.op == OP_TAG_EQ ?
+			COLUMN_EQ : COLUMN_NE;
+		insn->value = node->insn.value_id;
+		break;
+	case OP_PNAME_EQ:
+	case OP_PNAME_NE:
+		insn->op = COL_COMPARE;
+		insn->field = FIELD_PNAME;
+		insn->compare = node->insn.op == OP_PNAME_EQ ?
+			COLUMN_EQ : COLUMN_NE;
+		insn->value = node->insn.value_id;
+		break;
+	default:
+		/* OP_INT_* and COLUMN_* are in the same order */
+		insn->op = COL_COMPARE;
+		insn->field = node->insn.field;
+		insn->compare = COLUMN_EQ + (node->insn.op - OP_INT_EQ);
+		insn->value = node->insn.value_int;
+		break;
+	}
+}
+
+/* does every comparison of the filter have a column instruction? */
+static int all_columns(const struct node *node)
+{
+	const struct node *child;
+
+	if (node->type == NODE_COMPARISON)
+		return is_column_comparison(node);
+	for (child = node->first_child; child; child = child->next) {
+		if (!all_columns(child))
+			return 0;
+	}
+	return 1;
+}
+
+static void plan_columns(struct lokatt_filter *f, const struct node *root)
+{
+	size_t max_depth = 0;
+
+	f->column_count = 0;
+	f->columns_exact = 0;
+	if (!constrains(root))
+		return;
+
+	/* one instruction per comparison and per && or ||, at most */
+	f->columns = calloc(f->rpn_count, sizeof(struct column_insn));
+	emit_columns(f, root, 1, &max_depth);
+	if (max_depth > FILTER_MAX_DEPTH) {
+		f->column_count = 0;
+		return;
+	}
+	f->columns_exact = all_columns(root);
+}
+
+static int compile(struct lokatt_filter *f)
+{
+	struct node *nodes, *root;
+	size_t i, node_count = 0;
+	struct stack stack;
+	struct node **p;
+	int retval = -1;
+
+	nodes = calloc(f->rpn_count, sizeof(struct node));
+	/* one regex per comparison, at most */
+	f->regexes = calloc(f->rpn_count, sizeof(struct regex));
+	f->searches = calloc(f->rpn_count, sizeof(struct search));
+	f->tag_sets = calloc(f->rpn_count, sizeof(struct tag_set *));
+	stack_init(&stack, sizeof(struct node *));
+
+	for (i = 0; i < f->rpn_count; i++) {
+		const struct token *t = f->rpn[i];
+		struct node *node = &nodes[node_count++];
+		struct node *left, *right;
+
+		if (!is_operator(t->type)) {
+			node->type = NODE_TOKEN;
+			node->token = t;
+			p = stack_push(&stack);
+			*p = node;
+			continue;
+		}
+
+		if (stack.current_size < 2)
+			goto bail;
+		right = *(struct node **)stack_top(&stack);
+		stack_pop(&stack);
+		left = *(struct node **)stack_top(&stack);
+		stack_pop(&stack);
+
+		if (is_logical_operator(t->type)) {
+			if (left->type == NODE_TOKEN ||
+			    right->type == NODE_TOKEN)
+				goto bail;
+			node->type = t->type == TOKEN_OP_AND ?
+				NODE_AND : NODE_OR;
+			node->first_child = node->last_child = NULL;
+			add_child(node, left);
+			add_child(node, right);
+		} else {
+			if (left->type != NODE_TOKEN ||
+			    right->type != NODE_TOKEN)
+				goto bail;
+			node->type = NODE_COMPARISON;
+			if (compile_comparison(f, t, left->token,
+					       right->token, &node->insn))
+				goto bail;
+		}
+
+		p = stack_push(&stack);
+		*p = node;
+	}
+
+	if (stack.current_size != 1)
+		goto bail;
+	root = *(struct node **)stack_top(&stack);
+	if (root->type == NODE_TOKEN)
+		goto bail;
+
+	optimize(f, root);
+	plan(f, root);
+	plan_columns(f, root);
+	/* one instruction per comparison and per && or ||, at most */
+	f->code = calloc(f->rpn_count, sizeof(struct insn));
+	f->code_count = 0;
+	emit(f, root);
+	retval = 0;
+bail:
+	stack_destroy(&stack);
+	free(nodes);
+	return retval;
+}
+
 struct lokatt_filter *lokatt_create_filter(unsigned int event_bitmask,
 					   const char *spec)
 {
-	static struct lokatt_message dummy_msg = {
-		.pid = 0,
-		.tid = 0,
-		.sec = 0,
-		.nsec = 0,
-		.level = LEVEL_ASSERT,
-		.tag = "",
-		.text = "",
-	};
 	struct lokatt_filter *f = calloc(1, sizeof(*f));
 
 	if (spec) {
@@ -264,8 +1136,8 @@ struct lokatt_filter *lokatt_create_filter(unsigned int event_bitmask,
 					 &f->rpn_count))
 			goto bail;
 
-		/* check for syntax error, eg "tag == tag" */
-		if (filter_match_message(f, &dummy_msg) == -1)
+		/* also checks for type errors, eg "tag == tag" */
+		if (compile(f))
 			goto bail;
 	}
 
@@ -279,209 +1151,378 @@ bail:
 
 void lokatt_destroy_filter(struct lokatt_filter *f)
 {
+	size_t i;
+
+	for (i = 0; i < f->regex_count; i++) {
+		regfree(&f->regexes[i].re);
+		if (f->regexes[i].has_literal)
+			search_destroy(&f->regexes[i].literal);
+		free(f->regexes[i].memo);
+	}
+	free(f->regexes);
+	for (i = 0; i < f->search_count; i++)
+		search_destroy(&f->searches[i]);
+	free(f->searches);
+	for (i = 0; i < f->tag_set_count; i++)
+		free(f->tag_sets[i]);
+	free(f->tag_sets);
+	free(f->columns);
+	free(f->code);
 	free(f->rpn);
 	filter_free_tokens(f->tokens, f->token_count);
 	free(f);
 }
 
-static int get_int(const struct token *t, const struct lokatt_message *msg,
-		   int32_t *out)
+void filter_key(const struct lokatt_filter *f, struct strbuf *out)
 {
-	switch (t->type) {
-	case TOKEN_KEY_PID:
-		*out = msg->pid;
-		return 0;
-	case TOKEN_KEY_TID:
-		*out = msg->tid;
-		return 0;
-	case TOKEN_KEY_SEC:
-		*out = msg->sec;
-		return 0;
-	case TOKEN_KEY_NSEC:
-		*out = msg->nsec;
-		return 0;
-	case TOKEN_KEY_LEVEL:
-		*out = msg->level;
-		return 0;
-	default:
-		return -1;
+	const struct token *t;
+	size_t i;
+
+	strbuf_addf(out, "%x", f->event_bitmask);
+	for (i = 0; i < f->rpn_count; i++) {
+		t = f->rpn[i];
+		strbuf_addf(out, " %d", t->type);
+		if (t->type == TOKEN_VALUE_INT) {
+			strbuf_addf(out, ":%d", t->value_int);
+		} else if (t->type == TOKEN_VALUE_STRING) {
+			/* length prefixed, as the string may contain spaces */
+			strbuf_addf(out, ":%zu:", t->value_string.str_size);
+			strbuf_add(out, t->value_string.buf,
+				   t->value_string.str_size);
+		}
 	}
 }
 
-static int get_string(const struct token *t, const struct lokatt_message *msg,
-		      const char **out)
+static inline int32_t get_int(int field, const struct lokatt_message *msg)
 {
-	switch (t->type) {
-	case TOKEN_KEY_TAG:
-		*out = msg->tag ? msg->tag : "";
-		return 0;
-	case TOKEN_KEY_TEXT:
-		*out = msg->text ? msg->text : "";
-		return 0;
+	switch (field) {
+	case FIELD_PID:
+		return msg->pid;
+	case FIELD_TID:
+		return msg->tid;
+	case FIELD_SEC:
+		return msg->sec;
+	case FIELD_NSEC:
+		return msg->nsec;
 	default:
-		return -1;
+		return msg->level;
 	}
 }
 
-static int evaluate_eq(const struct token *left,
-		       const struct token *right,
-		       const struct lokatt_message *msg,
-		       int *out)
+static inline const char *get_string(int field,
+				     const struct lokatt_message *msg)
 {
-	if (!is_key(left->type))
-		return -1;
-	if (!is_value(right->type))
-		return -1;
+	const char *str;
+
+	switch (field) {
+	case FIELD_TAG:
+		str = msg->tag;
+		break;
+	case FIELD_PNAME:
+		str = msg->pname;
+		break;
+	default:
+		str = msg->text;
+		break;
+	}
+	return str ? str : "";
+}
 
-	if (right->type == TOKEN_VALUE_INT) {
-		int32_t value;
-		if (get_int(left, msg, &value))
-			return -1;
-		*out = value == right->value_int;
-		return 0;
-	} else {
-		const char *str;
-		if (get_string(left, msg, &str))
-			return -1;
-		*out = !strcmp(str, right->value_string.buf);
+static inline int string_equals(const struct insn *insn,
+				const struct lokatt_message *msg)
+{
+	/* unknown process names equal nothing, not even "" */
+	if (insn->field == FIELD_PNAME && !msg->pname)
 		return 0;
+	return !strcmp(get_string(insn->field, msg), insn->value_string);
+}
+
+static int regex_match(const struct regex *r, const char *str)
+{
+	if (r->anchored) {
+		if (strncmp(str, r->literal.needle, r->literal.size))
+			return 0;
+	} else if (r->has_literal) {
+		if (!search_find(&r->literal, str))
+			return 0;
 	}
+	if (r->exact)
+		return 1;
+	return !regexec(&r->re, str, 0, NULL, 0);
 }
 
-static int evaluate_lt(const struct token *left,
-		       const struct token *right,
-		       const struct lokatt_message *msg,
-		       int *out)
+static inline uint32_t get_tag_id(const struct lokatt_message *msg,
+				  uint32_t *tag_id)
 {
-	int32_t value;
+	if (*tag_id == INTERN_NONE)
+		*tag_id = intern_find(msg->tag);
+	return *tag_id;
+}
 
-	if (!is_key(left->type))
-		return -1;
-	if (right->type != TOKEN_VALUE_INT)
-		return -1;
-	if (get_int(left, msg, &value))
-		return -1;
-	*out = value < right->value_int;
-	return 0;
+static inline uint32_t get_pname_id(const struct lokatt_message *msg,
+				    uint32_t *pname_id)
+{
+	if (*pname_id == INTERN_NONE && msg->pname)
+		*pname_id = intern_find(msg->pname);
+	return *pname_id;
+}
+
+/*
+ * Concurrent matches may both run the regex and store the same result, so
+ * the memo needs no lock.
+ */
+static int pname_match(const struct regex *r,
+		       const struct lokatt_message *msg, uint32_t *pname_id)
+{
+	uint32_t id = get_pname_id(msg, pname_id);
+	uint8_t result;
+	int match;
+
+	if (id == INTERN_NONE || id >= PNAME_MEMO_SIZE)
+		return regex_match(r, get_string(FIELD_PNAME, msg));
+	result = __atomic_load_n(&r->memo[id], __ATOMIC_RELAXED);
+	if (result != MEMO_UNKNOWN)
+		return result == MEMO_MATCH;
+	match = regex_match(r, get_string(FIELD_PNAME, msg));
+	__atomic_store_n(&r->memo[id], match ? MEMO_MATCH : MEMO_NO_MATCH,
+			 __ATOMIC_RELAXED);
+	return match;
+}
+
+static inline int in_tag_set(const struct tag_set *ts, uint32_t id)
+{
+	return id < ts->size && (ts->bits[id / 64] >> (id % 64)) & 1;
 }
 
 /*
  * Return value:
  *   - '0': match
  *   - '> 0': no match
- *   - '< 0': internal error
  */
 int filter_match_message(const struct lokatt_filter *f,
-			 const struct lokatt_message *msg)
+			 const struct lokatt_message *msg, uint32_t tag_id,
+			 uint32_t pname_id)
 {
-	static const struct token TRUE = {
-		.type = TOKEN_TRUE,
-	};
-	static const struct token FALSE = {
-		.type = TOKEN_FALSE,
-	};
+	size_t i = 0;
+	int acc = 0;
+
+	while (i < f->code_count) {
+		const struct insn *insn = &f->code[i++];
+
+		switch (insn->op) {
+		case OP_INT_EQ:
+			acc = get_int(insn->field, msg) == insn->value_int;
+			break;
+		case OP_INT_NE:
+			acc = get_int(insn->field, msg) != insn->value_int;
+			break;
+		case OP_INT_LT:
+			acc = get_int(insn->field, msg) < insn->value_int;
+			break;
+		case OP_INT_LE:
+			acc = get_int(insn->field, msg) <= insn->value_int;
+			break;
+		case OP_INT_GT:
+			acc = get_int(insn->field, msg) > insn->value_int;
+			break;
+		case OP_INT_GE:
+			acc = get_int(insn->field, msg) >= insn->value_int;
+			break;
+		case OP_STR_EQ:
+			acc = string_equals(insn, msg);
+			break;
+		case OP_STR_NE:
+			acc = !string_equals(insn, msg);
+			break;
+		case OP_TAG_EQ:
+			acc = get_tag_id(msg, &tag_id) == insn->value_id;
+			break;
+		case OP_TAG_NE:
+			acc = get_tag_id(msg, &tag_id) != insn->value_id;
+			break;
+		case OP_TAG_IN:
+			acc = in_tag_set(insn->tag_set,
+					 get_tag_id(msg, &tag_id));
+			break;
+		case OP_TAG_NOT_IN:
+			acc = !in_tag_set(insn->tag_set,
+					  get_tag_id(msg, &tag_id));
+			break;
+		case OP_PNAME_EQ:
+			acc = get_pname_id(msg, &pname_id) == insn->value_id;
+			break;
+		case OP_PNAME_NE:
+			acc = get_pname_id(msg, &pname_id) != insn->value_id;
+			break;
+		case OP_PNAME_MATCH:
+			acc = pname_match(insn->regex, msg, &pname_id);
+			break;
+		case OP_PNAME_NMATCH:
+			acc = !pname_match(insn->regex, msg, &pname_id);
+			break;
+		case OP_REGEX_MATCH:
+			acc = regex_match(insn->regex,
+					  get_string(insn->field, msg));
+			break;
+		case OP_REGEX_NMATCH:
+			acc = !regex_match(insn->regex,
+					   get_string(insn->field, msg));
+			break;
+		case OP_CONTAINS:
+			acc = search_find(insn->search,
+					  get_string(insn->field, msg));
+			break;
+		case OP_JUMP_IF_FALSE:
+			if (!acc)
+				i = insn->target;
+			break;
+		case OP_JUMP_IF_TRUE:
+			if (acc)
+				i = insn->target;
+			break;
+		}
+	}
 
-	struct stack stack;
-	const struct token *t;
-	const struct token **p;
-	int retval = -1;
+	return acc ? 0 : 1;
+}
 
-	stack_init(&stack, sizeof(struct token *));
-	for (size_t i = 0; i < f->rpn_count; i++) {
-		t = f->rpn[i];
+uint64_t filter_seek(const struct lokatt_filter *f, struct index *idx,
+		     uint64_t id)
+{
+	unsigned int types = f->event_bitmask &
+		(EVENT_DEVICE_DISCONNECTED | EVENT_DEVICE_CONNECTED);
+	uint64_t next = UINT64_MAX, candidate;
+	unsigned int type;
+	size_t i;
 
-		if (is_operator(t->type)) {
-			struct token **left, **right;
-			int a, b;
+	if (f->event_bitmask & EVENT_LOGCAT_MESSAGE) {
+		if (f->key_count == 0)
+			return id;
+		/* leapfrog until all posting lists agree on a candidate */
+		next = id;
+		do {
+			candidate = next;
+			for (i = 0; i < f->key_count; i++)
+				next = index_seek(idx, f->keys[i].key,
+						  f->keys[i].value, next);
+		} while (next != candidate);
+	}
 
-			if (stack.current_size < 2)
-				goto bail;
+	/* other events are indexed by type */
+	for (type = 1; types; type <<= 1) {
+		if (!(types & type))
+			continue;
+		types &= ~type;
+		candidate = index_seek(idx, INDEX_KEY_TYPE, type, id);
+		if (candidate < next)
+			next = candidate;
+	}
 
-			right = stack_top(&stack);
-			stack_pop(&stack);
-			left = stack_top(&stack);
-			stack_pop(&stack);
-
-			switch (t->type) {
-			case TOKEN_OP_EQ:
-				if (evaluate_eq(*left, *right, msg, &a))
-					goto bail;
-				t = a ? &TRUE : &FALSE;
-				break;
-			case TOKEN_OP_NE:
-				if (evaluate_eq(*left, *right, msg, &a))
-					goto bail;
-				t = !a ? &TRUE : &FALSE;
-				break;
-			case TOKEN_OP_LT:
-				if (evaluate_lt(*left, *right, msg, &a))
-					goto bail;
-				t = a ? &TRUE : &FALSE;
-				break;
-			case TOKEN_OP_LE:
-				if (evaluate_lt(*left, *right, msg, &a))
-					goto bail;
-				if (evaluate_eq(*left, *right, msg, &b))
-					goto bail;
-				t = a || b ? &TRUE : &FALSE;
-				break;
-			case TOKEN_OP_GT:
-				if (evaluate_lt(*left, *right, msg, &a))
-					goto bail;
-				if (evaluate_eq(*left, *right, msg, &b))
-					goto bail;
-				t = !a && !b ? &TRUE : &FALSE;
-				break;
-			case TOKEN_OP_GE:
-				if (evaluate_lt(*left, *right, msg, &a))
-					goto bail;
-				t = !a ? &TRUE : &FALSE;
-				break;
-			case TOKEN_OP_AND:
-				if (*right != &TRUE && *right != &FALSE)
-					goto bail;
-				if (*left != &TRUE && *left != &FALSE)
-					goto bail;
-				a = *left == &TRUE;
-				b = *right == &TRUE;
-				t = a && b ? &TRUE : &FALSE;
-				break;
-			case TOKEN_OP_OR:
-				if (*right != &TRUE && *right != &FALSE)
-					goto bail;
-				if (*left != &TRUE && *left != &FALSE)
-					goto bail;
-				a = *left == &TRUE;
-				b = *right == &TRUE;
-				t = a || b ? &TRUE : &FALSE;
-				break;
-			default:
-				goto bail;
-			}
+	return next == UINT64_MAX ? id : next;
+}
+
+static const int32_t *get_column(const struct index_columns *c, int field)
+{
+	switch (field) {
+	case FIELD_PID:
+		return c->pid;
+	case FIELD_TID:
+		return c->tid;
+	case FIELD_SEC:
+		return c->sec;
+	case FIELD_NSEC:
+		return c->nsec;
+	case FIELD_LEVEL:
+		return c->level;
+	case FIELD_PNAME:
+		return (const int32_t *)c->pname_id;
+	default:
+		return (const int32_t *)c->tag_id;
+	}
+}
+
+uint64_t filter_select(const struct lokatt_filter *f,
+		       const struct index_columns *c, uint64_t id)
+{
+	uint64_t stack[FILTER_MAX_DEPTH], types, logcat;
+	uint64_t slot = id & c->mask;
+	size_t i, n = 0;
+
+	types = column_test(c->type + slot, f->event_bitmask);
+	if (!(f->event_bitmask & EVENT_LOGCAT_MESSAGE) ||
+	    f->column_count == 0)
+		return types;
+
+	for (i = 0; i < f->column_count; i++) {
+		const struct column_insn *insn = &f->columns[i];
+
+		switch (insn->op) {
+		case COL_COMPARE:
+			stack[n++] = column_compare(get_column(c, insn->field) +
+						    slot, insn->compare,
+						    insn->value);
+			break;
+		case COL_IN_SET:
+		case COL_NOT_IN_SET:
+			stack[n] = column_in_set(c->tag_id + slot,
+						 insn->tag_set->bits,
+						 insn->tag_set->size);
+			if (insn->op == COL_NOT_IN_SET)
+				stack[n] = ~stack[n];
+			n++;
+			break;
+		case COL_AND:
+			n--;
+			stack[n - 1] &= stack[n];
+			break;
+		case COL_OR:
+			n--;
+			stack[n - 1] |= stack[n];
+			break;
 		}
+	}
 
-		p = stack_push(&stack);
-		*p = t;
+	/* the program only applies to logcat messages */
+	logcat = column_test(c->type + slot, EVENT_LOGCAT_MESSAGE);
+	return types & (~logcat | stack[0]);
+}
+
+unsigned int filter_event_bitmask(const struct lokatt_filter *f)
+{
+	return f->event_bitmask;
+}
+
+const char *filter_required_tag(const struct lokatt_filter *f)
+{
+	size_t i;
+
+	for (i = 0; i < f->key_count; i++) {
+		if (f->keys[i].key == INDEX_KEY_TAG)
+			return f->keys[i].tag;
 	}
+	return NULL;
+}
 
-	if (stack.current_size != 1)
-		goto bail;
-	p = stack_top(&stack);
-	if (*p == &TRUE)
-		retval = 0;
-	else if (*p == &FALSE)
-		retval = 1;
-bail:
-	stack_destroy(&stack);
-	return retval;
+int filter_select_exact(const struct lokatt_filter *f)
+{
+	return !(f->event_bitmask & EVENT_LOGCAT_MESSAGE) ||
+		!f->token_count || f->columns_exact;
 }
 
-int lokatt_filter_match(const struct lokatt_filter *f,
-			const struct lokatt_event *event)
+int filter_match_event(const struct lokatt_filter *f, int type,
+		       const struct lokatt_message *msg, uint32_t tag_id,
+		       uint32_t pname_id)
 {
-	if (!(f->event_bitmask & event->type))
+	if (!(f->event_bitmask & type))
 		return 0;
-	if ((event->type & EVENT_LOGCAT_MESSAGE) && f->token_count)
-		return filter_match_message(f, &event->msg) == 0;
+	if ((type & EVENT_LOGCAT_MESSAGE) && f->token_count)
+		return filter_match_message(f, msg, tag_id, pname_id) == 0;
 	return 1;
 }
+
+int lokatt_filter_match(const struct lokatt_filter *f,
+			const struct lokatt_event *event)
+{
+	return filter_match_event(f, event->type, &event->msg, INTERN_NONE,
+				  INTERN_NONE);
+}
@@ -1,8 +1,12 @@
 #ifndef LIBLOKATT_FILTER_H
 #define LIBLOKATT_FILTER_H
 
+#include <stdint.h>
+
 #include "strbuf.h"
 
+struct index;
+struct index_columns;
 struct lokatt_filter;
 struct lokatt_message;
 
@@ -40,6 +44,8 @@ struct token {
 		TOKEN_OP_GE,      /*  >=  */
 		TOKEN_OP_MATCH,   /*  =~  */
 		TOKEN_OP_NMATCH,  /*  !~  */
+		TOKEN_OP_CONTAINS,  /*  contains   */
+		TOKEN_OP_ICONTAINS, /*  icontains  */
 	} type;
 
 	union {
@@ -54,7 +60,54 @@ void filter_free_tokens(struct token *tokens, size_t size);
 int filter_tokens_as_rpn(const struct token *tokens, size_t token_count,
 			 struct token ***out, size_t *out_size);
 
+/*
+ * Append the canonical form of 'f' to 'out': filters that differ only in
+ * whitespace or redundant parentheses get the same key.
+ */
+void filter_key(const struct lokatt_filter *f, struct strbuf *out);
+
+/*
+ * 'tag_id' and 'pname_id' are the interned ids of msg->tag and msg->pname
+ * (see intern.h), or INTERN_NONE, in which case they are looked up if
+ * needed.
+ */
 int filter_match_message(const struct lokatt_filter *f,
-			 const struct lokatt_message *msg);
+			 const struct lokatt_message *msg, uint32_t tag_id,
+			 uint32_t pname_id);
+
+/*
+ * Return the first id >= 'id' of an event in 'idx' that may match 'f',
+ * using the posting lists of the index to skip events that can't. Must be
+ * called between index_read_begin and index_read_end.
+ */
+uint64_t filter_seek(const struct lokatt_filter *f, struct index *idx,
+		     uint64_t id);
+
+/*
+ * Return a bitmap of the events in the block of 64 ids starting at 'id', a
+ * multiple of 64, that may match 'f': bit i is set for event 'id' + i. The
+ * comparisons on integer fields and tags are evaluated on the columns of
+ * the index (see index.h), the others are assumed to match. Bits for ids
+ * outside [index_resident_id, current_size) are meaningless. Must be
+ * called between index_read_begin and index_read_end.
+ */
+uint64_t filter_select(const struct lokatt_filter *f,
+		       const struct index_columns *c, uint64_t id);
+
+/* returns non-zero if filter_select selects exactly the matches of 'f' */
+int filter_select_exact(const struct lokatt_filter *f);
+
+unsigned int filter_event_bitmask(const struct lokatt_filter *f);
+
+/*
+ * Return the tag every logcat message matching 'f' has, or NULL if 'f'
+ * doesn't require any particular tag.
+ */
+const char *filter_required_tag(const struct lokatt_filter *f);
+
+/* returns non-zero on match; 'msg' is only used for EVENT_LOGCAT_MESSAGE */
+int filter_match_event(const struct lokatt_filter *f, int type,
+		       const struct lokatt_message *msg, uint32_t tag_id,
+		       uint32_t pname_id);
 
 #endif
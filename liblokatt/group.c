@@ -0,0 +1,326 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "adb.h"
+#include "backend.h"
+#include "error.h"
+#include "group.h"
+#include "index.h"
+#include "intern.h"
+#include "lokatt.h"
+#include "procs.h"
+
+#define MAX_EVENTS 64
+
+/* messages read from a member before moving on to the next one */
+#define INGEST_BATCH 256
+
+struct group_member {
+	struct group_member *prev, *next;
+	void *backend;
+	struct backend_ops *ops;
+	struct index *idx;
+	struct procs procs;
+	/* the first and last message appended without a process name */
+	uint64_t unnamed, last_unnamed;
+	/* the index size when the last listing started, see poll_procs */
+	uint64_t listing_from;
+	unsigned long listings;
+	/* -1 if the backend never blocks, see backend.h */
+	int fd;
+	/* stopped at INGEST_BATCH: more may be buffered, fd or not */
+	struct group_member *next_pending;
+	int pending;
+	/* removed, but epoll_wait may have returned it: freed later */
+	int dead;
+};
+
+/*
+ * One thread waits for the members' fds with epoll, level-triggered, and
+ * reads up to INGEST_BATCH messages from each member that is ready, so
+ * that a busy device can't starve the others. Members without an fd are
+ * always ready, and are read from on every turn of the loop, as are those
+ * that stopped at the batch limit: backends buffer what they read, so
+ * their fd isn't readable even though messages are waiting. The thread
+ * holds the lock while reading, so removing a member waits for it.
+ */
+struct lokatt_group {
+	int epfd;
+	int wakeup;
+	pthread_t thread;
+
+	pthread_mutex_t lock;
+	int stop;
+	/* members without an fd */
+	struct group_member *ready;
+	struct group_member *pending;
+	struct group_member *dead;
+};
+
+static void wake(struct lokatt_group *g)
+{
+	uint64_t one = 1;
+
+	if (write(g->wakeup, &one, sizeof(one)) < 0)
+		die("write");
+}
+
+static void list_add(struct group_member **list, struct group_member *m)
+{
+	m->prev = NULL;
+	m->next = *list;
+	if (*list)
+		(*list)->prev = m;
+	*list = m;
+}
+
+static void list_del(struct group_member **list, struct group_member *m)
+{
+	if (m->prev)
+		m->prev->next = m->next;
+	else
+		*list = m->next;
+	if (m->next)
+		m->next->prev = m->prev;
+}
+
+/* Stop reading from 'm', eg. at the end of its data. */
+static void retire_member(struct lokatt_group *g, struct group_member *m)
+{
+	struct group_member **p;
+
+	if (m->pending) {
+		for (p = &g->pending; *p != m; p = &(*p)->next_pending)
+			;
+		*p = m->next_pending;
+		m->pending = 0;
+	}
+	if (m->fd >= 0)
+		epoll_ctl(g->epfd, EPOLL_CTL_DEL, m->fd, NULL);
+	else
+		list_del(&g->ready, m);
+	m->fd = -1;
+	m->dead = 1;
+}
+
+static uint32_t find_pname(void *data, int32_t pid)
+{
+	return procs_find(data, pid);
+}
+
+static void track_listing(struct group_member *m)
+{
+	if (m->procs.started != m->listings) {
+		m->listings = m->procs.started;
+		m->listing_from = index_size(m->idx);
+	}
+}
+
+/*
+ * Name the messages appended without a process name once a listing is
+ * done. Those from before it started that it can't name are of processes
+ * gone already: only newer ones are left for the next listing to name.
+ */
+static void poll_procs(struct group_member *m)
+{
+	if (procs_poll(&m->procs) && m->unnamed != UINT64_MAX) {
+		index_name_processes(m->idx, m->unnamed, find_pname,
+				     &m->procs);
+		m->unnamed = m->last_unnamed >= m->listing_from ?
+			m->listing_from : UINT64_MAX;
+	}
+	track_listing(m);
+}
+
+static void append_message(struct group_member *m,
+			   const struct adb_message *msg)
+{
+	uint32_t pname_id = procs_lookup(&m->procs, msg->pid);
+
+	track_listing(m);
+	if (pname_id == INTERN_NONE) {
+		m->last_unnamed = index_size(m->idx);
+		if (m->unnamed == UINT64_MAX)
+			m->unnamed = m->last_unnamed;
+	}
+	index_append(m->idx, EVENT_LOGCAT_MESSAGE, msg, pname_id);
+}
+
+static void ingest(struct lokatt_group *g, struct group_member *m)
+{
+	struct adb_message msg;
+	int i, status;
+
+	/* the backend's fd may be ready for the listing rather than messages */
+	poll_procs(m);
+	for (i = 0; i < INGEST_BATCH; i++) {
+		status = m->ops->next_logcat_message(m->backend, &msg);
+		switch (status) {
+		case 0:
+			append_message(m, &msg);
+			break;
+		case BACKEND_AGAIN:
+			return;
+		case BACKEND_DISCONNECTED:
+			index_append(m->idx, EVENT_DEVICE_DISCONNECTED, NULL,
+				     INTERN_NONE);
+			break;
+		case BACKEND_CONNECTED:
+			/* the device may have rebooted, reusing pids */
+			procs_forget(&m->procs);
+			track_listing(m);
+			m->unnamed = UINT64_MAX;
+			index_append(m->idx, EVENT_DEVICE_CONNECTED, NULL,
+				     INTERN_NONE);
+			break;
+		default:
+			retire_member(g, m);
+			return;
+		}
+	}
+	if (m->fd >= 0 && !m->pending) {
+		m->pending = 1;
+		m->next_pending = g->pending;
+		g->pending = m;
+	}
+}
+
+static void *ingest_main(void *arg)
+{
+	struct lokatt_group *g = arg;
+	struct epoll_event events[MAX_EVENTS];
+	struct group_member *m, *next;
+	uint64_t count;
+	int i, n, timeout;
+
+	pthread_mutex_lock(&g->lock);
+	while (!g->stop) {
+		while (g->dead) {
+			m = g->dead;
+			g->dead = m->next;
+			procs_destroy(&m->procs);
+			free(m);
+		}
+		/* members added while waiting wake the thread up */
+		timeout = g->ready || g->pending ? 0 : -1;
+		pthread_mutex_unlock(&g->lock);
+
+		n = epoll_wait(g->epfd, events, MAX_EVENTS, timeout);
+
+		pthread_mutex_lock(&g->lock);
+		m = g->pending;
+		g->pending = NULL;
+		for (; m; m = next) {
+			next = m->next_pending;
+			m->pending = 0;
+			ingest(g, m);
+		}
+		for (i = 0; i < n; i++) {
+			m = events[i].data.ptr;
+			if (!m) {
+				if (read(g->wakeup, &count, sizeof(count)) < 0)
+					die("read");
+				continue;
+			}
+			if (!m->dead)
+				ingest(g, m);
+		}
+		for (m = g->ready; m; m = next) {
+			next = m->next;
+			ingest(g, m);
+		}
+	}
+	pthread_mutex_unlock(&g->lock);
+	return NULL;
+}
+
+struct lokatt_group *lokatt_create_group(void)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	struct lokatt_group *g = calloc(1, sizeof(*g));
+
+	if (!g)
+		die("calloc");
+	g->epfd = epoll_create1(EPOLL_CLOEXEC);
+	g->wakeup = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (g->epfd < 0 || g->wakeup < 0 ||
+	    epoll_ctl(g->epfd, EPOLL_CTL_ADD, g->wakeup, &ev) < 0)
+		goto bail;
+	pthread_mutex_init(&g->lock, NULL);
+	if (pthread_create(&g->thread, NULL, ingest_main, g)) {
+		pthread_mutex_destroy(&g->lock);
+		goto bail;
+	}
+	return g;
+bail:
+	if (g->epfd >= 0)
+		close(g->epfd);
+	if (g->wakeup >= 0)
+		close(g->wakeup);
+	free(g);
+	return NULL;
+}
+
+void lokatt_destroy_group(struct lokatt_group *g)
+{
+	struct group_member *m;
+
+	pthread_mutex_lock(&g->lock);
+	g->stop = 1;
+	wake(g);
+	pthread_mutex_unlock(&g->lock);
+	pthread_join(g->thread, NULL);
+
+	while (g->dead) {
+		m = g->dead;
+		g->dead = m->next;
+		procs_destroy(&m->procs);
+		free(m);
+	}
+	pthread_mutex_destroy(&g->lock);
+	close(g->epfd);
+	close(g->wakeup);
+	free(g);
+}
+
+struct group_member *group_add(struct lokatt_group *g, void *backend,
+			       struct backend_ops *ops, struct index *idx)
+{
+	struct group_member *m = calloc(1, sizeof(*m));
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	if (!m)
+		die("calloc");
+	m->backend = backend;
+	m->ops = ops;
+	m->idx = idx;
+	m->unnamed = UINT64_MAX;
+	procs_init(&m->procs, backend, ops);
+	track_listing(m);
+	m->fd = ops->pollable_fd(backend);
+
+	pthread_mutex_lock(&g->lock);
+	ev.data.ptr = m;
+	if (m->fd < 0 || epoll_ctl(g->epfd, EPOLL_CTL_ADD, m->fd, &ev) < 0) {
+		m->fd = -1;
+		list_add(&g->ready, m);
+	}
+	wake(g);
+	pthread_mutex_unlock(&g->lock);
+	return m;
+}
+
+void group_remove(struct lokatt_group *g, struct group_member *m)
+{
+	pthread_mutex_lock(&g->lock);
+	if (!m->dead)
+		retire_member(g, m);
+	/* the thread may still have it from epoll_wait: free it there */
+	m->next = g->dead;
+	g->dead = m;
+	pthread_mutex_unlock(&g->lock);
+}
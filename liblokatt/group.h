@@ -0,0 +1,20 @@
+#ifndef LIBLOKATT_GROUP_H
+#define LIBLOKATT_GROUP_H
+
+struct backend_ops;
+struct group_member;
+struct index;
+struct lokatt_group;
+
+/*
+ * Have the group's thread read the messages of 'backend' into 'idx'. The
+ * backend is switched to non-blocking mode. Returns the membership, to be
+ * passed to group_remove before the backend is destroyed.
+ */
+struct group_member *group_add(struct lokatt_group *g, void *backend,
+			       struct backend_ops *ops, struct index *idx);
+
+/* Once this returns, the group's thread no longer uses the backend. */
+void group_remove(struct lokatt_group *g, struct group_member *m);
+
+#endif
@@ -1,43 +1,1434 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "adb.h"
+#include "error.h"
 #include "index.h"
+#include "intern.h"
 #include "lokatt.h"
+#include "strbuf.h"
 
-void index_init(struct index *idx)
+#define INDEX_CHUNK_SIZE (256 * 1024)
+
+/* the number of spilled chunks kept in memory once read back */
+#define SPILL_RESIDENT_CHUNKS 8
+
+#define ALIGN(size, alignment) \
+	(((size) + (alignment) - 1) & ~((size_t)(alignment) - 1))
+
+#define load(ptr) __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define store(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_SEQ_CST)
+#define add(ptr, value) __atomic_add_fetch((ptr), (value), __ATOMIC_SEQ_CST)
+#define sub(ptr, value) __atomic_sub_fetch((ptr), (value), __ATOMIC_SEQ_CST)
+
+struct index_chunk {
+	struct index_chunk *next;
+	uint64_t first_id;
+	size_t used;
+	char data[INDEX_CHUNK_SIZE];
+};
+
+/* ring buffer of event pointers and columns, indexed by id */
+struct index_table {
+	uint64_t size;
+	struct index_columns columns;
+	const struct index_event *events[];
+};
+
+/* ids of the events with a given key and value, in ascending order */
+struct posting_list {
+	uint64_t capacity;
+	uint64_t size;
+	uint64_t ids[];
+};
+
+struct posting {
+	uint64_t key;
+	struct posting_list *list;
+};
+
+/* hash table of postings, open addressing, never more than half full */
+struct posting_table {
+	size_t size;
+	size_t count;
+	struct posting *slots[];
+};
+
+/*
+ * Time index: a tree of maximum timestamps. A node at level 0 covers 64
+ * consecutive events, and each node at level l + 1 covers 16 nodes at level
+ * l. As timestamps aren't monotonic, the maximum of a range is what tells
+ * whether any event in it is at or after a given time. Each level is a
+ * ring buffer indexed by node number, like the event table.
+ */
+#define TIME_LEAF_SHIFT 6
+#define TIME_FANOUT_SHIFT 4
+#define TIME_FANOUT (1 << TIME_FANOUT_SHIFT)
+
+struct time_level {
+	uint64_t size;
+	int64_t max[];
+};
+
+/* memory no longer reachable by new readers, to be freed later */
+struct retired {
+	struct retired *next;
+	unsigned long epoch;
+	void *ptr;
+};
+
+/*
+ * A chunk written to the spill file: its data, as it was in memory, then
+ * the offset of each of its events in the data. 'base' is the address the
+ * data had, to relocate the tag and text pointers into it.
+ */
+struct spilled {
+	uint64_t first_id, end_id;
+	uint64_t offset;
+	size_t size;
+	uintptr_t base;
+};
+
+/* the spilled chunks, in id order; only 'count' changes once published */
+struct spill_dir {
+	size_t capacity;
+	size_t count;
+	struct spilled entries[];
+};
+
+/* a spilled chunk read back into memory */
+struct resident {
+	struct resident *prev, *next;
+	uint64_t first_id, end_id;
+	const uint32_t *offsets;
+	char data[];
+};
+
+/*
+ * Spilled chunks are read back by readers, not the producer, so unlike the
+ * rest of the index the LRU of resident chunks is guarded by a mutex. A
+ * chunk dropped from the LRU is retired to 'retired', under the same
+ * epoch rules as the producer's.
+ */
+struct spill {
+	int fd;
+	uint64_t file_size;
+	struct spill_dir *dir;
+
+	pthread_mutex_t lock;
+	struct resident *first, *last;
+	size_t resident_count;
+	struct retired *retired;
+};
+
+static struct index_chunk *create_chunk()
+{
+	struct index_chunk *chunk = malloc(sizeof(*chunk));
+	if (!chunk)
+		die("malloc");
+	return chunk;
+}
+
+static struct index_table *create_table(uint64_t size)
+{
+	struct index_columns *c;
+	struct index_table *table;
+	char *p;
+
+	/* the columns follow the event pointers, in the same allocation */
+	table = calloc(1, sizeof(*table) + size * (sizeof(table->events[0]) +
+						   7 * sizeof(int32_t) + 1));
+	if (!table)
+		die("calloc");
+	table->size = size;
+	c = &table->columns;
+	c->mask = size - 1;
+	p = (char *)&table->events[size];
+	c->pid = (int32_t *)p;
+	c->tid = c->pid + size;
+	c->sec = c->tid + size;
+	c->nsec = c->sec + size;
+	c->level = c->nsec + size;
+	c->tag_id = (uint32_t *)(c->level + size);
+	c->pname_id = c->tag_id + size;
+	c->type = (uint8_t *)(c->pname_id + size);
+	return table;
+}
+
+static void set_columns(struct index_table *table, uint64_t id,
+			const struct index_event *event)
+{
+	struct index_columns *c = &table->columns;
+	uint64_t i = id & c->mask;
+
+	c->type[i] = event->type;
+	c->pid[i] = event->pid;
+	c->tid[i] = event->tid;
+	c->sec[i] = event->sec;
+	c->nsec[i] = event->nsec;
+	c->level[i] = event->level;
+	c->tag_id[i] = event->tag_id;
+	c->pname_id[i] = event->pname_id;
+}
+
+/* 'deadline' is on CLOCK_MONOTONIC, NULL to wait forever */
+static void futex_wait(uint32_t *addr, uint32_t value,
+		       const struct timespec *deadline)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, value, deadline,
+		NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static void futex_wake(uint32_t *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/*
+ * Readers don't take any locks. Instead, memory is reclaimed using epochs:
+ * a reader registers itself in the current epoch for the duration of its
+ * read, and memory retired by the producer during epoch e is only freed
+ * once no reader is left in epoch e or earlier. Epoch e and e + 2 share a
+ * reader counter, so the epoch is only advanced once the readers of the
+ * previous epoch are gone. The producer never waits for readers; retired
+ * memory is simply kept around a bit longer if readers are slow.
+ */
+unsigned long index_read_begin(struct index *idx)
+{
+	for (;;) {
+		unsigned long epoch = load(&idx->epoch);
+
+		add(&idx->readers[epoch & 1], 1);
+		if (load(&idx->epoch) == epoch)
+			return epoch;
+		sub(&idx->readers[epoch & 1], 1);
+	}
+}
+
+void index_read_end(struct index *idx, unsigned long epoch)
+{
+	sub(&idx->readers[epoch & 1], 1);
+}
+
+static void retire_to(struct index *idx, struct retired **list, void *ptr)
 {
+	struct retired *r = malloc(sizeof(*r));
+	if (!r)
+		die("malloc");
+	r->ptr = ptr;
+	r->epoch = load(&idx->epoch);
+	r->next = *list;
+	*list = r;
+}
+
+static void retire(struct index *idx, void *ptr)
+{
+	retire_to(idx, &idx->retired, ptr);
+}
+
+/*
+ * Free what has been retired to 'list' if no reader can still use it. The
+ * producer and readers of spilled chunks both reclaim, each from its own
+ * list, so the epoch is advanced with a compare and swap.
+ */
+static void reclaim(struct index *idx, struct retired **list)
+{
+	unsigned long epoch = load(&idx->epoch);
+	struct retired **p = list;
+
+	if (load(&idx->readers[(epoch - 1) & 1]) != 0)
+		return;
+
+	/* no readers in epoch - 1 or earlier are left */
+	while (*p) {
+		struct retired *r = *p;
+		if (r->epoch < epoch) {
+			*p = r->next;
+			free(r->ptr);
+			free(r);
+		} else {
+			p = &r->next;
+		}
+	}
+	__atomic_compare_exchange_n(&idx->epoch, &epoch, epoch + 1, 0,
+				    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static void free_retired(struct retired *r)
+{
+	while (r) {
+		struct retired *next = r->next;
+		free(r->ptr);
+		free(r);
+		r = next;
+	}
+}
+
+static inline uint64_t posting_key(int key, int32_t value)
+{
+	return (uint64_t)key << 32 | (uint32_t)value;
+}
+
+static inline size_t posting_hash(uint64_t key)
+{
+	key *= 0x9e3779b97f4a7c15ull;
+	return key ^ (key >> 32);
+}
+
+static struct posting_table *create_posting_table(size_t size)
+{
+	struct posting_table *t;
+
+	t = calloc(1, sizeof(*t) + size * sizeof(t->slots[0]));
+	if (!t)
+		die("calloc");
+	t->size = size;
+	return t;
+}
+
+static struct posting *find_posting(const struct posting_table *t,
+				    uint64_t key)
+{
+	size_t i;
+
+	for (i = posting_hash(key) & (t->size - 1);;
+	     i = (i + 1) & (t->size - 1)) {
+		struct posting *p = load(&t->slots[i]);
+
+		if (!p || p->key == key)
+			return p;
+	}
+}
+
+static void insert_posting(struct posting_table *t, struct posting *p)
+{
+	size_t i = posting_hash(p->key) & (t->size - 1);
+
+	while (t->slots[i])
+		i = (i + 1) & (t->size - 1);
+	store(&t->slots[i], p);
+	t->count++;
+}
+
+static struct posting *get_posting(struct index *idx, uint64_t key)
+{
+	struct posting_table *t = idx->postings, *new;
+	struct posting *p = find_posting(t, key);
+	size_t i;
+
+	if (p)
+		return p;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		die("malloc");
+	p->key = key;
+	p->list = NULL;
+
+	if ((t->count + 1) * 2 > t->size) {
+		new = create_posting_table(t->size * 2);
+		for (i = 0; i < t->size; i++) {
+			if (t->slots[i])
+				insert_posting(new, t->slots[i]);
+		}
+		store(&idx->postings, new);
+		retire(idx, t);
+		t = new;
+	}
+	insert_posting(t, p);
+	return p;
+}
+
+/*
+ * Replace the posting list of 'p' with one that only holds the ids that
+ * haven't been evicted, with room for at least 'extra' more.
+ */
+static void compact_posting(struct index *idx, struct posting *p,
+			    size_t extra)
+{
+	struct posting_list *old = p->list, *new = NULL;
+	uint64_t start = 0, live = 0, capacity;
+
+	if (old) {
+		while (start < old->size &&
+		       old->ids[start] < idx->resident_id)
+			start++;
+		live = old->size - start;
+	}
+
+	if (live + extra > 0) {
+		capacity = (live + extra) * 2;
+		if (capacity < 8)
+			capacity = 8;
+		new = malloc(sizeof(*new) + capacity * sizeof(new->ids[0]));
+		if (!new)
+			die("malloc");
+		new->capacity = capacity;
+		new->size = live;
+		if (live)
+			memcpy(new->ids, old->ids + start,
+			       live * sizeof(new->ids[0]));
+	}
+	store(&p->list, new);
+	if (old)
+		retire(idx, old);
+}
+
+static void add_posting(struct index *idx, int key, int32_t value,
+			uint64_t id)
+{
+	struct posting *p = get_posting(idx, posting_key(key, value));
+	struct posting_list *list = p->list;
+
+	if (!list || list->size == list->capacity) {
+		compact_posting(idx, p, 1);
+		list = p->list;
+	}
+	list->ids[list->size] = id;
+	store(&list->size, list->size + 1);
+}
+
+/* Drop evicted or spilled ids from posting lists that are mostly stale. */
+static void trim_postings(struct index *idx)
+{
+	struct posting_table *t = idx->postings;
+	size_t i;
+
+	for (i = 0; i < t->size; i++) {
+		struct posting *p = t->slots[i];
+		struct posting_list *list;
+
+		if (!p || !p->list)
+			continue;
+		list = p->list;
+		if (list->size == 0 ||
+		    list->ids[list->size / 2] < idx->resident_id)
+			compact_posting(idx, p, 0);
+	}
+}
+
+static inline int64_t timestamp(const struct index_event *event)
+{
+	return (int64_t)event->sec * 1000000000 + event->nsec;
+}
+
+static inline unsigned int time_shift(int level)
+{
+	return TIME_LEAF_SHIFT + level * TIME_FANOUT_SHIFT;
+}
+
+static struct time_level *create_time_level(uint64_t size)
+{
+	struct time_level *t;
+
+	t = malloc(sizeof(*t) + size * sizeof(t->max[0]));
+	if (!t)
+		die("malloc");
+	t->size = size;
+	return t;
+}
+
+static void add_time(struct index *idx, uint64_t id, int64_t ts)
+{
+	int level;
+
+	for (level = 0; level < INDEX_TIME_LEVELS; level++) {
+		struct time_level *t = idx->time[level], *new;
+		uint64_t node = id >> time_shift(level);
+		uint64_t first = idx->first_id >> time_shift(level);
+		uint64_t n;
+		int64_t *max;
+
+		if (node - first >= t->size) {
+			new = create_time_level(t->size * 2);
+			for (n = first; n < node; n++)
+				new->max[n & (new->size - 1)] =
+					t->max[n & (t->size - 1)];
+			store(&idx->time[level], new);
+			retire(idx, t);
+			t = new;
+		}
+
+		max = &t->max[node & (t->size - 1)];
+		if ((id & (((uint64_t)1 << time_shift(level)) - 1)) == 0)
+			store(max, ts);
+		else if (ts > *max)
+			store(max, ts);
+	}
+}
+
+static void add_chunk(struct index *idx, struct index_chunk *chunk)
+{
+	chunk->next = NULL;
+	chunk->first_id = idx->current_size;
+	chunk->used = 0;
+	if (idx->last_chunk)
+		idx->last_chunk->next = chunk;
+	else
+		idx->first_chunk = chunk;
+	idx->last_chunk = chunk;
+	idx->chunk_count++;
+}
+
+/* Evicted events aren't resident either. */
+static void update_resident_id(struct index *idx)
+{
+	if (idx->resident_id < idx->first_id)
+		store(&idx->resident_id, idx->first_id);
+}
+
+/* Evict the oldest chunk. */
+static void evict_chunk(struct index *idx)
+{
+	struct index_chunk *chunk = idx->first_chunk;
+
+	idx->first_chunk = chunk->next;
+	idx->chunk_count--;
+	if (idx->first_id < idx->first_chunk->first_id)
+		store(&idx->first_id, idx->first_chunk->first_id);
+	update_resident_id(idx);
+	retire(idx, chunk);
+	trim_postings(idx);
+}
+
+static int pwrite_all(int fd, const char *buf, size_t size, uint64_t offset)
+{
+	while (size) {
+		ssize_t r = pwrite(fd, buf, size, offset);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		size -= r;
+		offset += r;
+	}
+	return 0;
+}
+
+static int pread_all(int fd, char *buf, size_t size, uint64_t offset)
+{
+	while (size) {
+		ssize_t r = pread(fd, buf, size, offset);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (r == 0)
+			return -1;
+		buf += r;
+		size -= r;
+		offset += r;
+	}
+	return 0;
+}
+
+/* Add 'entry' to the spill directory, dropping entries evicted since. */
+static void add_spilled(struct index *idx, const struct spilled *entry)
+{
+	struct spill *s = idx->spill;
+	struct spill_dir *dir = s->dir, *new;
+	size_t i, start = 0;
+
+	if (dir->count == dir->capacity) {
+		while (start < dir->count &&
+		       dir->entries[start].end_id <= idx->first_id)
+			start++;
+		new = malloc(sizeof(*new) + 2 * (dir->count - start + 1) *
+			     sizeof(new->entries[0]));
+		if (!new)
+			die("malloc");
+		new->capacity = 2 * (dir->count - start + 1);
+		new->count = dir->count - start;
+		for (i = start; i < dir->count; i++)
+			new->entries[i - start] = dir->entries[i];
+		store(&s->dir, new);
+		retire(idx, dir);
+		dir = new;
+	}
+	dir->entries[dir->count] = *entry;
+	store(&dir->count, dir->count + 1);
+}
+
+/*
+ * Write the oldest chunk to the spill file and drop it from memory, along
+ * with its events' slots in the table and ids in the posting lists: the
+ * resident id moves past it. Its slots are set to NULL until reused, and
+ * index_get takes a slot without the event as a cue to look in the spill
+ * file. Returns -1 if the chunk couldn't be written.
+ */
+static int spill_chunk(struct index *idx)
+{
+	struct index_chunk *chunk = idx->first_chunk;
+	struct index_table *table = idx->table;
+	struct spill *s = idx->spill;
+	struct spilled entry;
+	uint32_t *offsets;
+	uint64_t id;
+	size_t count;
+	int ret;
+
+	entry.first_id = chunk->first_id > idx->first_id ?
+		chunk->first_id : idx->first_id;
+	entry.end_id = chunk->next->first_id;
+	entry.offset = s->file_size;
+	entry.size = chunk->used;
+	entry.base = (uintptr_t)chunk->data;
+	count = entry.end_id > entry.first_id ?
+		entry.end_id - entry.first_id : 0;
+
+	offsets = malloc(count * sizeof(*offsets) + 1);
+	if (!offsets)
+		die("malloc");
+	for (id = entry.first_id; id < entry.end_id; id++)
+		offsets[id - entry.first_id] = (const char *)
+			table->events[id & (table->size - 1)] - chunk->data;
+	ret = pwrite_all(s->fd, chunk->data, chunk->used, entry.offset) ||
+		pwrite_all(s->fd, (const char *)offsets,
+			   count * sizeof(*offsets),
+			   entry.offset + chunk->used);
+	free(offsets);
+	if (ret)
+		return -1;
+	s->file_size += chunk->used + count * sizeof(*offsets);
+
+	/* publish the spilled copy before unpublishing the chunk */
+	add_spilled(idx, &entry);
+	for (id = entry.first_id; id < entry.end_id; id++)
+		store(&table->events[id & (table->size - 1)], NULL);
+	/* before trimming, see index_seek */
+	store(&idx->resident_id, entry.end_id);
+
+	idx->first_chunk = chunk->next;
+	idx->chunk_count--;
+	retire(idx, chunk);
+	trim_postings(idx);
+	return 0;
+}
+
+/*
+ * Reserve 'size' bytes at the end of the last chunk. If the byte budget has
+ * been reached, the oldest chunk is spilled, or if there is no spill file
+ * or spilling fails, evicted.
+ */
+static void *reserve(struct index *idx, size_t size)
+{
+	struct index_chunk *chunk = idx->last_chunk;
+	void *p;
+
+	size = ALIGN(size, __alignof__(struct index_event));
+	if (chunk->used + size > INDEX_CHUNK_SIZE) {
+		if (idx->max_chunks && idx->chunk_count >= idx->max_chunks &&
+		    (!idx->spill || spill_chunk(idx)))
+			evict_chunk(idx);
+		chunk = create_chunk();
+		add_chunk(idx, chunk);
+	}
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+	return p;
+}
+
+/*
+ * Make room in the ring buffer of event pointers and columns for one more
+ * resident event. The old table is retired rather than freed, as readers
+ * may still use it.
+ */
+static void grow_table(struct index *idx)
+{
+	struct index_table *old = idx->table, *new;
+	uint64_t id;
+
+	if (idx->current_size - idx->resident_id < old->size)
+		return;
+
+	new = create_table(old->size * 2);
+	for (id = idx->resident_id; id < idx->current_size; id++) {
+		const struct index_columns *c = &old->columns;
+		uint64_t i = id & c->mask, j = id & new->columns.mask;
+
+		new->events[j] = old->events[i];
+		new->columns.type[j] = c->type[i];
+		new->columns.pid[j] = c->pid[i];
+		new->columns.tid[j] = c->tid[i];
+		new->columns.sec[j] = c->sec[i];
+		new->columns.nsec[j] = c->nsec[i];
+		new->columns.level[j] = c->level[i];
+		new->columns.tag_id[j] = c->tag_id[i];
+		new->columns.pname_id[j] = c->pname_id[i];
+	}
+	store(&idx->table, new);
+	retire(idx, old);
+}
+
+void index_init(struct index *idx, uint64_t max_events, uint64_t max_bytes)
+{
+	int i;
+
+	idx->first_id = 0;
+	idx->resident_id = 0;
 	idx->current_size = 0;
-	idx->max_size = 1024;
-	idx->arena = calloc(idx->max_size, sizeof(struct lokatt_event *));
+	idx->table = create_table(1024);
+	idx->postings = create_posting_table(256);
+	for (i = 0; i < INDEX_TIME_LEVELS; i++)
+		idx->time[i] = create_time_level(16);
+	idx->seq = 0;
+	idx->waiters = 0;
+	idx->epoch = 2;
+	idx->readers[0] = idx->readers[1] = 0;
+	pthread_mutex_init(&idx->waker_lock, NULL);
+	idx->wakers = NULL;
+	idx->waker_count = idx->waker_alloc = 0;
+
+	idx->first_chunk = idx->last_chunk = NULL;
+	idx->chunk_count = 0;
+	add_chunk(idx, create_chunk());
+	idx->retired = NULL;
+	idx->spill = NULL;
+
+	idx->max_events = max_events;
+	idx->max_chunks = 0;
+	if (max_bytes) {
+		/* need at least two chunks to evict one */
+		idx->max_chunks = max_bytes / sizeof(struct index_chunk);
+		if (idx->max_chunks < 2)
+			idx->max_chunks = 2;
+	}
+}
+
+int index_spill(struct index *idx, const char *dir)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct spill *s;
+	int fd;
+
+	strbuf_addf(&path, "%s/lokatt-spill-XXXXXX", dir);
+	/* close on exec: adb children mustn't keep the file's space */
+	fd = mkostemp(path.buf, O_CLOEXEC);
+	if (fd >= 0)
+		unlink(path.buf);
+	strbuf_destroy(&path);
+	if (fd < 0)
+		return -1;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		die("calloc");
+	s->fd = fd;
+	s->dir = calloc(1, sizeof(*s->dir) + 64 * sizeof(s->dir->entries[0]));
+	if (!s->dir)
+		die("calloc");
+	s->dir->capacity = 64;
+	pthread_mutex_init(&s->lock, NULL);
+	idx->spill = s;
+	return 0;
+}
+
+static void destroy_spill(struct spill *s)
+{
+	struct resident *r = s->first;
+
+	while (r) {
+		struct resident *next = r->next;
+		free(r);
+		r = next;
+	}
+	free_retired(s->retired);
+	pthread_mutex_destroy(&s->lock);
+	free(s->dir);
+	close(s->fd);
+	free(s);
 }
 
 void index_destroy(struct index *idx)
 {
-	uint64_t i;
-	for (i = 0; i < idx->current_size; i++)
-		free(idx->arena[i]);
-	free(idx->arena);
+	struct index_chunk *chunk = idx->first_chunk;
+	size_t i;
+
+	while (chunk) {
+		struct index_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	free_retired(idx->retired);
+	if (idx->spill)
+		destroy_spill(idx->spill);
+	free(idx->table);
+	for (i = 0; i < idx->postings->size; i++) {
+		struct posting *p = idx->postings->slots[i];
+		if (p) {
+			free(p->list);
+			free(p);
+		}
+	}
+	free(idx->postings);
+	for (i = 0; i < INDEX_TIME_LEVELS; i++)
+		free(idx->time[i]);
+	pthread_mutex_destroy(&idx->waker_lock);
+	free(idx->wakers);
+}
+
+/*
+ * Find tag and text in a "<level><tag>\0<text>\0" payload. Don't trust the
+ * terminating nul chars to actually be there, and leave room for them in
+ * MSG_MAX_PAYLOAD_SIZE bytes. Trailing newlines are stripped from text.
+ * Returns non-zero if the payload is well-formed and nothing was stripped,
+ * meaning tag and text can be used in place.
+ */
+static int decode_payload(const struct adb_message *msg, uint8_t *level,
+			  const char **tag, size_t *tag_size,
+			  const char **text, size_t *text_size)
+{
+	size_t size = msg->payload_size;
+	const char *end;
+	int in_place = 1;
+
+	if (size > MSG_MAX_PAYLOAD_SIZE - 2) {
+		size = MSG_MAX_PAYLOAD_SIZE - 2;
+		in_place = 0;
+	}
+	end = msg->payload + size;
+
+	if (size == 0) {
+		*level = 0;
+		*tag = *text = "";
+		*tag_size = *text_size = 1;
+		return 0;
+	}
+	*level = (uint8_t)msg->payload[0];
+
+	*tag = msg->payload + 1;
+	*tag_size = strnlen(*tag, end - *tag) + 1;
+	if (*tag + *tag_size > end) {
+		*text = "";
+		*text_size = 1;
+		return 0;
+	}
+
+	*text = *tag + *tag_size;
+	*text_size = strnlen(*text, end - *text) + 1;
+	if (*text + *text_size > end)
+		in_place = 0;
+	while (*text_size > 1 && (*text)[*text_size - 2] == '\n') {
+		(*text_size)--;
+		in_place = 0;
+	}
+	return in_place;
+}
+
+static void wake_wakers(struct index *idx)
+{
+	size_t i;
+
+	pthread_mutex_lock(&idx->waker_lock);
+	for (i = 0; i < idx->waker_count; i++) {
+		struct index_waker *w = idx->wakers[i];
+
+		add(&w->seq, 1);
+		if (load(&w->waiters))
+			futex_wake(&w->seq);
+	}
+	pthread_mutex_unlock(&idx->waker_lock);
+}
+
+void index_append(struct index *idx, int type, const struct adb_message *msg,
+		  uint32_t pname_id)
+{
+	struct index_event *event;
+	const char *tag = "", *text = "", *interned = "";
+	size_t tag_size = 1, text_size = 1, tag_length;
+	uint32_t tag_id = INTERN_NONE;
+	uint8_t level = 0;
+	int in_place = 0;
+
+	if (type & EVENT_LOGCAT_MESSAGE) {
+		in_place = decode_payload(msg, &level, &tag, &tag_size,
+					  &text, &text_size) &&
+			msg->persistent;
+		tag_id = intern_tag(tag, tag_size - 1, &interned);
+	}
+	tag_length = tag_size - 1;
+	/* tags not interned are stored in the payload, see index.h */
+	if (tag_id == INTERN_NONE && tag_size > 1)
+		in_place = 0;
+	else
+		tag_size = 0;
+
+	if (in_place) {
+		event = reserve(idx, sizeof(*event));
+		event->text = text;
+	} else {
+		event = reserve(idx, sizeof(*event) + tag_size + text_size);
+		if (tag_size) {
+			memcpy(event->payload, tag, tag_size - 1);
+			event->payload[tag_size - 1] = '\0';
+			interned = event->payload;
+		}
+		memcpy(event->payload + tag_size, text, text_size - 1);
+		event->payload[tag_size + text_size - 1] = '\0';
+		event->text = event->payload + tag_size;
+	}
+
+	event->type = type;
+	event->level = level;
+	event->tag_id = tag_id;
+	event->pname_id = msg ? pname_id : INTERN_NONE;
+	event->tag = interned;
+	event->tag_size = tag_length;
+	event->text_size = text_size - 1;
+	if (msg) {
+		event->pid = msg->pid;
+		event->tid = msg->tid;
+		event->sec = msg->sec;
+		event->nsec = msg->nsec;
+	} else {
+		event->pid = event->tid = event->sec = event->nsec = 0;
+	}
+	event->id = idx->current_size;
+
+	if (type & EVENT_LOGCAT_MESSAGE) {
+		add_posting(idx, INDEX_KEY_PID, event->pid, event->id);
+		add_posting(idx, INDEX_KEY_TID, event->tid, event->id);
+		add_posting(idx, INDEX_KEY_LEVEL, event->level, event->id);
+		if (tag_id != INTERN_NONE)
+			add_posting(idx, INDEX_KEY_TAG, tag_id, event->id);
+		if (event->pname_id != INTERN_NONE)
+			add_posting(idx, INDEX_KEY_PNAME, event->pname_id,
+				    event->id);
+	} else {
+		add_posting(idx, INDEX_KEY_TYPE, type, event->id);
+	}
+
+	add_time(idx, event->id, timestamp(event));
+
+	/*
+	 * Evict before publishing, so that a reader that sees the new event
+	 * also sees the first id that goes with it.
+	 */
+	if (idx->max_events &&
+	    idx->current_size + 1 - idx->first_id > idx->max_events) {
+		store(&idx->first_id, idx->current_size + 1 - idx->max_events);
+		update_resident_id(idx);
+		while (idx->first_chunk->next &&
+		       idx->first_chunk->next->first_id <= idx->first_id)
+			evict_chunk(idx);
+	}
+
+	/* publish the event */
+	grow_table(idx);
+	set_columns(idx->table, event->id, event);
+	store(&idx->table->events[event->id & (idx->table->size - 1)], event);
+	store(&idx->current_size, idx->current_size + 1);
+	add(&idx->seq, 1);
+	if (load(&idx->waiters))
+		futex_wake(&idx->seq);
+	if (load(&idx->waker_count))
+		wake_wakers(idx);
+
+	if (idx->retired)
+		reclaim(idx, &idx->retired);
+}
+
+struct named {
+	uint32_t pname_id;
+	uint64_t id;
+};
+
+static int compare_named(const void *a, const void *b)
+{
+	const struct named *x = a, *y = b;
+
+	if (x->pname_id != y->pname_id)
+		return x->pname_id < y->pname_id ? -1 : 1;
+	return x->id < y->id ? -1 : x->id > y->id;
+}
+
+/*
+ * Add the ascending 'ids' to the posting list of 'p'. They may go anywhere
+ * in it, so merge them into a new list, leaving evicted ids out.
+ */
+static void merge_posting(struct index *idx, struct posting *p,
+			  const struct named *ids, size_t count)
+{
+	struct posting_list *old = p->list, *new;
+	uint64_t size = old ? old->size : 0, i = 0, j = 0, n = 0;
+
+	while (i < size && old->ids[i] < idx->resident_id)
+		i++;
+	new = malloc(sizeof(*new) + (size - i + count) * 2 *
+		     sizeof(new->ids[0]));
+	if (!new)
+		die("malloc");
+	new->capacity = (size - i + count) * 2;
+	while (i < size || j < count) {
+		if (j == count || (i < size && old->ids[i] < ids[j].id))
+			new->ids[n++] = old->ids[i++];
+		else
+			new->ids[n++] = ids[j++].id;
+	}
+	new->size = n;
+	store(&p->list, new);
+	if (old)
+		retire(idx, old);
+}
+
+void index_name_processes(struct index *idx, uint64_t from,
+			  uint32_t (*lookup)(void *data, int32_t pid),
+			  void *data)
+{
+	struct index_table *table = idx->table;
+	uint64_t mask = table->columns.mask, id, key;
+	struct index_event *event;
+	struct named *named = NULL;
+	size_t count = 0, alloc = 0, i, j;
+	uint32_t pname_id;
+
+	if (from < idx->resident_id)
+		from = idx->resident_id;
+	for (id = from; id < idx->current_size; id++) {
+		/* the producer's own event, so it may change it */
+		event = (struct index_event *)table->events[id & mask];
+		if (!(event->type & EVENT_LOGCAT_MESSAGE) ||
+		    event->pname_id != INTERN_NONE)
+			continue;
+		pname_id = lookup(data, event->pid);
+		if (pname_id == INTERN_NONE)
+			continue;
+		store(&event->pname_id, pname_id);
+		store(&table->columns.pname_id[id & mask], pname_id);
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			named = realloc(named, alloc * sizeof(*named));
+			if (!named)
+				die("realloc");
+		}
+		named[count].pname_id = pname_id;
+		named[count++].id = id;
+	}
+	if (!count)
+		return;
+
+	/* one merge per name */
+	qsort(named, count, sizeof(*named), compare_named);
+	for (i = 0; i < count; i = j) {
+		for (j = i + 1; j < count &&
+		     named[j].pname_id == named[i].pname_id; j++)
+			;
+		key = posting_key(INDEX_KEY_PNAME, named[i].pname_id);
+		merge_posting(idx, get_posting(idx, key), named + i, j - i);
+	}
+	free(named);
+
+	if (idx->retired)
+		reclaim(idx, &idx->retired);
+}
+
+static const struct spilled *find_spilled(const struct spill_dir *dir,
+					  uint64_t id)
+{
+	size_t lo = 0, hi = load(&dir->count);
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (dir->entries[mid].end_id <= id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == load(&dir->count) || dir->entries[lo].first_id > id)
+		return NULL;
+	return &dir->entries[lo];
+}
+
+static inline int points_into(const char *p, uintptr_t base, size_t size)
+{
+	return (uintptr_t)p >= base && (uintptr_t)p < base + size;
 }
 
-void index_append(struct index *idx, const struct lokatt_event *event)
+/* Read a spilled chunk back, and relocate the pointers into its data. */
+static struct resident *read_spilled(struct spill *s,
+				     const struct spilled *e)
 {
-	struct lokatt_event *copy = malloc(sizeof(*copy));
-	memcpy(copy, event, sizeof(*copy));
-	if (copy->type & EVENT_LOGCAT_MESSAGE)
-		decode_logcat_payload(copy->msg.payload, &copy->msg.level,
-				      copy->msg.tag, copy->msg.text);
-	if (idx->current_size == idx->max_size) {
-		idx->max_size += 1024;
-		idx->arena = realloc(idx->arena, idx->max_size *
-				     sizeof(struct lokatt_event *));
+	size_t count = e->end_id - e->first_id, i;
+	struct resident *r;
+
+	r = malloc(sizeof(*r) + e->size + count * sizeof(r->offsets[0]));
+	if (!r)
+		die("malloc");
+	if (pread_all(s->fd, r->data, e->size + count * sizeof(r->offsets[0]),
+		      e->offset)) {
+		free(r);
+		return NULL;
+	}
+	r->first_id = e->first_id;
+	r->end_id = e->end_id;
+	r->offsets = (const uint32_t *)(r->data + e->size);
+	for (i = 0; i < count; i++) {
+		struct index_event *event =
+			(struct index_event *)(r->data + r->offsets[i]);
+
+		if (points_into(event->tag, e->base, e->size))
+			event->tag = r->data + ((uintptr_t)event->tag - e->base);
+		if (points_into(event->text, e->base, e->size))
+			event->text = r->data +
+				((uintptr_t)event->text - e->base);
 	}
-	idx->arena[idx->current_size] = copy;
-	copy->id = idx->current_size++;
+	return r;
+}
+
+static void lru_unlink(struct spill *s, struct resident *r)
+{
+	if (r->prev)
+		r->prev->next = r->next;
+	else
+		s->first = r->next;
+	if (r->next)
+		r->next->prev = r->prev;
+	else
+		s->last = r->prev;
+	s->resident_count--;
 }
 
-const struct lokatt_event *index_get(struct index *idx, uint64_t id)
+static void lru_push(struct spill *s, struct resident *r)
 {
-	if (id < idx->current_size)
-		return idx->arena[id];
-	return NULL;
+	r->prev = NULL;
+	r->next = s->first;
+	if (s->first)
+		s->first->prev = r;
+	else
+		s->last = r;
+	s->first = r;
+	s->resident_count++;
+}
+
+/* Get a spilled event, reading its chunk back if it isn't resident. */
+static const struct index_event *get_spilled(struct index *idx, uint64_t id)
+{
+	struct spill *s = idx->spill;
+	const struct index_event *event = NULL;
+	const struct spilled *e;
+	struct resident *r;
+
+	pthread_mutex_lock(&s->lock);
+	for (r = s->first; r; r = r->next) {
+		if (id >= r->first_id && id < r->end_id)
+			break;
+	}
+	if (r) {
+		lru_unlink(s, r);
+	} else {
+		e = find_spilled(load(&s->dir), id);
+		r = e ? read_spilled(s, e) : NULL;
+		if (r && s->resident_count == SPILL_RESIDENT_CHUNKS) {
+			struct resident *old = s->last;
+
+			lru_unlink(s, old);
+			retire_to(idx, &s->retired, old);
+		}
+	}
+	if (r) {
+		lru_push(s, r);
+		event = (const struct index_event *)
+			(r->data + r->offsets[id - r->first_id]);
+	}
+	if (s->retired)
+		reclaim(idx, &s->retired);
+	pthread_mutex_unlock(&s->lock);
+	return event;
+}
+
+const struct index_event *index_get(struct index *idx, uint64_t id)
+{
+	const struct index_table *table;
+	const struct index_event *event;
+
+	/* load current_size before table: a newer table is fine, older isn't */
+	if (id >= load(&idx->current_size) || id < load(&idx->first_id))
+		return NULL;
+	table = load(&idx->table);
+	event = load(&table->events[id & (table->size - 1)]);
+	/* the slot may be empty, or already reused by a newer event */
+	if (event && event->id == id)
+		return event;
+	return idx->spill ? get_spilled(idx, id) : NULL;
+}
+
+const struct index_columns *index_columns(struct index *idx)
+{
+	return &load(&idx->table)->columns;
+}
+
+uint64_t index_first_id(struct index *idx)
+{
+	return load(&idx->first_id);
+}
+
+uint64_t index_resident_id(struct index *idx)
+{
+	return load(&idx->resident_id);
+}
+
+uint64_t index_size(struct index *idx)
+{
+	return load(&idx->current_size);
+}
+
+uint64_t index_seek(struct index *idx, int key, int32_t value, uint64_t id)
+{
+	uint64_t size = load(&idx->current_size), count, lo = 0, hi;
+	const struct posting_list *list;
+	const struct posting *p;
+
+	if (id >= size)
+		return id;
+	p = find_posting(load(&idx->postings), posting_key(key, value));
+	list = p ? load(&p->list) : NULL;
+	/*
+	 * Spilled ids may be gone from the list. The resident id is stored
+	 * before the list is trimmed, so load it after the list.
+	 */
+	if (id < load(&idx->resident_id))
+		return id;
+	if (!list)
+		return size;
+
+	/* first id >= 'id' */
+	count = hi = load(&list->size);
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		if (list->ids[mid] < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == count || list->ids[lo] > size)
+		return size;
+	return list->ids[lo];
+}
+
+/*
+ * Find the first event in [id, end) at or after 'ts', with 'id' a multiple
+ * of 64, by descending from level 'level'. Returns 'end' if there is none.
+ */
+static uint64_t descend_time(struct index *idx, int level, uint64_t id,
+			     uint64_t end, int64_t ts)
+{
+	const struct index_event *event;
+
+	for (; level >= 0; level--) {
+		const struct time_level *t = load(&idx->time[level]);
+		uint64_t node = id >> time_shift(level);
+
+		while (id < end && load(&t->max[node & (t->size - 1)]) < ts) {
+			node++;
+			id = node << time_shift(level);
+		}
+		if (id >= end)
+			return end;
+	}
+
+	for (; id < end; id++) {
+		event = index_get(idx, id);
+		if (event && timestamp(event) >= ts)
+			return id;
+	}
+	return end;
+}
+
+uint64_t index_seek_time(struct index *idx, int32_t sec, int32_t nsec,
+			 uint64_t id)
+{
+	int64_t ts = (int64_t)sec * 1000000000 + nsec;
+	uint64_t size = load(&idx->current_size), end;
+	const struct index_event *event;
+	int level;
+
+	if (id < index_first_id(idx))
+		id = index_first_id(idx);
+	if (id >= size)
+		return id;
+
+	/* up to the end of the first leaf, event by event */
+	end = (id | ((1 << TIME_LEAF_SHIFT) - 1)) + 1;
+	for (; id < end && id < size; id++) {
+		event = index_get(idx, id);
+		if (event && timestamp(event) >= ts)
+			return id;
+	}
+
+	/*
+	 * Walk up the tree: at each level, try the remaining siblings within
+	 * the parent, then move on to the parent's next sibling. 'id' is the
+	 * first event of the next node to try.
+	 */
+	for (level = 0; id < size; level++) {
+		uint64_t group = (uint64_t)1 << time_shift(level + 1);
+
+		end = level == INDEX_TIME_LEVELS - 1 ?
+			size : (id | (group - 1)) + 1;
+		if (end > size)
+			end = size;
+		id = descend_time(idx, level, id, end, ts);
+		if (id < end)
+			return id;
+		if (level == INDEX_TIME_LEVELS - 1)
+			break;
+	}
+	return size;
+}
+
+static int wait_until(struct index *idx, uint64_t id,
+		      const struct timespec *deadline)
+{
+	struct timespec now;
+	int ret = 0;
+
+	add(&idx->waiters, 1);
+	for (;;) {
+		uint32_t seq = load(&idx->seq);
+
+		if (id < load(&idx->current_size))
+			break;
+		if (deadline) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			if (now.tv_sec > deadline->tv_sec ||
+			    (now.tv_sec == deadline->tv_sec &&
+			     now.tv_nsec >= deadline->tv_nsec)) {
+				ret = -1;
+				break;
+			}
+		}
+		futex_wait(&idx->seq, seq, deadline);
+	}
+	sub(&idx->waiters, 1);
+	return ret;
+}
+
+void index_wait(struct index *idx, uint64_t id)
+{
+	wait_until(idx, id, NULL);
+}
+
+static void deadline_after(struct timespec *deadline, int timeout_ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+	deadline->tv_sec += timeout_ms / 1000;
+	deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+int index_wait_timeout(struct index *idx, uint64_t id, int timeout_ms)
+{
+	struct timespec deadline;
+
+	deadline_after(&deadline, timeout_ms);
+	return wait_until(idx, id, &deadline);
+}
+
+void index_add_waker(struct index *idx, struct index_waker *w)
+{
+	pthread_mutex_lock(&idx->waker_lock);
+	if (idx->waker_count == idx->waker_alloc) {
+		idx->waker_alloc = idx->waker_alloc ? idx->waker_alloc * 2 : 4;
+		idx->wakers = realloc(idx->wakers, idx->waker_alloc *
+				      sizeof(idx->wakers[0]));
+		if (!idx->wakers)
+			die("realloc");
+	}
+	idx->wakers[idx->waker_count] = w;
+	store(&idx->waker_count, idx->waker_count + 1);
+	pthread_mutex_unlock(&idx->waker_lock);
+}
+
+void index_remove_waker(struct index *idx, struct index_waker *w)
+{
+	size_t i;
+
+	pthread_mutex_lock(&idx->waker_lock);
+	for (i = 0; i < idx->waker_count; i++) {
+		if (idx->wakers[i] == w) {
+			idx->wakers[i] = idx->wakers[idx->waker_count - 1];
+			store(&idx->waker_count, idx->waker_count - 1);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&idx->waker_lock);
+}
+
+void index_waker_wait(struct index_waker *w, uint32_t seq, int timeout_ms)
+{
+	struct timespec deadline;
+
+	if (timeout_ms >= 0)
+		deadline_after(&deadline, timeout_ms);
+	add(&w->waiters, 1);
+	futex_wait(&w->seq, seq, timeout_ms >= 0 ? &deadline : NULL);
+	sub(&w->waiters, 1);
+}
+
+void index_event_to_message(const struct index_event *event,
+			    struct lokatt_message *out)
+{
+	out->pid = event->pid;
+	out->tid = event->tid;
+	out->sec = event->sec;
+	out->nsec = event->nsec;
+	out->level = event->level;
+	out->tag = event->tag;
+	out->text = event->text;
+	out->pname = intern_string(index_event_pname_id(event));
+}
+
+void index_event_to_view(const struct index_event *event,
+			 struct lokatt_view *out)
+{
+	out->type = event->type;
+	out->id = event->id;
+	if (!(event->type & EVENT_LOGCAT_MESSAGE))
+		return;
+	out->pid = event->pid;
+	out->tid = event->tid;
+	out->sec = event->sec;
+	out->nsec = event->nsec;
+	out->level = event->level;
+	out->tag = event->tag;
+	out->text = event->text;
+	out->tag_size = event->tag_size;
+	out->text_size = event->text_size;
+	out->pname = intern_string(index_event_pname_id(event));
+}
+
+void index_event_copy(const struct index_event *event,
+		      struct lokatt_event *out)
+{
+	size_t tag_size = event->tag_size + 1;
+	size_t text_size = event->text_size + 1;
+
+	out->type = event->type;
+	out->id = event->id;
+	if (!(event->type & EVENT_LOGCAT_MESSAGE))
+		return;
+	index_event_to_message(event, &out->msg);
+	out->msg.payload[0] = event->level;
+	memcpy(out->msg.payload + 1, event->tag, tag_size);
+	memcpy(out->msg.payload + 1 + tag_size, event->text, text_size);
+	out->msg.tag = out->msg.payload + 1;
+	out->msg.text = out->msg.payload + 1 + tag_size;
 }
@@ -1,34 +1,249 @@
 #ifndef LOKATT_INDEX_H
 #define LOKATT_INDEX_H
 
+#include <pthread.h>
+#include <stddef.h>
 #include <stdint.h>
 
-#define decode_logcat_payload(payload_ptr, level_ptr, tag_ptr, text_ptr) \
-	do { \
-		char *p; \
-		\
-		*(level_ptr) = (uint8_t)(((const char *)(payload_ptr))[0]); \
-		(tag_ptr) = (const char *)(((const char *)(payload_ptr)) + 1); \
-		(text_ptr) = (const char *)(strchr((tag_ptr), '\0') + 1); \
-		\
-		/* also strip trailing newlines from text */ \
-		p = strchr(text_ptr, '\0') - 1; \
-		while (*p == '\n') { \
-			*p-- = '\0'; \
-		} \
-	} while (0)
-
+struct adb_message;
 struct lokatt_event;
+struct lokatt_message;
+struct lokatt_view;
+
+/*
+ * An event as stored in the index. Events are packed back to back in large
+ * chunks, and each event only occupies as many payload bytes as its text
+ * actually needs. Tags are interned (see intern.h): 'tag' points to the
+ * interned copy and 'tag_id' is its id. Only if the tag couldn't be interned
+ * is 'tag_id' INTERN_NONE and the tag stored in the payload, before the
+ * text. 'pname_id' is the interned name of the process, INTERN_NONE if it
+ * isn't known (yet: see index_name_processes). The text pointer refers to the payload, or, if the
+ * backend's payload is persistent and can be used as is, directly to the
+ * backend's data. 'tag_size' and 'text_size' are the lengths of tag and
+ * text, without the nul, so that readers needn't look for it.
+ */
+struct index_event {
+	uint64_t id;
+	int32_t pid;
+	int32_t tid;
+	int32_t sec;
+	int32_t nsec;
+	uint32_t tag_id;
+	uint32_t pname_id;
+	uint16_t tag_size;
+	uint16_t text_size;
+	uint8_t type;
+	uint8_t level;
+	const char *tag;
+	const char *text;
+	char payload[];
+};
+
+/*
+ * The header fields of the events, one dense array per field, indexed by
+ * 'id & mask' like the events themselves, so that a scan over a field only
+ * touches that field's memory. Blocks of 64 ids starting at a multiple of
+ * 64 are contiguous. The slot of an event may be reused as soon as the
+ * event has been evicted or spilled, so check index_resident_id after
+ * reading a slot.
+ */
+struct index_columns {
+	uint64_t mask;
+	int32_t *pid;
+	int32_t *tid;
+	int32_t *sec;
+	int32_t *nsec;
+	int32_t *level;
+	uint32_t *tag_id;
+	uint32_t *pname_id;
+	uint8_t *type;
+};
+
+struct index_chunk;
+struct index_table;
+struct posting_table;
+struct retired;
+struct spill;
+struct time_level;
+
+#define INDEX_TIME_LEVELS 8
+
+/*
+ * A futex word bumped on every append to any of the indices it has been
+ * added to, so that a thread can wait for several indices at once.
+ */
+struct index_waker {
+	uint32_t seq;
+	uint32_t waiters;
+};
+
+/*
+ * Keys of the posting lists: for each key and value, the index keeps the
+ * ids of the matching events, in ascending order. INDEX_KEY_TYPE only
+ * covers events other than EVENT_LOGCAT_MESSAGE.
+ */
+enum {
+	INDEX_KEY_PID,
+	INDEX_KEY_TID,
+	INDEX_KEY_TAG,
+	INDEX_KEY_LEVEL,
+	INDEX_KEY_TYPE,
+	INDEX_KEY_PNAME,
+};
 
+/*
+ * Events with ids in [first_id, current_size) are available. If a budget is
+ * set, the oldest events are evicted to make room for new ones; event ids
+ * are never reused.
+ *
+ * The index has a single producer, which calls index_append, and any number
+ * of concurrent readers. Readers never block the producer and don't take any
+ * locks, but must bracket their accesses with index_read_begin and
+ * index_read_end; events, and the tag and text they point to, are only
+ * guaranteed to stay valid until then.
+ *
+ * With a spill file (see index_spill), chunks over the byte budget are
+ * written to it instead of being evicted, and events in [first_id,
+ * resident_id) are only in the file: their slots in the table, their
+ * columns and their ids in the posting lists go with them. What stays in
+ * memory for them is bounded by the time index, about a byte per 8 events,
+ * and an entry per spilled chunk. index_get reads spilled events back
+ * transparently, keeping the last few chunks read in memory; only that
+ * path takes a lock.
+ */
 struct index {
-	uint64_t current_size, max_size;
-	struct lokatt_event **arena;
+	/* shared with readers */
+	uint64_t first_id, resident_id, current_size;
+	struct index_table *table;
+	struct posting_table *postings;
+	struct time_level *time[INDEX_TIME_LEVELS];
+	struct spill *spill;
+	uint32_t seq;
+	uint32_t waiters;
+	unsigned long epoch;
+	unsigned long readers[2];
+	/* only the count is read without the lock */
+	pthread_mutex_t waker_lock;
+	struct index_waker **wakers;
+	size_t waker_count, waker_alloc;
+
+	/* only used by the producer */
+	struct index_chunk *first_chunk, *last_chunk;
+	size_t chunk_count;
+	struct retired *retired;
+
+	/* budget, 0 means unlimited */
+	uint64_t max_events;
+	size_t max_chunks;
 };
 
-void index_init(struct index *idx);
+/* 'max_events' and 'max_bytes' set the budget, 0 means unlimited */
+void index_init(struct index *idx, uint64_t max_events, uint64_t max_bytes);
 void index_destroy(struct index *idx);
 
-void index_append(struct index *idx, const struct lokatt_event *event);
-const struct lokatt_event *index_get(struct index *idx, uint64_t id);
+/*
+ * Spill chunks over the byte budget to a file in 'dir' rather than evict
+ * them. The file is unlinked right away, so it goes away with the index.
+ * Call before appending anything. Returns 0 on success, -1 on error.
+ */
+int index_spill(struct index *idx, const char *dir);
+
+/*
+ * 'msg' is only used (and must only be non-NULL) for EVENT_LOGCAT_MESSAGE,
+ * as is 'pname_id', the interned name of the process that logged it, or
+ * INTERN_NONE.
+ */
+void index_append(struct index *idx, int type, const struct adb_message *msg,
+		  uint32_t pname_id);
+
+/*
+ * Fill in the process names of the logcat messages from 'from' on that were
+ * appended without one, eg. while the device's processes were still being
+ * listed: 'lookup' returns the interned name of 'pid', or INTERN_NONE if it
+ * still isn't known. Their pname columns and posting lists are updated as
+ * well. Spilled events keep no name. Only the producer may call this.
+ */
+void index_name_processes(struct index *idx, uint64_t from,
+			  uint32_t (*lookup)(void *data, int32_t pid),
+			  void *data);
+
+/* The name of an event may be filled in while it's read. */
+static inline uint32_t index_event_pname_id(const struct index_event *event)
+{
+	return __atomic_load_n(&event->pname_id, __ATOMIC_RELAXED);
+}
+
+unsigned long index_read_begin(struct index *idx);
+void index_read_end(struct index *idx, unsigned long epoch);
+
+/* returns NULL if 'id' has been evicted or has not been appended yet */
+const struct index_event *index_get(struct index *idx, uint64_t id);
+
+/*
+ * The columns of the events in [resident_id, current_size), valid until
+ * index_read_end. Load current_size first: columns newer than the size are
+ * fine, older ones aren't.
+ */
+const struct index_columns *index_columns(struct index *idx);
+
+uint64_t index_first_id(struct index *idx);
+
+/* the first event still in memory, first_id unless spilling */
+uint64_t index_resident_id(struct index *idx);
+
+/* the number of events appended so far, ie. the id of the next one */
+uint64_t index_size(struct index *idx);
+
+/*
+ * Return the first id >= 'id' of an event with 'key' equal to 'value', or
+ * the id of the next event to be appended if there is no such event yet.
+ * Returns 'id' if it hasn't been appended yet, or has been spilled: the
+ * posting lists don't cover spilled events.
+ */
+uint64_t index_seek(struct index *idx, int key, int32_t value, uint64_t id);
+
+/*
+ * Return the first id >= 'id' of an event with a timestamp at or after
+ * 'sec' and 'nsec', or the id of the next event to be appended if there is
+ * none yet. Returns 'id' if it hasn't been appended yet. Timestamps can go
+ * backwards, eg. when the device reboots: events are searched in id order,
+ * not time order. Takes O(log n) time.
+ */
+uint64_t index_seek_time(struct index *idx, int32_t sec, int32_t nsec,
+			 uint64_t id);
+
+/* Block until event 'id' has been appended. */
+void index_wait(struct index *idx, uint64_t id);
+
+/*
+ * Like index_wait, but give up after 'timeout_ms'. Returns 0 if event 'id'
+ * has been appended, -1 on timeout.
+ */
+int index_wait_timeout(struct index *idx, uint64_t id, int timeout_ms);
+
+/* Bump 'w' on every append from now on, until removed. */
+void index_add_waker(struct index *idx, struct index_waker *w);
+void index_remove_waker(struct index *idx, struct index_waker *w);
+
+/*
+ * Wait up to 'timeout_ms', or forever if negative, for the seq of 'w' to
+ * change from 'seq', loaded before looking at the indices.
+ */
+void index_waker_wait(struct index_waker *w, uint32_t seq, int timeout_ms);
+
+/*
+ * Fill in the header fields of 'out' and point its tag and text at the
+ * index's copy. The payload of 'out' is left untouched.
+ */
+void index_event_to_message(const struct index_event *event,
+			    struct lokatt_message *out);
+
+/* Point 'out' at 'event', which must stay valid while 'out' is used. */
+void index_event_to_view(const struct index_event *event,
+			 struct lokatt_view *out);
+
+/* Copy 'event' into 'out', including tag and text. */
+void index_event_copy(const struct index_event *event,
+		      struct lokatt_event *out);
 
 #endif
@@ -0,0 +1,192 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "intern.h"
+
+#define INTERN_MAX_BYTES (4 * 1024 * 1024)
+#define INTERN_TAG_MAX_BYTES (INTERN_MAX_BYTES * 3 / 4)
+
+#define load(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define store(ptr, value) __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+
+struct entry {
+	uint32_t id;
+	uint32_t hash;
+	size_t size;
+	char str[];
+};
+
+/*
+ * Open addressing, linear probing, never more than half full. 'ids' maps
+ * ids back to entries; it has room for size / 2 of them.
+ */
+struct table {
+	size_t size;
+	struct table *prev;
+	struct entry **ids;
+	struct entry *slots[];
+};
+
+/*
+ * Readers only load the table pointer and the slots. Entries are never
+ * removed, and tables replaced by bigger ones are kept around, as readers
+ * may still be using them: they take less than the current table, and all
+ * tables count towards 'total_bytes'.
+ */
+static struct table *table;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t count;
+static size_t total_bytes;
+
+static uint32_t hash(const char *str, size_t size)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < size; i++) {
+		h ^= (uint8_t)str[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static struct entry *lookup(const struct table *t, const char *str,
+			    size_t size, uint32_t h)
+{
+	size_t i;
+
+	if (!t)
+		return NULL;
+	for (i = h & (t->size - 1);; i = (i + 1) & (t->size - 1)) {
+		struct entry *e = load(&t->slots[i]);
+
+		if (!e)
+			return NULL;
+		if (e->hash == h && e->size == size &&
+		    !memcmp(e->str, str, size))
+			return e;
+	}
+}
+
+static void insert(struct table *t, struct entry *e)
+{
+	size_t i = e->hash & (t->size - 1);
+
+	while (t->slots[i])
+		i = (i + 1) & (t->size - 1);
+	store(&t->slots[i], e);
+}
+
+static size_t table_bytes(size_t size)
+{
+	return sizeof(struct table) + (size + size / 2) *
+		sizeof(struct entry *);
+}
+
+static void grow(void)
+{
+	struct table *old = table, *new;
+	size_t size = old ? old->size * 2 : 256, i;
+
+	new = calloc(1, table_bytes(size));
+	if (!new)
+		die("calloc");
+	total_bytes += table_bytes(size);
+	new->size = size;
+	new->prev = old;
+	new->ids = &new->slots[size];
+	for (i = 0; old && i < old->size; i++) {
+		if (old->slots[i])
+			insert(new, old->slots[i]);
+	}
+	for (i = 0; old && i < old->size / 2; i++)
+		new->ids[i] = old->ids[i];
+	store(&table, new);
+}
+
+/*
+ * Make room for one more entry of 'bytes' bytes, growing the table if
+ * needed. Returns -1 if that would go over the cap. Tags have a lower cap,
+ * and only fill the table up to 3/8 rather than 1/2: the rest of the room
+ * doesn't depend on growing the table.
+ */
+static int reserve(size_t bytes, int is_tag)
+{
+	size_t max_bytes = is_tag ? INTERN_TAG_MAX_BYTES : INTERN_MAX_BYTES;
+	size_t grown = 0;
+
+	if (!table || (count + 2) * (is_tag ? 8 : 6) > table->size * 3)
+		grown = table_bytes(table ? table->size * 2 : 256);
+	if (total_bytes + grown + bytes > max_bytes)
+		return -1;
+	if (grown)
+		grow();
+	total_bytes += bytes;
+	return 0;
+}
+
+static uint32_t do_intern(const char *str, size_t size, const char **out,
+			  int is_tag)
+{
+	uint32_t h = hash(str, size);
+	struct entry *e;
+
+	e = lookup(load(&table), str, size, h);
+	if (e)
+		goto found;
+
+	pthread_mutex_lock(&lock);
+	e = lookup(table, str, size, h);
+	if (!e && !reserve(sizeof(*e) + size + 1, is_tag)) {
+		e = malloc(sizeof(*e) + size + 1);
+		if (!e)
+			die("malloc");
+		e->id = ++count;
+		e->hash = h;
+		e->size = size;
+		memcpy(e->str, str, size);
+		e->str[size] = '\0';
+		insert(table, e);
+		store(&table->ids[e->id], e);
+	}
+	pthread_mutex_unlock(&lock);
+	if (!e)
+		return INTERN_NONE;
+found:
+	if (out)
+		*out = e->str;
+	return e->id;
+}
+
+uint32_t intern(const char *str, size_t size, const char **out)
+{
+	return do_intern(str, size, out, 0);
+}
+
+uint32_t intern_tag(const char *str, size_t size, const char **out)
+{
+	return do_intern(str, size, out, 1);
+}
+
+uint32_t intern_find(const char *str)
+{
+	size_t size = strlen(str);
+	struct entry *e;
+
+	e = lookup(load(&table), str, size, hash(str, size));
+	return e ? e->id : INTERN_NONE;
+}
+
+const char *intern_string(uint32_t id)
+{
+	struct table *t = load(&table);
+	struct entry *e;
+
+	if (!t || id >= t->size / 2)
+		return NULL;
+	e = load(&t->ids[id]);
+	return e ? e->str : NULL;
+}
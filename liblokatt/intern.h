@@ -0,0 +1,37 @@
+#ifndef LIBLOKATT_INTERN_H
+#define LIBLOKATT_INTERN_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Process-wide string interning. Each distinct string gets a small integer
+ * id, starting at 1, which stays valid, along with the interned copy of the
+ * string, for the lifetime of the process. The ids are shared by all
+ * devices, so filters, which aren't bound to a device, can resolve string
+ * literals to ids when they are created.
+ *
+ * As ids are never reused, nothing is ever freed. Instead, the memory used,
+ * strings and hash tables alike, is capped; once the cap has been reached,
+ * new strings are no longer interned and INTERN_NONE is returned. Only
+ * strings read from devices are interned, filters just look theirs up, and
+ * tags, which apps may make up at will, can't take the room left for
+ * process names. Lookups don't take any locks.
+ */
+#define INTERN_NONE 0
+
+/*
+ * Intern the 'size' bytes at 'str', which need not be nul terminated, and
+ * point '*out' at the interned, nul terminated copy.
+ */
+uint32_t intern(const char *str, size_t size, const char **out);
+
+/* like intern, for tags: stops at a lower cap */
+uint32_t intern_tag(const char *str, size_t size, const char **out);
+
+/* returns INTERN_NONE if 'str' hasn't been interned */
+uint32_t intern_find(const char *str);
+
+/* the interned string with id 'id', or NULL if there is none */
+const char *intern_string(uint32_t id);
+
+#endif
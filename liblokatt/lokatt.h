@@ -1,5 +1,6 @@
 #ifndef LIBLOKATT_LOKATT_H
 #define LIBLOKATT_LOKATT_H
+#include <stddef.h>
 #include <stdint.h>
 
 enum {
@@ -21,6 +22,12 @@ struct lokatt_message {
 	uint8_t level;
 	const char *tag;
 	const char *text;
+	/*
+	 * The name of the process, as the device reported it when the message
+	 * was read, or NULL if unknown. It stays valid until the program
+	 * exits.
+	 */
+	const char *pname;
 	char payload[MSG_MAX_PAYLOAD_SIZE];
 };
 
@@ -40,10 +47,54 @@ struct lokatt_event {
 	};
 };
 
+struct lokatt_group;
+
+/*
+ * Memory budget for the events kept by a device. When the budget has been
+ * used up, the oldest events are evicted to make room for new ones. Zero
+ * means unlimited. 'max_cache_bytes' is the budget for the filter results
+ * cached by lokatt_scan; zero means 16 MiB. If 'spill_dir' is set, events
+ * over 'max_bytes' are written to a temporary file in that directory instead
+ * of being evicted, and read back when needed: scans check them one by one,
+ * and they still take about a byte of memory per 8 events. If 'group' is
+ * set, the device is read by the group's thread rather than a thread of its
+ * own, see lokatt_create_group. Passing NULL instead of a struct
+ * lokatt_options to any of the lokatt_open functions is the same as setting
+ * everything to zero.
+ */
+struct lokatt_options {
+	uint64_t max_events;
+	uint64_t max_bytes;
+	uint64_t max_cache_bytes;
+	const char *spill_dir;
+	struct lokatt_group *group;
+};
+
+/*
+ * A group of devices read by a single thread. Instead of a thread per
+ * device blocking on its own pipe, the group's thread waits for all of its
+ * devices at once, with epoll, and reads what is available from each. Close
+ * the devices of a group before destroying it.
+ */
+struct lokatt_group *lokatt_create_group(void);
+void lokatt_destroy_group(struct lokatt_group *group);
+
+/*
+ * An adb device is read with 'logcat -B', asked of the adb server over a
+ * socket (see ADB_SERVER_SOCKET and ANDROID_ADB_SERVER_PORT in adb's
+ * documentation), or through 'adb exec-out' if no server is running.
+ * logcat is restarted whenever it stops, eg. when the device is unplugged
+ * or reboots. The events then include EVENT_DEVICE_DISCONNECTED when it
+ * stops, and EVENT_DEVICE_CONNECTED before the first message once it is
+ * back. 'serialno' selects the device, NULL meaning adb's default.
+ */
 struct lokatt_device;
-struct lokatt_device *lokatt_open_adb_device(const char *serialno);
-struct lokatt_device *lokatt_open_dummy_device(const char *path);
-struct lokatt_device *lokatt_open_file(const char *path);
+struct lokatt_device *lokatt_open_adb_device(const char *serialno,
+					     const struct lokatt_options *opts);
+struct lokatt_device *lokatt_open_dummy_device(const char *path,
+					const struct lokatt_options *opts);
+struct lokatt_device *lokatt_open_file(const char *path,
+				       const struct lokatt_options *opts);
 void lokatt_close_device(struct lokatt_device *);
 
 struct lokatt_filter;
@@ -55,13 +106,168 @@ void lokatt_destroy_filter(struct lokatt_filter *f);
 int lokatt_filter_match(const struct lokatt_filter *f,
 			const struct lokatt_event *event);
 
+#define LOKATT_EVICTED 1
+
 /*
  * Read the next event, as counted from event with id 'current_id', matching
  * the filter bitmask. Will block until a matching event becomes available.
+ *
+ * Returns 0 on success. If event 'current_id' has already been evicted, no
+ * event is read: instead out->id is set to the id of the oldest event still
+ * available and LOKATT_EVICTED is returned.
+ */
+int lokatt_next_event(struct lokatt_device *dev,
+		      uint64_t current_id,
+		      const struct lokatt_filter *filter,
+		      struct lokatt_event *out);
+
+/*
+ * Find the events with ids in ['current_id', 'end_id') that match the
+ * filter, without blocking: only events already read from the device are
+ * considered. The range is split into chunks, which are scanned in parallel
+ * on a pool of worker threads. The ids of the matching events are stored in
+ * ascending order in '*out_ids', a newly allocated array of '*out_count'
+ * elements, which the caller must free.
+ *
+ * The matches are cached per device, keyed by the filter expression, so
+ * scanning again with the same filter, or one that only differs in
+ * whitespace and parentheses, only has to look at events not scanned
+ * before. The least recently used results are dropped when the cache
+ * exceeds its budget, see struct lokatt_options.
+ *
+ * Returns 0 on success. If events in the range have been evicted, before or
+ * during the scan, the matches among the remaining events are stored and
+ * LOKATT_EVICTED is returned.
+ */
+int lokatt_scan(struct lokatt_device *dev,
+		uint64_t current_id,
+		uint64_t end_id,
+		const struct lokatt_filter *filter,
+		uint64_t **out_ids,
+		size_t *out_count);
+
+/*
+ * Return the id of the first event, as counted from event with id
+ * 'current_id', with a timestamp at or after 'sec' and 'nsec', or the id of
+ * the next event to arrive if there is no such event yet. Timestamps can go
+ * backwards, eg. when the device reboots: to find a time within a later
+ * boot, start from an event in that boot. Takes logarithmic time.
+ */
+uint64_t lokatt_seek_time(struct lokatt_device *dev,
+			  uint64_t current_id,
+			  int32_t sec,
+			  int32_t nsec);
+
+/*
+ * Like lokatt_next_event, but read up to 'count' matching events into the
+ * array 'out' in a single pass over the device's events. Will block until at
+ * least one matching event becomes available, but will not wait for more.
+ * The number of events read is stored in 'out_count'. The next call should
+ * continue from out[*out_count - 1].id + 1.
  */
-uint64_t lokatt_next_event(struct lokatt_device *dev,
-			   uint64_t current_id,
-			   const struct lokatt_filter *filter,
-			   struct lokatt_event *out);
+int lokatt_next_events(struct lokatt_device *dev,
+		       uint64_t current_id,
+		       const struct lokatt_filter *filter,
+		       struct lokatt_event *out,
+		       size_t count,
+		       size_t *out_count);
+
+/*
+ * A read-only view of an event, pointing into the device's own copy rather
+ * than holding one, see lokatt_next_views. 'tag' and 'text' are nul
+ * terminated; 'tag_size' and 'text_size' are their lengths, without the
+ * nul. Only 'type' and 'id' are set for events other than
+ * EVENT_LOGCAT_MESSAGE.
+ */
+struct lokatt_view {
+	int type;
+	uint64_t id;
+	int32_t pid;
+	int32_t tid;
+	int32_t sec;
+	int32_t nsec;
+	uint8_t level;
+	const char *tag;
+	const char *text;
+	size_t tag_size;
+	size_t text_size;
+	/* as in struct lokatt_message */
+	const char *pname;
+};
+
+/*
+ * Like lokatt_next_events, but without copying: the events are returned as
+ * views into the device's storage, valid until lokatt_release_views is
+ * called with the guard stored in '*out_guard'. Release the guard whatever
+ * is returned, and don't hold on to it for long: events evicted meanwhile
+ * can't be freed until it is released. A guard may be released from any
+ * thread.
+ */
+int lokatt_next_views(struct lokatt_device *dev,
+		      uint64_t current_id,
+		      const struct lokatt_filter *filter,
+		      struct lokatt_view *out,
+		      size_t count,
+		      size_t *out_count,
+		      unsigned long *out_guard);
+void lokatt_release_views(struct lokatt_device *dev, unsigned long guard);
+
+/*
+ * Merged view of several devices: the events of all of them that match
+ * 'filter', interleaved in timestamp order. Events other than log messages
+ * go with the message before them on the same device. To merge live
+ * streams, the view holds an event back while any other device has nothing
+ * to compare it with, but for at most 'window_ms' from when that device
+ * went quiet: later events of a device quiet for longer are merged as they
+ * come, and may be out of order by that much. Events evicted before the
+ * view gets to them are skipped.
+ */
+struct lokatt_merge;
+struct lokatt_merge *lokatt_create_merge(struct lokatt_device **devs,
+					 size_t count,
+					 const struct lokatt_filter *filter,
+					 int window_ms);
+void lokatt_destroy_merge(struct lokatt_merge *m);
+
+/*
+ * Read the next event of the merged view into 'out', and the index in
+ * 'devs' of the device it came from into 'out_device'. Will block until an
+ * event is available. Returns 0 on success.
+ */
+int lokatt_merge_next(struct lokatt_merge *m, struct lokatt_event *out,
+		      size_t *out_device);
+
+/*
+ * Sessions: the events of a device, saved to a file in a compact, block
+ * compressed format. Opening a session only reads an index of its blocks,
+ * not the events themselves, and blocks that can't match a filter aren't
+ * even read. Returns 0 on success, -1 on error.
+ */
+int lokatt_save_session(struct lokatt_device *dev, const char *path);
+
+struct lokatt_session;
+struct lokatt_session *lokatt_open_session(const char *path);
+void lokatt_close_session(struct lokatt_session *s);
+
+/* the session holds events with ids in [first id, size) */
+uint64_t lokatt_session_first_id(struct lokatt_session *s);
+uint64_t lokatt_session_size(struct lokatt_session *s);
+
+/*
+ * Like lokatt_next_events, but never blocks: at the end of the session,
+ * '*out_count' is 0. Returns -1 if the file can't be read or is corrupt.
+ */
+int lokatt_session_next_events(struct lokatt_session *s,
+			       uint64_t current_id,
+			       const struct lokatt_filter *filter,
+			       struct lokatt_event *out,
+			       size_t count,
+			       size_t *out_count);
+
+/* like lokatt_seek_time */
+uint64_t lokatt_session_seek_time(struct lokatt_session *s,
+				  uint64_t current_id,
+				  int32_t sec,
+				  int32_t nsec);
 
 #endif
@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+/* lengths of 15 or more continue in bytes of 255, then a last byte */
+#define LENGTH_MASK 15
+
+static inline uint32_t read32(const char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline size_t hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static char *put_length(char *p, size_t length)
+{
+	for (; length >= 255; length -= 255)
+		*p++ = (char)255;
+	*p++ = (char)length;
+	return p;
+}
+
+/* 'match_size' is 0 for the last sequence, which has no match */
+static char *put_sequence(char *p, const char *literals, size_t size,
+			  size_t offset, size_t match_size)
+{
+	size_t match = match_size ? match_size - MIN_MATCH : 0;
+	char *token = p++;
+
+	*token = (char)((size < LENGTH_MASK ? size : LENGTH_MASK) << 4 |
+			(match < LENGTH_MASK ? match : LENGTH_MASK));
+	if (size >= LENGTH_MASK)
+		p = put_length(p, size - LENGTH_MASK);
+	memcpy(p, literals, size);
+	p += size;
+	if (!match_size)
+		return p;
+
+	*p++ = (char)(offset & 0xff);
+	*p++ = (char)(offset >> 8);
+	if (match >= LENGTH_MASK)
+		p = put_length(p, match - LENGTH_MASK);
+	return p;
+}
+
+size_t lz_compress(const char *src, size_t size, char *dst)
+{
+	/* positions + 1 of the last occurrence of each hash, 0 if none */
+	uint32_t table[1 << HASH_BITS];
+	const char *p = src, *literals = src, *end = src + size;
+	char *out = dst;
+
+	memset(table, 0, sizeof(table));
+	while (p + MIN_MATCH <= end) {
+		uint32_t v = read32(p), last;
+		size_t h = hash(v), length = MIN_MATCH;
+		const char *ref;
+
+		last = table[h];
+		table[h] = p - src + 1;
+		ref = last ? src + (last - 1) : NULL;
+		if (!ref || p - ref > MAX_OFFSET || read32(ref) != v) {
+			p++;
+			continue;
+		}
+		while (p + length < end && ref[length] == p[length])
+			length++;
+		out = put_sequence(out, literals, p - literals, p - ref,
+				   length);
+		p += length;
+		literals = p;
+	}
+	out = put_sequence(out, literals, end - literals, 0, 0);
+	return out - dst;
+}
+
+static int get_length(const char **p, const char *end, size_t *length)
+{
+	uint8_t b;
+
+	do {
+		if (*p == end)
+			return -1;
+		b = (uint8_t)*(*p)++;
+		*length += b;
+	} while (b == 255);
+	return 0;
+}
+
+int lz_decompress(const char *src, size_t size, char *dst, size_t capacity,
+		  size_t *out_size)
+{
+	const char *p = src, *end = src + size;
+	char *out = dst, *out_end = dst + capacity;
+
+	while (p < end) {
+		uint8_t token = (uint8_t)*p++;
+		size_t literals = token >> 4, match = token & LENGTH_MASK;
+		size_t offset;
+
+		if (literals == LENGTH_MASK && get_length(&p, end, &literals))
+			return -1;
+		if ((size_t)(end - p) < literals ||
+		    (size_t)(out_end - out) < literals)
+			return -1;
+		memcpy(out, p, literals);
+		out += literals;
+		p += literals;
+		if (p == end)
+			break;
+
+		if (end - p < 2)
+			return -1;
+		offset = (uint8_t)p[0] | (size_t)(uint8_t)p[1] << 8;
+		p += 2;
+		if (match == LENGTH_MASK && get_length(&p, end, &match))
+			return -1;
+		match += MIN_MATCH;
+		if (offset == 0 || offset > (size_t)(out - dst) ||
+		    (size_t)(out_end - out) < match)
+			return -1;
+		/* byte by byte: the match may overlap what it produces */
+		for (; match; match--, out++)
+			*out = out[-offset];
+	}
+	*out_size = out - dst;
+	return 0;
+}
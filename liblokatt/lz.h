@@ -0,0 +1,29 @@
+#ifndef LIBLOKATT_LZ_H
+#define LIBLOKATT_LZ_H
+#include <stddef.h>
+
+/*
+ * A small LZ77 compressor for blocks of log data, in the spirit of LZ4:
+ * fast, greedy, no entropy coding. The compressed data is a series of
+ * sequences, each a run of literals followed by a match of at least four
+ * bytes within the last 64 KiB; the last sequence has literals only.
+ */
+
+/* the most bytes compressing 'size' bytes can produce */
+#define LZ_BOUND(size) ((size) + (size) / 255 + 16)
+
+/*
+ * Compress the 'size' bytes at 'src' into 'dst', which must hold at least
+ * LZ_BOUND(size) bytes. Returns the compressed size.
+ */
+size_t lz_compress(const char *src, size_t size, char *dst);
+
+/*
+ * Decompress the 'size' bytes at 'src' into the 'capacity' bytes at 'dst',
+ * and store the decompressed size in 'out_size'. Returns 0 on success, -1 if
+ * the data is corrupt or doesn't fit.
+ */
+int lz_decompress(const char *src, size_t size, char *dst, size_t capacity,
+		  size_t *out_size);
+
+#endif
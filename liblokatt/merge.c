@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "device.h"
+#include "error.h"
+#include "index.h"
+#include "lokatt.h"
+
+/*
+ * Each device is a source with at most one event buffered, its head. The
+ * heads are kept in a binary heap ordered by timestamp, and the oldest one
+ * is returned once every source has a head: no source can have anything
+ * older. A source without a head holds up the merge until it has been
+ * empty for the reorder window; after that it is taken to be idle, and its
+ * events are merged as they come. An append to any of the devices wakes
+ * the merge up, so it waits for all of them at once.
+ */
+struct source {
+	struct lokatt_device *dev;
+	uint64_t next_id;
+	int has_head;
+	struct lokatt_event head;
+	/* events other than log messages go with the previous message */
+	int64_t ts, last_ts;
+	/* when the source was found empty, 0 if it has a head */
+	int64_t empty_since;
+};
+
+struct lokatt_merge {
+	const struct lokatt_filter *filter;
+	int window_ms;
+	struct index_waker waker;
+	struct source *sources;
+	size_t source_count;
+	/* indices of the sources with a head */
+	size_t *heap;
+	size_t heap_size;
+};
+
+static int64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* ties go to the first device, to keep the merge deterministic */
+static int before(const struct lokatt_merge *m, size_t a, size_t b)
+{
+	const struct source *x = &m->sources[a], *y = &m->sources[b];
+
+	return x->ts < y->ts || (x->ts == y->ts && a < b);
+}
+
+static void swap(size_t *a, size_t *b)
+{
+	size_t tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+static void heap_push(struct lokatt_merge *m, size_t source)
+{
+	size_t i = m->heap_size++;
+
+	m->heap[i] = source;
+	while (i > 0 && before(m, m->heap[i], m->heap[(i - 1) / 2])) {
+		swap(&m->heap[i], &m->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+}
+
+static size_t heap_pop(struct lokatt_merge *m)
+{
+	size_t top = m->heap[0], i = 0;
+
+	m->heap[0] = m->heap[--m->heap_size];
+	for (;;) {
+		size_t l = 2 * i + 1, r = l + 1, min = i;
+
+		if (l < m->heap_size && before(m, m->heap[l], m->heap[min]))
+			min = l;
+		if (r < m->heap_size && before(m, m->heap[r], m->heap[min]))
+			min = r;
+		if (min == i)
+			break;
+		swap(&m->heap[i], &m->heap[min]);
+		i = min;
+	}
+	return top;
+}
+
+/* Try to read the next event of a source without a head. */
+static void fill(struct lokatt_merge *m, size_t i)
+{
+	struct source *s = &m->sources[i];
+	size_t count;
+	int ret;
+
+	ret = device_poll_events(s->dev, &s->next_id, m->filter, &s->head, 1,
+				 &count);
+	if (ret == LOKATT_EVICTED) {
+		/* a live view: skip what has been evicted */
+		s->next_id = s->head.id;
+		ret = device_poll_events(s->dev, &s->next_id, m->filter,
+					 &s->head, 1, &count);
+	}
+	if (ret || count == 0) {
+		if (!s->empty_since)
+			s->empty_since = now_ms();
+		return;
+	}
+
+	s->has_head = 1;
+	s->empty_since = 0;
+	if (s->head.type & EVENT_LOGCAT_MESSAGE)
+		s->last_ts = (int64_t)s->head.msg.sec * 1000000000 +
+			s->head.msg.nsec;
+	s->ts = s->last_ts;
+	heap_push(m, i);
+}
+
+/*
+ * Return the source that holds up the merge the longest, and how long it
+ * may still do so, or -1 if none does.
+ */
+static long holding_up(const struct lokatt_merge *m, int *timeout_ms)
+{
+	int64_t now = now_ms();
+	long source = -1;
+	size_t i;
+
+	for (i = 0; i < m->source_count; i++) {
+		const struct source *s = &m->sources[i];
+		int64_t left;
+
+		if (s->has_head)
+			continue;
+		left = s->empty_since + m->window_ms - now;
+		if (left > 0 && (source < 0 || left > *timeout_ms)) {
+			source = i;
+			*timeout_ms = left;
+		}
+	}
+	return source;
+}
+
+struct lokatt_merge *lokatt_create_merge(struct lokatt_device **devs,
+					 size_t count,
+					 const struct lokatt_filter *filter,
+					 int window_ms)
+{
+	struct lokatt_merge *m;
+	size_t i;
+
+	if (count == 0)
+		return NULL;
+	m = calloc(1, sizeof(*m));
+	if (!m)
+		die("calloc");
+	m->filter = filter;
+	m->window_ms = window_ms;
+	m->sources = calloc(count, sizeof(m->sources[0]));
+	m->heap = calloc(count, sizeof(m->heap[0]));
+	if (!m->sources || !m->heap)
+		die("calloc");
+	m->source_count = count;
+	for (i = 0; i < count; i++) {
+		m->sources[i].dev = devs[i];
+		device_add_waker(devs[i], &m->waker);
+	}
+	return m;
+}
+
+void lokatt_destroy_merge(struct lokatt_merge *m)
+{
+	size_t i;
+
+	for (i = 0; i < m->source_count; i++)
+		device_remove_waker(m->sources[i].dev, &m->waker);
+	free(m->heap);
+	free(m->sources);
+	free(m);
+}
+
+int lokatt_merge_next(struct lokatt_merge *m, struct lokatt_event *out,
+		      size_t *out_device)
+{
+	struct source *s;
+	int timeout_ms;
+	uint32_t seq;
+	size_t i;
+
+	for (;;) {
+		/* before filling, so that no append goes unnoticed */
+		seq = __atomic_load_n(&m->waker.seq, __ATOMIC_SEQ_CST);
+		for (i = 0; i < m->source_count; i++) {
+			if (!m->sources[i].has_head)
+				fill(m, i);
+		}
+
+		/*
+		 * Wait for any device, but no longer than the window of the
+		 * source holding up the merge, if any.
+		 */
+		timeout_ms = -1;
+		if (holding_up(m, &timeout_ms) < 0 && m->heap_size > 0)
+			break;
+		index_waker_wait(&m->waker, seq, timeout_ms);
+	}
+
+	i = heap_pop(m);
+	s = &m->sources[i];
+	s->has_head = 0;
+	*out = s->head;
+	if (out->type & EVENT_LOGCAT_MESSAGE) {
+		out->msg.tag = out->msg.payload +
+			(s->head.msg.tag - s->head.msg.payload);
+		out->msg.text = out->msg.payload +
+			(s->head.msg.text - s->head.msg.payload);
+	}
+	*out_device = i;
+	return 0;
+}
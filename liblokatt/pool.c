@@ -0,0 +1,98 @@
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "pool.h"
+
+#define POOL_MAX_THREADS 64
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static int thread_count;
+
+/* one job at a time */
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static unsigned long generation;
+static void (*job_fn)(void *arg);
+static void *job_arg;
+static int busy;
+
+static void *worker_main(void *unused)
+{
+	unsigned long seen = 0;
+	void (*fn)(void *arg);
+	void *arg;
+
+	(void)unused;
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (generation == seen)
+			pthread_cond_wait(&work, &lock);
+		seen = generation;
+		fn = job_fn;
+		arg = job_arg;
+		pthread_mutex_unlock(&lock);
+
+		fn(arg);
+
+		pthread_mutex_lock(&lock);
+		if (--busy == 0)
+			pthread_cond_signal(&done);
+	}
+	return NULL;
+}
+
+static void init(void)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	sigset_t all, old;
+	pthread_t thread;
+	int i;
+
+	thread_count = cpus > 1 ? cpus - 1 : 0;
+	if (thread_count > POOL_MAX_THREADS)
+		thread_count = POOL_MAX_THREADS;
+
+	/* workers inherit the mask: keep signals on the user's threads */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&thread, NULL, worker_main, NULL))
+			die("pthread_create");
+		pthread_detach(thread);
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+int pool_size(void)
+{
+	pthread_once(&once, init);
+	return thread_count + 1;
+}
+
+void pool_run(void (*fn)(void *arg), void *arg)
+{
+	pthread_once(&once, init);
+	pthread_mutex_lock(&run_lock);
+
+	pthread_mutex_lock(&lock);
+	job_fn = fn;
+	job_arg = arg;
+	busy = thread_count;
+	generation++;
+	pthread_cond_broadcast(&work);
+	pthread_mutex_unlock(&lock);
+
+	fn(arg);
+
+	pthread_mutex_lock(&lock);
+	while (busy)
+		pthread_cond_wait(&done, &lock);
+	pthread_mutex_unlock(&lock);
+
+	pthread_mutex_unlock(&run_lock);
+}
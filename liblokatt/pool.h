@@ -0,0 +1,19 @@
+#ifndef LIBLOKATT_POOL_H
+#define LIBLOKATT_POOL_H
+
+/*
+ * Process-wide pool of worker threads, one per online CPU but the caller's.
+ * The threads are started on first use and live as long as the process.
+ */
+
+/* number of threads pool_run runs 'fn' on, including the caller */
+int pool_size(void);
+
+/*
+ * Run 'fn(arg)' on every worker thread and on the calling thread, and wait
+ * for all of them to return. 'fn' typically grabs work items off a shared
+ * counter until there are none left. Concurrent calls are serialized.
+ */
+void pool_run(void (*fn)(void *arg), void *arg);
+
+#endif
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+#include "error.h"
+#include "intern.h"
+#include "procs.h"
+
+/* a free slot has 'id' INTERN_NONE */
+struct proc {
+	int32_t pid;
+	uint32_t id;
+};
+
+static size_t slot_of(int32_t pid, size_t size)
+{
+	return ((uint32_t)pid * 2654435761u) & (size - 1);
+}
+
+static struct proc *find(const struct proc_table *t, int32_t pid)
+{
+	size_t i;
+
+	if (!t->slots)
+		return NULL;
+	for (i = slot_of(pid, t->size);; i = (i + 1) & (t->size - 1)) {
+		struct proc *proc = &t->slots[i];
+
+		if (proc->id == INTERN_NONE || proc->pid == pid)
+			return proc;
+	}
+}
+
+static void grow(struct proc_table *t)
+{
+	struct proc *old = t->slots, *proc;
+	size_t old_size = t->size, i;
+
+	t->size = old_size ? old_size * 2 : 256;
+	t->slots = calloc(t->size, sizeof(*t->slots));
+	if (!t->slots)
+		die("calloc");
+	for (i = 0; i < old_size; i++) {
+		if (old[i].id == INTERN_NONE)
+			continue;
+		proc = find(t, old[i].pid);
+		*proc = old[i];
+	}
+	free(old);
+}
+
+static void add(void *data, int32_t pid, const char *name)
+{
+	struct proc_table *t = data;
+	struct proc *proc;
+	uint32_t id;
+
+	id = intern(name, strlen(name), NULL);
+	if (id == INTERN_NONE)
+		return;
+	if ((t->count + 1) * 2 > t->size)
+		grow(t);
+	proc = find(t, pid);
+	if (proc->id == INTERN_NONE)
+		t->count++;
+	proc->pid = pid;
+	proc->id = id;
+}
+
+static void clear(struct proc_table *t)
+{
+	free(t->slots);
+	memset(t, 0, sizeof(*t));
+}
+
+static void start_listing(struct procs *p)
+{
+	p->listing = 1;
+	p->stale = 0;
+	p->started++;
+	procs_poll(p);
+}
+
+void procs_init(struct procs *p, void *backend, struct backend_ops *ops)
+{
+	memset(p, 0, sizeof(*p));
+	p->backend = backend;
+	p->ops = ops;
+	start_listing(p);
+}
+
+void procs_destroy(struct procs *p)
+{
+	free(p->table.slots);
+	free(p->next.slots);
+}
+
+void procs_forget(struct procs *p)
+{
+	clear(&p->table);
+	p->has_listed = 0;
+	if (p->listing)
+		p->stale = 1;
+	else
+		start_listing(p);
+}
+
+static long ms_since(const struct timespec *then)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - then->tv_sec) * 1000 +
+		(now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+/* Replace the table once a listing is done, or keep it if listing fails. */
+int procs_poll(struct procs *p)
+{
+	int status, replaced = 0;
+
+	if (!p->listing)
+		return 0;
+	status = p->ops->list_processes(p->backend, add, &p->next);
+	if (status == BACKEND_AGAIN)
+		return 0;
+	p->listing = 0;
+	if (status == 0 && !p->stale) {
+		free(p->table.slots);
+		p->table = p->next;
+		memset(&p->next, 0, sizeof(p->next));
+		replaced = 1;
+	} else {
+		clear(&p->next);
+	}
+	if (p->stale) {
+		start_listing(p);
+		return 0;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &p->listed);
+	p->has_listed = 1;
+	return replaced;
+}
+
+uint32_t procs_find(struct procs *p, int32_t pid)
+{
+	struct proc *proc = find(&p->table, pid);
+
+	return proc ? proc->id : INTERN_NONE;
+}
+
+uint32_t procs_lookup(struct procs *p, int32_t pid)
+{
+	uint32_t id = procs_find(p, pid);
+
+	if (id != INTERN_NONE)
+		return id;
+	if (p->listing ||
+	    (p->has_listed && ms_since(&p->listed) < PROCS_REFRESH_MS))
+		return INTERN_NONE;
+
+	/* the listing may be done right away, eg. if it fails */
+	start_listing(p);
+	return procs_find(p, pid);
+}
@@ -0,0 +1,72 @@
+#ifndef LIBLOKATT_PROCS_H
+#define LIBLOKATT_PROCS_H
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+struct backend_ops;
+struct proc;
+
+/*
+ * The process table of a device: the name of each pid, interned (see
+ * intern.h), so that messages can be tagged with the id of their process'
+ * name as they are read. The table is filled in bulk from one listing of
+ * the device's processes, and listed again when a pid turns up that isn't
+ * in it, at most every PROCS_REFRESH_MS: pids of processes that have
+ * already exited don't cause a listing per message. Listing doesn't block:
+ * it goes on in the background, see procs_poll, and the new table replaces
+ * the old one once it's complete, so messages read in the meantime may
+ * have to be named afterwards. Only the thread that reads the device uses
+ * the table, so it takes no locks.
+ */
+#define PROCS_REFRESH_MS 500
+
+/* open addressing, linear probing, never more than half full */
+struct proc_table {
+	struct proc *slots;
+	size_t size, count;
+};
+
+struct procs {
+	void *backend;
+	struct backend_ops *ops;
+
+	struct proc_table table;
+	/* filled by the listing under way, if any */
+	struct proc_table next;
+	int listing;
+	/* forgotten while listing: the listing may be out of date */
+	int stale;
+	/* the number of listings started so far */
+	unsigned long started;
+
+	struct timespec listed;
+	int has_listed;
+};
+
+/* Start listing the processes right away. */
+void procs_init(struct procs *p, void *backend, struct backend_ops *ops);
+void procs_destroy(struct procs *p);
+
+/*
+ * The interned name of 'pid', or INTERN_NONE if it isn't known, in which
+ * case a listing may be started.
+ */
+uint32_t procs_lookup(struct procs *p, int32_t pid);
+
+/* Like procs_lookup, but never start a listing. */
+uint32_t procs_find(struct procs *p, int32_t pid);
+
+/*
+ * Carry on with the listing under way, if any. Call when the fd is ready.
+ * Returns 1 if the listing is done and has replaced the table, 0 otherwise.
+ */
+int procs_poll(struct procs *p);
+
+/*
+ * Forget all names, eg. after the device has rebooted and pids may have
+ * been reused, and list the processes again right away.
+ */
+void procs_forget(struct procs *p);
+
+#endif
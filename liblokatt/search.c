@@ -0,0 +1,158 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "error.h"
+#include "search.h"
+
+static inline int is_candidate(const struct search *s, const char *p)
+{
+	return ((uint8_t)p[0] | s->first_mask) == s->first &&
+		((uint8_t)p[s->size - 1] | s->last_mask) == s->last;
+}
+
+static inline int compare(const struct search *s, const char *p)
+{
+	if (s->icase)
+		return !strncasecmp(p, s->needle, s->size);
+	return !memcmp(p, s->needle, s->size);
+}
+
+/* Check positions [pos, size - needle size] one at a time. */
+static int scan_tail(const struct search *s, const char *haystack,
+		     size_t pos, size_t size)
+{
+	for (; pos + s->size <= size; pos++) {
+		if (is_candidate(s, haystack + pos) &&
+		    compare(s, haystack + pos))
+			return 1;
+	}
+	return 0;
+}
+
+static int scan_scalar(const struct search *s, const char *haystack,
+		       size_t size)
+{
+	return scan_tail(s, haystack, 0, size);
+}
+
+#ifdef __SSE2__
+static int scan_sse2(const struct search *s, const char *haystack,
+		     size_t size)
+{
+	const __m128i first = _mm_set1_epi8(s->first);
+	const __m128i first_mask = _mm_set1_epi8(s->first_mask);
+	const __m128i last = _mm_set1_epi8(s->last);
+	const __m128i last_mask = _mm_set1_epi8(s->last_mask);
+	size_t pos;
+
+	for (pos = 0; pos + 16 + s->size - 1 <= size; pos += 16) {
+		const char *p = haystack + pos;
+		__m128i a, b;
+		unsigned int bits;
+
+		a = _mm_loadu_si128((const __m128i *)p);
+		b = _mm_loadu_si128((const __m128i *)(p + s->size - 1));
+		a = _mm_cmpeq_epi8(_mm_or_si128(a, first_mask), first);
+		b = _mm_cmpeq_epi8(_mm_or_si128(b, last_mask), last);
+		bits = _mm_movemask_epi8(_mm_and_si128(a, b));
+		while (bits) {
+			if (compare(s, p + __builtin_ctz(bits)))
+				return 1;
+			bits &= bits - 1;
+		}
+	}
+	return scan_tail(s, haystack, pos, size);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static int scan_avx2(const struct search *s, const char *haystack,
+		     size_t size)
+{
+	const __m256i first = _mm256_set1_epi8(s->first);
+	const __m256i first_mask = _mm256_set1_epi8(s->first_mask);
+	const __m256i last = _mm256_set1_epi8(s->last);
+	const __m256i last_mask = _mm256_set1_epi8(s->last_mask);
+	size_t pos;
+
+	for (pos = 0; pos + 32 + s->size - 1 <= size; pos += 32) {
+		const char *p = haystack + pos;
+		__m256i a, b;
+		unsigned int bits;
+
+		a = _mm256_loadu_si256((const __m256i *)p);
+		b = _mm256_loadu_si256((const __m256i *)(p + s->size - 1));
+		a = _mm256_cmpeq_epi8(_mm256_or_si256(a, first_mask), first);
+		b = _mm256_cmpeq_epi8(_mm256_or_si256(b, last_mask), last);
+		bits = _mm256_movemask_epi8(_mm256_and_si256(a, b));
+		while (bits) {
+			if (compare(s, p + __builtin_ctz(bits)))
+				return 1;
+			bits &= bits - 1;
+		}
+	}
+	return scan_tail(s, haystack, pos, size);
+}
+#endif
+
+/*
+ * For case insensitive searches, letters are folded to lower case by
+ * setting bit 0x20, which leaves the byte unchanged if it already was a
+ * lower case letter. Other bytes are compared as is.
+ */
+static void set_byte(uint8_t c, int icase, uint8_t *value, uint8_t *mask)
+{
+	if (icase && isalpha(c)) {
+		*value = tolower(c);
+		*mask = 0x20;
+	} else {
+		*value = c;
+		*mask = 0;
+	}
+}
+
+void search_init(struct search *s, const char *needle, int icase)
+{
+	s->needle = strdup(needle);
+	if (!s->needle)
+		die("strdup");
+	s->size = strlen(needle);
+	s->icase = icase;
+	if (s->size) {
+		set_byte(needle[0], icase, &s->first, &s->first_mask);
+		set_byte(needle[s->size - 1], icase, &s->last, &s->last_mask);
+	}
+
+	s->scan = scan_scalar;
+#ifdef __SSE2__
+	s->scan = scan_sse2;
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		s->scan = scan_avx2;
+#endif
+}
+
+void search_destroy(struct search *s)
+{
+	free(s->needle);
+}
+
+int search_find(const struct search *s, const char *haystack)
+{
+	size_t size;
+
+	if (s->size == 0)
+		return 1;
+	size = strlen(haystack);
+	if (size < s->size)
+		return 0;
+	return s->scan(s, haystack, size);
+}
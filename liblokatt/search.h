@@ -0,0 +1,29 @@
+#ifndef LIBLOKATT_SEARCH_H
+#define LIBLOKATT_SEARCH_H
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A precompiled substring search. Candidate positions are found by
+ * comparing the first and last byte of the needle against a whole vector
+ * of the haystack at a time, and only candidates are compared in full.
+ * The widest kernel the CPU supports is picked in search_init.
+ */
+struct search {
+	char *needle;
+	size_t size;
+	int icase;
+	/* a byte b matches the first byte if (b | first_mask) == first */
+	uint8_t first, first_mask;
+	uint8_t last, last_mask;
+	int (*scan)(const struct search *s, const char *haystack, size_t size);
+};
+
+/* 'icase' makes the search ignore ASCII case */
+void search_init(struct search *s, const char *needle, int icase);
+void search_destroy(struct search *s);
+
+/* returns non-zero if 'haystack' contains the needle */
+int search_find(const struct search *s, const char *haystack);
+
+#endif
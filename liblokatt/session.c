@@ -0,0 +1,863 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "filter.h"
+#include "index.h"
+#include "intern.h"
+#include "lokatt.h"
+#include "lz.h"
+#include "session.h"
+
+/*
+ * Session file format. All integers are little endian.
+ *
+ *   file header   magic, u32 version, u32 reserved
+ *   blocks        for each block: block header, compressed events
+ *   footer        for each block: u64 offset, block header
+ *   trailer       u64 footer offset, u32 block count, u32 version, magic
+ *
+ * A block holds events with consecutive ids, up to SESSION_BLOCK_SIZE bytes
+ * of them before compression (see lz.h), each stored as
+ *
+ *   u8 type, u8 level, i32 pid, i32 tid, i32 sec, i32 nsec,
+ *   u16 tag size, u16 text size, u16 process name size,
+ *   tag, '\0', text, '\0', process name, '\0'
+ *
+ * with an empty process name if it isn't known.
+ *
+ * The block header describes the events in the block, so that readers can
+ * skip it without decompressing it: the id of the first event, the number
+ * of events, the event types present, the smallest and largest timestamp,
+ * a checksum of the events, and a bloom filter of the tags, sized to the
+ * number of different tags in the block. The footer repeats the block
+ * headers, so opening a session only reads the footer.
+ */
+#define SESSION_MAGIC "LOKATTS"
+#define SESSION_MAGIC_SIZE 8
+#define SESSION_VERSION 3
+#define SESSION_BLOCK_SIZE (64 * 1024)
+
+#define FILE_HEADER_SIZE (SESSION_MAGIC_SIZE + 8)
+#define TRAILER_SIZE (16 + SESSION_MAGIC_SIZE)
+#define RECORD_HEADER_SIZE 24
+#define MAX_BLOCK_EVENTS (SESSION_BLOCK_SIZE / RECORD_HEADER_SIZE)
+
+/* about 1% false positives */
+#define BLOOM_BITS_PER_TAG 10
+#define BLOOM_HASHES 7
+#define BLOOM_MAX_WORDS ((MAX_BLOCK_EVENTS * BLOOM_BITS_PER_TAG + 63) / 64)
+
+/* a block header is followed by its bloom filter, in 64-bit words */
+#define BLOCK_HEADER_SIZE(words) (48 + 8 * (size_t)(words))
+#define FOOTER_ENTRY_SIZE(words) (8 + BLOCK_HEADER_SIZE(words))
+
+struct block_header {
+	uint32_t compressed_size;
+	uint32_t raw_size;
+	uint32_t event_count;
+	uint32_t types;
+	uint32_t checksum;
+	uint32_t bloom_words;
+	uint64_t first_id;
+	int64_t min_time;
+	int64_t max_time;
+	uint64_t *bloom;
+};
+
+static void put_u16(char *p, uint16_t v)
+{
+	p[0] = (char)v;
+	p[1] = (char)(v >> 8);
+}
+
+static void put_u32(char *p, uint32_t v)
+{
+	put_u16(p, (uint16_t)v);
+	put_u16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_u64(char *p, uint64_t v)
+{
+	put_u32(p, (uint32_t)v);
+	put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint16_t get_u16(const char *p)
+{
+	return (uint8_t)p[0] | (uint16_t)(uint8_t)p[1] << 8;
+}
+
+static uint32_t get_u32(const char *p)
+{
+	return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static uint64_t get_u64(const char *p)
+{
+	return get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static void encode_block_header(char *p, const struct block_header *h)
+{
+	size_t i;
+
+	put_u32(p, h->compressed_size);
+	put_u32(p + 4, h->raw_size);
+	put_u32(p + 8, h->event_count);
+	put_u32(p + 12, h->types);
+	put_u32(p + 16, h->checksum);
+	put_u32(p + 20, h->bloom_words);
+	put_u64(p + 24, h->first_id);
+	put_u64(p + 32, (uint64_t)h->min_time);
+	put_u64(p + 40, (uint64_t)h->max_time);
+	for (i = 0; i < h->bloom_words; i++)
+		put_u64(p + 48 + 8 * i, h->bloom[i]);
+}
+
+/*
+ * Decode the header at 'p', of up to 'size' bytes, with its bloom filter
+ * going to 'bloom'. Returns the size of the header, or 0 if it is bad.
+ */
+static size_t decode_block_header(const char *p, size_t size,
+				  struct block_header *h, uint64_t *bloom)
+{
+	size_t i;
+
+	if (size < BLOCK_HEADER_SIZE(0))
+		return 0;
+	h->compressed_size = get_u32(p);
+	h->raw_size = get_u32(p + 4);
+	h->event_count = get_u32(p + 8);
+	h->types = get_u32(p + 12);
+	h->checksum = get_u32(p + 16);
+	h->bloom_words = get_u32(p + 20);
+	h->first_id = get_u64(p + 24);
+	h->min_time = (int64_t)get_u64(p + 32);
+	h->max_time = (int64_t)get_u64(p + 40);
+	if (h->bloom_words == 0 || h->bloom_words > BLOOM_MAX_WORDS ||
+	    size < BLOCK_HEADER_SIZE(h->bloom_words))
+		return 0;
+	h->bloom = bloom;
+	for (i = 0; i < h->bloom_words; i++)
+		h->bloom[i] = get_u64(p + 48 + 8 * i);
+	return BLOCK_HEADER_SIZE(h->bloom_words);
+}
+
+static inline int64_t timestamp(int32_t sec, int32_t nsec)
+{
+	return (int64_t)sec * 1000000000 + nsec;
+}
+
+static uint32_t hash(const char *data, size_t size)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	/* FNV-1a */
+	for (i = 0; i < size; i++) {
+		h ^= (uint8_t)data[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* double hashing, of the tag's hash, into a bloom filter of 'words' */
+static void bloom_bits(uint32_t h, uint32_t words,
+		       uint32_t bits[BLOOM_HASHES])
+{
+	uint32_t step = (h >> 17 | h << 15) | 1;
+	size_t i;
+
+	for (i = 0; i < BLOOM_HASHES; i++, h += step)
+		bits[i] = h % (words * 64);
+}
+
+static void bloom_add(struct block_header *h, uint32_t tag_hash)
+{
+	uint32_t bits[BLOOM_HASHES];
+	size_t i;
+
+	bloom_bits(tag_hash, h->bloom_words, bits);
+	for (i = 0; i < BLOOM_HASHES; i++)
+		h->bloom[bits[i] / 64] |= (uint64_t)1 << (bits[i] % 64);
+}
+
+static int bloom_test(const struct block_header *h, const char *tag)
+{
+	uint32_t bits[BLOOM_HASHES];
+	size_t i;
+
+	bloom_bits(hash(tag, strlen(tag)), h->bloom_words, bits);
+	for (i = 0; i < BLOOM_HASHES; i++) {
+		if (!((h->bloom[bits[i] / 64] >> (bits[i] % 64)) & 1))
+			return 0;
+	}
+	return 1;
+}
+
+static int write_all(int fd, const char *buf, size_t size)
+{
+	while (size) {
+		ssize_t r = write(fd, buf, size);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += r;
+		size -= r;
+	}
+	return 0;
+}
+
+static int pread_all(int fd, char *buf, size_t size, uint64_t offset)
+{
+	while (size) {
+		ssize_t r = pread(fd, buf, size, offset);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (r == 0)
+			return -1;
+		buf += r;
+		size -= r;
+		offset += r;
+	}
+	return 0;
+}
+
+struct writer {
+	int fd;
+	uint64_t offset;
+
+	/* the block being filled */
+	struct block_header header;
+	char *raw;
+	size_t raw_size;
+	char *compressed;
+	/* the hashes of the block's tags, one per message */
+	uint32_t *tags;
+	size_t tag_count;
+
+	char *footer;
+	size_t footer_size, footer_alloc;
+	uint32_t block_count;
+};
+
+static int compare_u32(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Size the bloom filter to the number of different tags, and fill it. */
+static void fill_bloom(struct writer *w)
+{
+	struct block_header *h = &w->header;
+	size_t i, distinct = 0;
+
+	qsort(w->tags, w->tag_count, sizeof(*w->tags), compare_u32);
+	for (i = 0; i < w->tag_count; i++) {
+		if (i == 0 || w->tags[i] != w->tags[i - 1])
+			w->tags[distinct++] = w->tags[i];
+	}
+	h->bloom_words = (distinct * BLOOM_BITS_PER_TAG + 63) / 64;
+	if (h->bloom_words == 0)
+		h->bloom_words = 1;
+	memset(h->bloom, 0, h->bloom_words * sizeof(*h->bloom));
+	for (i = 0; i < distinct; i++)
+		bloom_add(h, w->tags[i]);
+	w->tag_count = 0;
+}
+
+static int flush_block(struct writer *w)
+{
+	struct block_header *h = &w->header;
+	char buf[BLOCK_HEADER_SIZE(BLOOM_MAX_WORDS)];
+	size_t header_size;
+	uint64_t *bloom = h->bloom;
+
+	if (!h->event_count)
+		return 0;
+	fill_bloom(w);
+	header_size = BLOCK_HEADER_SIZE(h->bloom_words);
+	h->raw_size = w->raw_size;
+	h->checksum = hash(w->raw, w->raw_size);
+	h->compressed_size = lz_compress(w->raw, w->raw_size, w->compressed);
+	encode_block_header(buf, h);
+	if (write_all(w->fd, buf, header_size) ||
+	    write_all(w->fd, w->compressed, h->compressed_size))
+		return -1;
+
+	while (w->footer_size + 8 + header_size > w->footer_alloc) {
+		w->footer_alloc = w->footer_alloc ? w->footer_alloc * 2 :
+			64 * FOOTER_ENTRY_SIZE(1);
+		w->footer = realloc(w->footer, w->footer_alloc);
+		if (!w->footer)
+			die("realloc");
+	}
+	put_u64(w->footer + w->footer_size, w->offset);
+	memcpy(w->footer + w->footer_size + 8, buf, header_size);
+	w->footer_size += 8 + header_size;
+	w->block_count++;
+
+	w->offset += header_size + h->compressed_size;
+	memset(h, 0, sizeof(*h));
+	h->bloom = bloom;
+	w->raw_size = 0;
+	return 0;
+}
+
+static int add_event(struct writer *w, const struct index_event *event)
+{
+	struct block_header *h = &w->header;
+	const char *pname = intern_string(index_event_pname_id(event));
+	size_t tag_size = event->tag_size, text_size = event->text_size;
+	size_t pname_size = pname ? strlen(pname) : 0;
+	size_t size = RECORD_HEADER_SIZE + tag_size + 1 + text_size + 1 +
+		pname_size + 1;
+	int64_t ts = timestamp(event->sec, event->nsec);
+	char *p;
+
+	/* a gap in the ids, from events evicted while writing, ends a block */
+	if (h->event_count &&
+	    (event->id != h->first_id + h->event_count ||
+	     w->raw_size + size > SESSION_BLOCK_SIZE)) {
+		if (flush_block(w))
+			return -1;
+	}
+	if (!h->event_count) {
+		h->first_id = event->id;
+		h->min_time = h->max_time = ts;
+	}
+	h->event_count++;
+	h->types |= event->type;
+	if (ts < h->min_time)
+		h->min_time = ts;
+	if (ts > h->max_time)
+		h->max_time = ts;
+	if (event->type & EVENT_LOGCAT_MESSAGE)
+		w->tags[w->tag_count++] = hash(event->tag, tag_size);
+
+	p = w->raw + w->raw_size;
+	p[0] = (char)event->type;
+	p[1] = (char)event->level;
+	put_u32(p + 2, (uint32_t)event->pid);
+	put_u32(p + 6, (uint32_t)event->tid);
+	put_u32(p + 10, (uint32_t)event->sec);
+	put_u32(p + 14, (uint32_t)event->nsec);
+	put_u16(p + 18, (uint16_t)tag_size);
+	put_u16(p + 20, (uint16_t)text_size);
+	put_u16(p + 22, (uint16_t)pname_size);
+	p += RECORD_HEADER_SIZE;
+	memcpy(p, event->tag, tag_size + 1);
+	memcpy(p + tag_size + 1, event->text, text_size + 1);
+	p += tag_size + 1 + text_size + 1;
+	if (pname)
+		memcpy(p, pname, pname_size);
+	p[pname_size] = '\0';
+	w->raw_size += size;
+	return 0;
+}
+
+int session_write(struct index *idx, const char *path)
+{
+	char header[FILE_HEADER_SIZE], trailer[TRAILER_SIZE];
+	const struct index_event *event;
+	unsigned long epoch;
+	uint64_t id, size;
+	struct writer w;
+	int retval = -1;
+
+	memset(&w, 0, sizeof(w));
+	w.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (w.fd < 0)
+		return -1;
+	w.raw = malloc(SESSION_BLOCK_SIZE);
+	w.compressed = malloc(LZ_BOUND(SESSION_BLOCK_SIZE));
+	w.tags = malloc(MAX_BLOCK_EVENTS * sizeof(*w.tags));
+	w.header.bloom = malloc(BLOOM_MAX_WORDS * sizeof(*w.header.bloom));
+	if (!w.raw || !w.compressed || !w.tags || !w.header.bloom)
+		die("malloc");
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, SESSION_MAGIC, SESSION_MAGIC_SIZE);
+	put_u32(header + SESSION_MAGIC_SIZE, SESSION_VERSION);
+	if (write_all(w.fd, header, sizeof(header)))
+		goto bail;
+	w.offset = sizeof(header);
+
+	epoch = index_read_begin(idx);
+	size = index_size(idx);
+	for (id = index_first_id(idx); id < size; id++) {
+		/* don't hold on to memory the producer has retired for long */
+		if (id % 4096 == 0) {
+			index_read_end(idx, epoch);
+			epoch = index_read_begin(idx);
+		}
+		event = index_get(idx, id);
+		if (event && add_event(&w, event))
+			break;
+	}
+	index_read_end(idx, epoch);
+	if (id < size || flush_block(&w))
+		goto bail;
+
+	put_u64(trailer, w.offset);
+	put_u32(trailer + 8, w.block_count);
+	put_u32(trailer + 12, SESSION_VERSION);
+	memcpy(trailer + 16, SESSION_MAGIC, SESSION_MAGIC_SIZE);
+	if (write_all(w.fd, w.footer, w.footer_size) ||
+	    write_all(w.fd, trailer, sizeof(trailer)))
+		goto bail;
+	retval = 0;
+bail:
+	if (close(w.fd) && retval == 0)
+		retval = -1;
+	if (retval)
+		unlink(path);
+	free(w.raw);
+	free(w.compressed);
+	free(w.tags);
+	free(w.header.bloom);
+	free(w.footer);
+	return retval;
+}
+
+struct block {
+	uint64_t offset;
+	struct block_header header;
+};
+
+struct record {
+	int type;
+	uint8_t level;
+	int32_t pid;
+	int32_t tid;
+	int32_t sec;
+	int32_t nsec;
+	uint32_t tag_id;
+	uint32_t pname_id;
+	const char *tag;
+	const char *text;
+	/* interned, NULL if unknown */
+	const char *pname;
+};
+
+struct lokatt_session {
+	int fd;
+	pthread_mutex_t lock;
+	struct block *blocks;
+	size_t block_count;
+	/* the blocks' bloom filters */
+	uint64_t *blooms;
+
+	/*
+	 * A tree of the blocks' largest timestamps: node n is the larger of
+	 * nodes 2n and 2n + 1, and block i is node leaves + i.
+	 */
+	int64_t *max_time;
+	size_t leaves;
+
+	/* the last block read, decompressed, or block_count if none */
+	size_t current;
+	char *compressed;
+	char *data;
+	struct record *records;
+};
+
+/* sanity check the footer, so that reading blocks can trust it */
+static int check_blocks(const struct lokatt_session *s,
+			uint64_t footer_offset)
+{
+	uint64_t offset = FILE_HEADER_SIZE, next_id = 0;
+	size_t i;
+
+	for (i = 0; i < s->block_count; i++) {
+		const struct block *b = &s->blocks[i];
+		const struct block_header *h = &b->header;
+
+		if (b->offset != offset ||
+		    h->raw_size > SESSION_BLOCK_SIZE ||
+		    h->compressed_size > LZ_BOUND(SESSION_BLOCK_SIZE) ||
+		    h->event_count == 0 ||
+		    h->event_count > h->raw_size / RECORD_HEADER_SIZE ||
+		    (i > 0 && h->first_id < next_id) ||
+		    h->first_id + h->event_count < h->first_id)
+			return -1;
+		offset += BLOCK_HEADER_SIZE(h->bloom_words) +
+			h->compressed_size;
+		next_id = h->first_id + h->event_count;
+	}
+	return offset == footer_offset ? 0 : -1;
+}
+
+static void build_time_tree(struct lokatt_session *s)
+{
+	size_t i;
+
+	for (s->leaves = 1; s->leaves < s->block_count; s->leaves *= 2)
+		;
+	s->max_time = malloc(2 * s->leaves * sizeof(*s->max_time));
+	if (!s->max_time)
+		die("malloc");
+	for (i = 0; i < s->leaves; i++)
+		s->max_time[s->leaves + i] = i < s->block_count ?
+			s->blocks[i].header.max_time : INT64_MIN;
+	for (i = s->leaves - 1; i > 0; i--)
+		s->max_time[i] = s->max_time[2 * i] > s->max_time[2 * i + 1] ?
+			s->max_time[2 * i] : s->max_time[2 * i + 1];
+}
+
+struct lokatt_session *lokatt_open_session(const char *path)
+{
+	char header[FILE_HEADER_SIZE], trailer[TRAILER_SIZE], *footer = NULL;
+	struct lokatt_session *s;
+	uint64_t footer_offset, footer_size;
+	size_t i, pos, words = 0, size;
+	struct stat st;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		die("calloc");
+	s->fd = open(path, O_RDONLY);
+	if (s->fd < 0)
+		goto bail;
+	if (fstat(s->fd, &st) ||
+	    (uint64_t)st.st_size < FILE_HEADER_SIZE + TRAILER_SIZE)
+		goto bail;
+
+	if (pread_all(s->fd, header, sizeof(header), 0) ||
+	    pread_all(s->fd, trailer, sizeof(trailer),
+		      st.st_size - sizeof(trailer)))
+		goto bail;
+	if (memcmp(header, SESSION_MAGIC, SESSION_MAGIC_SIZE) ||
+	    get_u32(header + SESSION_MAGIC_SIZE) != SESSION_VERSION ||
+	    memcmp(trailer + 16, SESSION_MAGIC, SESSION_MAGIC_SIZE) ||
+	    get_u32(trailer + 12) != SESSION_VERSION)
+		goto bail;
+
+	footer_offset = get_u64(trailer);
+	s->block_count = get_u32(trailer + 8);
+	if (footer_offset < FILE_HEADER_SIZE ||
+	    footer_offset > (uint64_t)st.st_size - TRAILER_SIZE)
+		goto bail;
+	footer_size = st.st_size - TRAILER_SIZE - footer_offset;
+	if (footer_size < (uint64_t)s->block_count * FOOTER_ENTRY_SIZE(1) ||
+	    footer_size > (uint64_t)s->block_count *
+	    FOOTER_ENTRY_SIZE(BLOOM_MAX_WORDS))
+		goto bail;
+
+	footer = malloc(footer_size + 1);
+	s->blocks = calloc(s->block_count + 1, sizeof(*s->blocks));
+	/* more than enough for the bloom filters */
+	s->blooms = malloc(footer_size / 8 * sizeof(*s->blooms) + 1);
+	if (!footer || !s->blocks || !s->blooms)
+		die("malloc");
+	if (pread_all(s->fd, footer, footer_size, footer_offset))
+		goto bail;
+	for (i = 0, pos = 0; i < s->block_count; i++, pos += size) {
+		struct block *b = &s->blocks[i];
+
+		if (footer_size - pos < 8)
+			goto bail;
+		b->offset = get_u64(footer + pos);
+		pos += 8;
+		size = decode_block_header(footer + pos, footer_size - pos,
+					   &b->header, s->blooms + words);
+		if (!size)
+			goto bail;
+		words += b->header.bloom_words;
+	}
+	if (pos != footer_size)
+		goto bail;
+	free(footer);
+	footer = NULL;
+	if (check_blocks(s, footer_offset))
+		goto bail;
+
+	build_time_tree(s);
+	s->current = s->block_count;
+	s->compressed = malloc(LZ_BOUND(SESSION_BLOCK_SIZE));
+	s->data = malloc(SESSION_BLOCK_SIZE);
+	s->records = malloc(SESSION_BLOCK_SIZE / RECORD_HEADER_SIZE *
+			    sizeof(*s->records));
+	if (!s->compressed || !s->data || !s->records)
+		die("malloc");
+	pthread_mutex_init(&s->lock, NULL);
+	return s;
+bail:
+	free(footer);
+	free(s->blocks);
+	free(s->blooms);
+	if (s->fd >= 0)
+		close(s->fd);
+	free(s);
+	return NULL;
+}
+
+void lokatt_close_session(struct lokatt_session *s)
+{
+	pthread_mutex_destroy(&s->lock);
+	close(s->fd);
+	free(s->blocks);
+	free(s->blooms);
+	free(s->max_time);
+	free(s->compressed);
+	free(s->data);
+	free(s->records);
+	free(s);
+}
+
+uint64_t lokatt_session_first_id(struct lokatt_session *s)
+{
+	return s->block_count ? s->blocks[0].header.first_id : 0;
+}
+
+uint64_t lokatt_session_size(struct lokatt_session *s)
+{
+	const struct block_header *h;
+
+	if (!s->block_count)
+		return 0;
+	h = &s->blocks[s->block_count - 1].header;
+	return h->first_id + h->event_count;
+}
+
+/* decompress and parse block 'i', unless it already is */
+static int load_block(struct lokatt_session *s, size_t i)
+{
+	const struct block_header *h = &s->blocks[i].header;
+	const char *p, *end;
+	size_t size, k;
+
+	if (s->current == i)
+		return 0;
+	s->current = s->block_count;
+	if (pread_all(s->fd, s->compressed, h->compressed_size,
+		      s->blocks[i].offset +
+		      BLOCK_HEADER_SIZE(h->bloom_words)) ||
+	    lz_decompress(s->compressed, h->compressed_size, s->data,
+			  SESSION_BLOCK_SIZE, &size) ||
+	    size != h->raw_size || hash(s->data, size) != h->checksum)
+		return -1;
+
+	p = s->data;
+	end = s->data + size;
+	for (k = 0; k < h->event_count; k++) {
+		struct record *r = &s->records[k];
+		size_t tag_size, text_size, pname_size;
+		const char *pname;
+
+		if ((size_t)(end - p) < RECORD_HEADER_SIZE)
+			return -1;
+		tag_size = get_u16(p + 18);
+		text_size = get_u16(p + 20);
+		pname_size = get_u16(p + 22);
+		if ((size_t)(end - p) < RECORD_HEADER_SIZE + tag_size + 1 +
+		    text_size + 1 + pname_size + 1)
+			return -1;
+		/* as in a struct lokatt_message's payload */
+		if (1 + tag_size + 1 + text_size + 1 > MSG_MAX_PAYLOAD_SIZE)
+			return -1;
+		r->type = (uint8_t)p[0];
+		r->level = (uint8_t)p[1];
+		r->pid = (int32_t)get_u32(p + 2);
+		r->tid = (int32_t)get_u32(p + 6);
+		r->sec = (int32_t)get_u32(p + 10);
+		r->nsec = (int32_t)get_u32(p + 14);
+		p += RECORD_HEADER_SIZE;
+		r->tag = p;
+		r->text = p + tag_size + 1;
+		pname = r->text + text_size + 1;
+		if (r->tag[tag_size] || r->text[text_size] ||
+		    pname[pname_size])
+			return -1;
+		r->tag_id = intern_find(r->tag);
+		r->pname = NULL;
+		r->pname_id = pname_size ?
+			intern(pname, pname_size, &r->pname) : INTERN_NONE;
+		p += tag_size + 1 + text_size + 1 + pname_size + 1;
+	}
+	if (p != end)
+		return -1;
+	s->current = i;
+	return 0;
+}
+
+/* the first block with events at or after 'id' */
+static size_t find_block(const struct lokatt_session *s, uint64_t id)
+{
+	size_t lo = 0, hi = s->block_count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct block_header *h = &s->blocks[mid].header;
+
+		if (h->first_id + h->event_count <= id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * The first block from block 'i' on with a timestamp at or after 'target',
+ * or block_count if there is none. Takes logarithmic time.
+ */
+static size_t find_block_time(const struct lokatt_session *s, size_t i,
+			      int64_t target)
+{
+	size_t n = s->leaves + i;
+
+	if (i >= s->block_count)
+		return s->block_count;
+	/* up, and right, until a subtree has one */
+	while (s->max_time[n] < target) {
+		while (n & 1)
+			n >>= 1;
+		if (!n)
+			return s->block_count;
+		n++;
+	}
+	/* then down, to its leftmost block that has one */
+	while (n < s->leaves)
+		n = s->max_time[2 * n] >= target ? 2 * n : 2 * n + 1;
+	return n - s->leaves;
+}
+
+static int may_match(const struct lokatt_filter *f, const char *tag,
+		     const struct block_header *h)
+{
+	unsigned int types = h->types & filter_event_bitmask(f);
+
+	/* the tag only matters for logcat messages */
+	if (types & ~EVENT_LOGCAT_MESSAGE)
+		return 1;
+	if (!types)
+		return 0;
+	return !tag || bloom_test(h, tag);
+}
+
+static void record_to_message(const struct record *r,
+			      struct lokatt_message *out)
+{
+	out->pid = r->pid;
+	out->tid = r->tid;
+	out->sec = r->sec;
+	out->nsec = r->nsec;
+	out->level = r->level;
+	out->tag = r->tag;
+	out->text = r->text;
+	out->pname = r->pname;
+}
+
+/* like index_event_copy */
+static void record_copy(const struct record *r, uint64_t id,
+			struct lokatt_event *out)
+{
+	size_t tag_size = strlen(r->tag) + 1;
+	size_t text_size = strlen(r->text) + 1;
+
+	out->type = r->type;
+	out->id = id;
+	if (!(r->type & EVENT_LOGCAT_MESSAGE))
+		return;
+	record_to_message(r, &out->msg);
+	out->msg.payload[0] = r->level;
+	memcpy(out->msg.payload + 1, r->tag, tag_size);
+	memcpy(out->msg.payload + 1 + tag_size, r->text, text_size);
+	out->msg.tag = out->msg.payload + 1;
+	out->msg.text = out->msg.payload + 1 + tag_size;
+}
+
+int lokatt_session_next_events(struct lokatt_session *s,
+			       uint64_t id,
+			       const struct lokatt_filter *filter,
+			       struct lokatt_event *out,
+			       size_t count,
+			       size_t *out_count)
+{
+	const char *tag = filter_required_tag(filter);
+	struct lokatt_message msg;
+	size_t i, k, n = 0;
+	int retval = 0;
+
+	*out_count = 0;
+	if (id < lokatt_session_first_id(s)) {
+		out->id = lokatt_session_first_id(s);
+		return LOKATT_EVICTED;
+	}
+
+	pthread_mutex_lock(&s->lock);
+	for (i = find_block(s, id); i < s->block_count && n < count; i++) {
+		const struct block_header *h = &s->blocks[i].header;
+
+		if (!may_match(filter, tag, h))
+			continue;
+		if (load_block(s, i)) {
+			retval = -1;
+			break;
+		}
+		k = id > h->first_id ? id - h->first_id : 0;
+		for (; k < h->event_count && n < count; k++) {
+			const struct record *r = &s->records[k];
+
+			record_to_message(r, &msg);
+			if (filter_match_event(filter, r->type, &msg,
+					       r->tag_id, r->pname_id))
+				record_copy(r, h->first_id + k, &out[n++]);
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	*out_count = n;
+	return retval;
+}
+
+uint64_t lokatt_session_seek_time(struct lokatt_session *s,
+				  uint64_t id,
+				  int32_t sec,
+				  int32_t nsec)
+{
+	int64_t target = timestamp(sec, nsec);
+	uint64_t size = lokatt_session_size(s);
+	size_t i, k;
+
+	if (id >= size)
+		return id;
+
+	pthread_mutex_lock(&s->lock);
+	for (i = find_block_time(s, find_block(s, id), target);
+	     i < s->block_count; i = find_block_time(s, i + 1, target)) {
+		const struct block_header *h = &s->blocks[i].header;
+
+		if (load_block(s, i))
+			break;
+		k = id > h->first_id ? id - h->first_id : 0;
+		for (; k < h->event_count; k++) {
+			const struct record *r = &s->records[k];
+
+			if (timestamp(r->sec, r->nsec) >= target) {
+				id = h->first_id + k;
+				goto out;
+			}
+		}
+	}
+	id = size;
+out:
+	pthread_mutex_unlock(&s->lock);
+	return id;
+}
@@ -0,0 +1,13 @@
+#ifndef LIBLOKATT_SESSION_H
+#define LIBLOKATT_SESSION_H
+
+struct index;
+
+/*
+ * Write the events of 'idx' to 'path' in the session format (see
+ * session.c). Returns 0 on success, -1 on error, in which case no file is
+ * left behind.
+ */
+int session_write(struct index *idx, const char *path);
+
+#endif
@@ -71,15 +71,22 @@ void strbuf_vaddf(struct strbuf *sb, const char *fmt, va_list ap)
 {
 	va_list ap_cp;
 	size_t required;
-	size_t available = sb->alloc_size - sb->str_size - 1;
+	size_t available;
+
+	/* the default buffer must never be written to */
+	if (!sb->alloc_size)
+		strbuf_grow(sb, 0);
+	available = sb->alloc_size - sb->str_size - 1;
 
 	va_copy(ap_cp, ap);
 
-	required = vsnprintf(sb->buf + sb->str_size, available, fmt, ap_cp);
+	/* 'available' doesn't count the nul */
+	required = vsnprintf(sb->buf + sb->str_size, available + 1, fmt,
+			     ap_cp);
 	if (required > available) {
 		strbuf_grow(sb, required);
 		available = sb->alloc_size - sb->str_size - 1;
-		required = vsnprintf(sb->buf + sb->str_size, available,
+		required = vsnprintf(sb->buf + sb->str_size, available + 1,
 				     fmt, ap);
 	}
 	set_str_size(sb, sb->str_size + required);
@@ -0,0 +1,49 @@
+/* throwaway stand-in for flex output; mirrors liblokatt/filter-lexer.lex */
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include "liblokatt/filter.h"
+#include "filter-lexer.h"
+
+struct st { const char *p; char text[4096]; int leng; };
+
+struct lit { const char *s; int tok; };
+#include "lits.inc"
+
+int yylex_init(yyscan_t *s) { *s = calloc(1, sizeof(struct st)); return 0; }
+int yylex_destroy(yyscan_t s) { free(s); return 0; }
+YY_BUFFER_STATE yy_scan_string(const char *str, yyscan_t s)
+{ ((struct st *)s)->p = str; return s; }
+void yy_delete_buffer(YY_BUFFER_STATE b, yyscan_t s) { (void)b; (void)s; }
+char *yyget_text(yyscan_t s) { return ((struct st *)s)->text; }
+int yyget_leng(yyscan_t s) { return ((struct st *)s)->leng; }
+
+static int ret(struct st *st, int n, int tok)
+{
+	memcpy(st->text, st->p, n); st->text[n] = 0; st->leng = n;
+	st->p += n; return tok;
+}
+
+int yylex(yyscan_t s)
+{
+	struct st *st = s;
+	const char *p = st->p;
+	int best = 0, tok = -1, n;
+	size_t i;
+	if (!*p) return 0;
+	n = strspn(p, " \t\n");
+	if (n) return ret(st, n, TOKEN_WHITESPACE);
+	for (i = 0; i < sizeof(lits) / sizeof(lits[0]); i++) {
+		int l = strlen(lits[i].s);
+		if (!strncmp(p, lits[i].s, l) && l > best) { best = l; tok = lits[i].tok; }
+	}
+	n = 0; while (isdigit((unsigned char)p[n])) n++;
+	if (n > best) { best = n; tok = TOKEN_VALUE_INT; }
+	if (*p == '"') {
+		n = 1;
+		while (p[n] && p[n] != '"') { if (p[n] == '\\' && p[n+1]) n++; n++; }
+		if (p[n] == '"' && n + 1 > best) { best = n + 1; tok = TOKEN_VALUE_STRING; }
+	}
+	if (best) return ret(st, best, tok);
+	return ret(st, 1, -1);
+}
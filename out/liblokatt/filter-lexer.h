@@ -0,0 +1,13 @@
+#ifndef STUB_FILTER_LEXER_H
+#define STUB_FILTER_LEXER_H
+#include <stddef.h>
+typedef void *yyscan_t;
+typedef void *YY_BUFFER_STATE;
+int yylex_init(yyscan_t *s);
+int yylex_destroy(yyscan_t s);
+YY_BUFFER_STATE yy_scan_string(const char *str, yyscan_t s);
+void yy_delete_buffer(YY_BUFFER_STATE b, yyscan_t s);
+int yylex(yyscan_t s);
+char *yyget_text(yyscan_t s);
+int yyget_leng(yyscan_t s);
+#endif
@@ -3,10 +3,34 @@ local_prefix := t
 local_executable := test-lokatt
 
 local_objects += main.o
+local_objects += test-adb.o
+local_objects += test-backend.o
+local_objects += test-column.o
+local_objects += test-device.o
 local_objects += test-filter.o
+local_objects += test-group.o
+local_objects += test-index.o
+local_objects += test-intern.o
+local_objects += test-lz.o
+local_objects += test-merge.o
+local_objects += test-procs.o
+local_objects += test-search.o
+local_objects += test-session.o
 local_objects += test-stack.o
 local_objects += test-strbuf.o
 
 local_shared_libraries := liblokatt
 
 include common.mk
+
+# benchmarks: built with the tests, but not run by them
+include clean.mk
+local_prefix := t
+
+local_executable := bench-adb
+
+local_objects += bench-adb.o
+
+local_shared_libraries := liblokatt
+
+include common.mk
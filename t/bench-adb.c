@@ -0,0 +1,107 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "liblokatt/adb.h"
+
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+
+/*
+ * How fast adb_reader_next parses a stream of messages: the boot capture,
+ * repeated, is written to a pipe by one thread and read by another, the
+ * way the adb backend reads logcat. Not part of the test run.
+ *
+ *   bench-adb [repeat count [capture]]
+ */
+struct writer {
+	int fd;
+	const char *data;
+	size_t size;
+	long count;
+};
+
+static void *write_capture(void *arg)
+{
+	struct writer *w = arg;
+	size_t done;
+	ssize_t n;
+	long i;
+
+	for (i = 0; i < w->count; i++) {
+		for (done = 0; done < w->size; done += n) {
+			n = write(w->fd, w->data + done, w->size - done);
+			if (n < 0) {
+				perror("write");
+				exit(1);
+			}
+		}
+	}
+	close(w->fd);
+	return NULL;
+}
+
+static char *read_capture(const char *path, size_t *size)
+{
+	struct stat st;
+	char *data;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		return NULL;
+	data = malloc(st.st_size);
+	if (!data || read(fd, data, st.st_size) != st.st_size) {
+		free(data);
+		close(fd);
+		return NULL;
+	}
+	close(fd);
+	*size = st.st_size;
+	return data;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = argc > 2 ? argv[2] : BOOT_CAPTURE;
+	struct writer w = { .count = argc > 1 ? atol(argv[1]) : 1000 };
+	struct adb_reader reader;
+	struct adb_message msg;
+	struct timespec start, end;
+	unsigned long count = 0;
+	pthread_t thread;
+	char *data;
+	double s;
+	int fds[2];
+
+	data = read_capture(path, &w.size);
+	if (!data) {
+		fprintf(stderr, "failed to read %s\n", path);
+		return 1;
+	}
+	w.data = data;
+	if (pipe(fds) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	w.fd = fds[1];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_create(&thread, NULL, write_capture, &w);
+	adb_reader_init(&reader, fds[0]);
+	while (adb_reader_next(&reader, &msg) == 0)
+		count++;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_join(thread, NULL);
+	adb_reader_destroy(&reader);
+	close(fds[0]);
+	free(data);
+
+	s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%lu messages, %.1f MB in %.3f s: %.0f messages/s\n", count,
+	       (double)w.size * w.count / 1e6, s, count / s);
+	return 0;
+}
@@ -0,0 +1,120 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "liblokatt/adb.h"
+#include "liblokatt/lokatt.h"
+
+#include "test.h"
+
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+#define REGULAR_USAGE_CAPTURE "t/nexus-5-android-5.1-regular-usage.bin"
+
+static int count_messages(int fd)
+{
+	struct adb_reader reader;
+	struct adb_message msg;
+	int count = 0;
+
+	adb_reader_init(&reader, fd);
+	while (adb_reader_next(&reader, &msg) == 0) {
+		ASSERT_GT(msg.payload_size, 0);
+		ASSERT_GE(msg.payload[0], LEVEL_VERBOSE);
+		ASSERT_LE(msg.payload[0], LEVEL_ASSERT);
+		count++;
+	}
+	adb_reader_destroy(&reader);
+
+	return count;
+}
+
+TEST(adb, read_capture_files)
+{
+	struct adb_reader reader;
+	struct adb_message msg;
+	int fd;
+
+	fd = open(BOOT_CAPTURE, O_RDONLY);
+	ASSERT_GE(fd, 0);
+	adb_reader_init(&reader, fd);
+	ASSERT_EQ(adb_reader_next(&reader, &msg), 0);
+	ASSERT_EQ(msg.pid, 0);
+	ASSERT_EQ(msg.tid, 190);
+	ASSERT_EQ(msg.sec, 1702556);
+	ASSERT_EQ(msg.nsec, 571829272);
+	ASSERT_EQ(msg.payload_size, 30);
+	ASSERT_EQ(msg.payload[0], LEVEL_INFO);
+	ASSERT_EQ(strcmp(msg.payload + 1, "installd"), 0);
+	ASSERT_EQ(strcmp(msg.payload + 10, "installd firing up\n"), 0);
+	adb_reader_destroy(&reader);
+	close(fd);
+
+	fd = open(BOOT_CAPTURE, O_RDONLY);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(count_messages(fd), 2703);
+	close(fd);
+
+	fd = open(REGULAR_USAGE_CAPTURE, O_RDONLY);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(count_messages(fd), 2444);
+	close(fd);
+}
+
+TEST(adb, read_from_pipe_in_small_pieces)
+{
+	int fds[2];
+	pid_t pid;
+
+	ASSERT_EQ(pipe(fds), 0);
+	pid = fork();
+	ASSERT_NE(pid, -1);
+	if (pid == 0) {
+		char buf[7];
+		ssize_t r;
+		int fd = open(BOOT_CAPTURE, O_RDONLY);
+
+		close(fds[0]);
+		while ((r = read(fd, buf, sizeof(buf))) > 0)
+			if (write(fds[1], buf, r) != r)
+				exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+	ASSERT_EQ(count_messages(fds[0]), 2703);
+	close(fds[0]);
+	waitpid(pid, NULL, 0);
+}
+
+TEST(adb, read_from_non_blocking_pipe)
+{
+	struct adb_reader reader;
+	struct adb_message msg;
+	char buf[64];
+	int fds[2], fd;
+
+	fd = open(BOOT_CAPTURE, O_RDONLY);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(read(fd, buf, sizeof(buf)), sizeof(buf));
+	close(fd);
+
+	ASSERT_EQ(pipe(fds), 0);
+	ASSERT_EQ(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+	adb_reader_init(&reader, fds[0]);
+	ASSERT_EQ(adb_reader_next(&reader, &msg), 1);
+
+	/* the first message is 20 + 30 bytes: send part of it, then more */
+	ASSERT_EQ(write(fds[1], buf, 30), 30);
+	ASSERT_EQ(adb_reader_next(&reader, &msg), 1);
+	ASSERT_EQ(write(fds[1], buf + 30, 34), 34);
+	ASSERT_EQ(adb_reader_next(&reader, &msg), 0);
+	ASSERT_EQ(msg.tid, 190);
+	ASSERT_EQ(adb_reader_next(&reader, &msg), 1);
+
+	close(fds[1]);
+	ASSERT_EQ(adb_reader_next(&reader, &msg), -1);
+	adb_reader_destroy(&reader);
+	close(fds[0]);
+}
@@ -0,0 +1,655 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "liblokatt/adb.h"
+#include "liblokatt/backend.h"
+#include "liblokatt/lokatt.h"
+
+#include "test.h"
+
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+
+/* the processes of BOOT_CAPTURE's device, as toolbox's ps lists them */
+#define FAKE_PS \
+	"USER     PID   PPID  VSIZE  RSS     WCHAN    PC         NAME\n" \
+	"root      1     0     2172   820   ffffffff 00000000 S /init\n" \
+	"media     189   1     27384  8012  ffffffff b6e1ed7c S " \
+	"/system/bin/mediaserver\n" \
+	"system    727   200   1027492 91084 ffffffff b6dbcd7c S " \
+	"system_server\n" \
+	"u0_a38    893   200   946352 77416 ffffffff b6dbdc6c S " \
+	"com.android.systemui\n"
+
+TEST(backend, file)
+{
+	void *backend;
+	struct adb_message msg;
+	int count = 0;
+
+	ASSERT_EQ(create_file_backend("t/does-not-exist"), NULL);
+
+	backend = create_file_backend("t/nexus-5-android-5.1-boot.bin");
+	ASSERT_NE(backend, NULL);
+
+	ASSERT_EQ(file_backend_ops.next_logcat_message(backend, &msg), 0);
+	ASSERT_EQ(msg.tid, 190);
+	ASSERT_EQ(msg.persistent, 1);
+	ASSERT_EQ(strcmp(msg.payload + 1, "installd"), 0);
+	count++;
+
+	while (file_backend_ops.next_logcat_message(backend, &msg) == 0)
+		count++;
+	ASSERT_EQ(count, 2703);
+
+	/* end of file is sticky */
+	ASSERT_NE(file_backend_ops.next_logcat_message(backend, &msg), 0);
+
+	file_backend_ops.destroy(backend);
+}
+
+/*
+ * Put a shell script named adb first in PATH, in place of the real one.
+ * Returns the old PATH, to be restored with restore_adb.
+ */
+static char *install_fake_adb(char *dir, const char *script)
+{
+	char path[256], *old = strdup(getenv("PATH"));
+	FILE *fp;
+
+	strcpy(dir, "/tmp/lokatt-test-adb-XXXXXX");
+	ASSERT_NE(mkdtemp(dir), NULL);
+	snprintf(path, sizeof(path), "%s/adb", dir);
+	fp = fopen(path, "w");
+	ASSERT_NE(fp, NULL);
+	/* answer ps right away */
+	fprintf(fp, "#!/bin/sh\n"
+		"case \"$*\" in *\"exec-out ps \"*)\n"
+		"	printf '%%s' '%s'\n"
+		"	exit 0\n"
+		"esac\n"
+		"%s\n", FAKE_PS, script);
+	fclose(fp);
+	ASSERT_EQ(chmod(path, 0755), 0);
+
+	snprintf(path, sizeof(path), "%s:%s", dir, old);
+	setenv("PATH", path, 1);
+	/* no server there: the backend has to run adb */
+	snprintf(path, sizeof(path), "localfilesystem:%s/no-server", dir);
+	setenv("ADB_SERVER_SOCKET", path, 1);
+	return old;
+}
+
+/* the name FAKE_PS gives process 'pid', if any */
+static const char *fake_pname(int32_t pid)
+{
+	switch (pid) {
+	case 189:
+		return "/system/bin/mediaserver";
+	case 727:
+		return "system_server";
+	case 893:
+		return "com.android.systemui";
+	default:
+		return NULL;
+	}
+}
+
+static void check_pname(const struct lokatt_message *msg)
+{
+	const char *pname = fake_pname(msg->pid);
+
+	if (!pname) {
+		ASSERT_EQ(msg->pname, NULL);
+		return;
+	}
+	ASSERT_NE(msg->pname, NULL);
+	ASSERT_EQ(strcmp(msg->pname, pname), 0);
+}
+
+static void restore_adb(char *dir, char *old)
+{
+	char path[256];
+
+	setenv("PATH", old, 1);
+	unsetenv("ADB_SERVER_SOCKET");
+	free(old);
+	snprintf(path, sizeof(path), "%s/adb", dir);
+	unlink(path);
+	rmdir(dir);
+}
+
+static long elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 +
+		(now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/*
+ * The device names messages once it has listed its processes, which goes
+ * on in the background. Wait until it has named the messages of 'file' in
+ * [from, to), which it has 'offset' ids further on.
+ */
+static void wait_pnames(struct lokatt_device *file, struct lokatt_device *dev,
+			uint64_t from, uint64_t to, uint64_t offset)
+{
+	struct lokatt_filter *filter = lokatt_create_filter(EVENT_ANY, NULL);
+	struct lokatt_event event;
+	struct timespec start;
+
+	/* messages are named in order: wait for the last one with a name */
+	do {
+		ASSERT_GT(to, from);
+		ASSERT_EQ(lokatt_next_event(file, --to, filter, &event), 0);
+	} while (!fake_pname(event.msg.pid));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (;;) {
+		ASSERT_EQ(lokatt_next_event(dev, to + offset, filter, &event),
+			  0);
+		if (event.msg.pname)
+			break;
+		ASSERT_LT(elapsed_ms(&start), 5000);
+		usleep(10 * 1000);
+	}
+	lokatt_destroy_filter(filter);
+}
+
+TEST(backend, adb_close)
+{
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event, expected;
+	struct timespec start;
+	char dir[64], *old;
+	int i;
+
+	/* all of the capture, then nothing: adb would block in read() */
+	old = install_fake_adb(dir, "cat " BOOT_CAPTURE "; exec sleep 1000");
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	dev = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(dev, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 2702, filter, &expected), 0);
+	lokatt_close_device(dev);
+
+	for (i = 0; i < 20; i++) {
+		dev = lokatt_open_adb_device(NULL, NULL);
+		ASSERT_NE(dev, NULL);
+		ASSERT_EQ(lokatt_next_event(dev, 2702, filter, &event), 0);
+		ASSERT_EQ(strcmp(event.msg.text, expected.msg.text), 0);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		lokatt_close_device(dev);
+		ASSERT_LT(elapsed_ms(&start), 500);
+
+		/* adb has been reaped */
+		ASSERT_EQ(waitpid(-1, NULL, WNOHANG), -1);
+		ASSERT_EQ(errno, ECHILD);
+	}
+
+	lokatt_destroy_filter(filter);
+	restore_adb(dir, old);
+}
+
+/* the offset of message 'n' in 'path' */
+static long message_offset(const char *path, int n)
+{
+	static char buf[1 << 20];
+	struct adb_message msg;
+	size_t size, pos = 0;
+	FILE *fp = fopen(path, "r");
+
+	ASSERT_NE(fp, NULL);
+	size = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	for (; n > 0; n--)
+		pos += adb_parse_message(buf + pos, size - pos, &msg);
+	return pos;
+}
+
+TEST(backend, adb_reconnect)
+{
+	struct lokatt_device *dev, *file;
+	struct lokatt_session *session;
+	struct lokatt_filter *filter;
+	struct lokatt_event event, expected;
+	char script[512], args[256], dir[64], *old;
+	uint64_t id;
+	size_t count;
+	FILE *fp;
+
+	/*
+	 * The first adb cuts out in the middle of message 1000. The second
+	 * sends again from message 997, as logcat -T would: 997 to 999 are
+	 * at or before the time of 999.
+	 */
+	snprintf(script, sizeof(script),
+		 "dir=$(dirname \"$0\")\n"
+		 "echo \"$@\" >>$dir/args\n"
+		 "if [ ! -e $dir/started ]; then\n"
+		 "	touch $dir/started\n"
+		 "	head -c %ld " BOOT_CAPTURE "\n"
+		 "	exit 1\n"
+		 "fi\n"
+		 "tail -c +%ld " BOOT_CAPTURE "\n"
+		 "exec sleep 1000",
+		 message_offset(BOOT_CAPTURE, 1000) + 10,
+		 message_offset(BOOT_CAPTURE, 997) + 1);
+	old = install_fake_adb(dir, script);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	file = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(file, NULL);
+
+	dev = lokatt_open_adb_device("serial", NULL);
+	ASSERT_NE(dev, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 1000, filter, &event), 0);
+	ASSERT_EQ(event.type, EVENT_DEVICE_DISCONNECTED);
+	ASSERT_EQ(lokatt_next_event(dev, 1001, filter, &event), 0);
+	ASSERT_EQ(event.type, EVENT_DEVICE_CONNECTED);
+	wait_pnames(file, dev, 0, 1000, 0);
+	wait_pnames(file, dev, 1000, 2703, 2);
+
+	/* nothing lost, nothing twice */
+	for (id = 0; id < 2703; id++) {
+		ASSERT_EQ(lokatt_next_event(file, id, filter, &expected), 0);
+		ASSERT_EQ(lokatt_next_event(dev, id < 1000 ? id : id + 2,
+					    filter, &event), 0);
+		ASSERT_EQ(event.type, EVENT_LOGCAT_MESSAGE);
+		ASSERT_EQ(event.msg.sec, expected.msg.sec);
+		ASSERT_EQ(event.msg.nsec, expected.msg.nsec);
+		ASSERT_EQ(strcmp(event.msg.text, expected.msg.text), 0);
+		check_pname(&event.msg);
+	}
+	lokatt_destroy_filter(filter);
+
+	/* process names are saved with the session */
+	snprintf(script, sizeof(script), "%s/session", dir);
+	ASSERT_EQ(lokatt_save_session(dev, script), 0);
+	session = lokatt_open_session(script);
+	ASSERT_NE(session, NULL);
+	filter = lokatt_create_filter(EVENT_LOGCAT_MESSAGE,
+				      "pname == \"system_server\"");
+	ASSERT_NE(filter, NULL);
+	ASSERT_EQ(lokatt_session_next_events(session, 0, filter, &event, 1,
+					     &count), 0);
+	ASSERT_EQ(count, 1);
+	ASSERT_EQ(event.msg.pid, 727);
+	ASSERT_EQ(strcmp(event.msg.pname, "system_server"), 0);
+	lokatt_close_session(session);
+	unlink(script);
+
+	lokatt_close_device(dev);
+	lokatt_close_device(file);
+
+	/* the serial is passed on, and the second adb resumes from 999 */
+	snprintf(script, sizeof(script), "%s/args", dir);
+	fp = fopen(script, "r");
+	ASSERT_NE(fp, NULL);
+	ASSERT_NE(fgets(args, sizeof(args), fp), NULL);
+	ASSERT_EQ(strcmp(args, "-s serial exec-out logcat -B\n"), 0);
+	ASSERT_NE(fgets(args, sizeof(args), fp), NULL);
+	ASSERT_EQ(strcmp(args, "-s serial exec-out logcat -B "
+			 "-T 1427869624.077606040\n"), 0);
+	fclose(fp);
+	unlink(script);
+	snprintf(script, sizeof(script), "%s/started", dir);
+	unlink(script);
+
+	lokatt_destroy_filter(filter);
+	restore_adb(dir, old);
+}
+
+/*
+ * A stand-in for the adb server. It answers requests for ps with
+ * FAKE_PS, and serves 'connections' requests for logcat: it replays the
+ * capture from byte 'from[i]' to byte 'to[i]', or to the end if 0, to the
+ * i-th one. After the last byte, it closes the connection if 'to[i]' is
+ * set, else waits for the client to.
+ */
+struct fake_server {
+	char dir[64];
+	int fd;
+	pthread_t thread;
+	int stop;
+
+	const char *serial;
+	int connections;
+	long from[2], to[2];
+	char requests[2][2][64];
+	char refused[64];
+	int ps_requests;
+
+	struct connection {
+		struct fake_server *server;
+		int i, fd;
+		pthread_t thread;
+	} logcat[2];
+	int logcat_count;
+};
+
+static char capture[1 << 20];
+static size_t capture_size;
+
+static int read_request(int fd, char *out, size_t size)
+{
+	char length[5] = "";
+	size_t n;
+
+	if (read(fd, length, 4) != 4)
+		return -1;
+	n = strtoul(length, NULL, 16);
+	if (n >= size || read(fd, out, n) != (ssize_t)n)
+		return -1;
+	out[n] = '\0';
+	return 0;
+}
+
+static void *stream_logcat(void *userdata)
+{
+	struct connection *c = userdata;
+	struct fake_server *server = c->server;
+	long to = server->to[c->i] ? server->to[c->i] : (long)capture_size;
+	char byte;
+
+	write(c->fd, capture + server->from[c->i], to - server->from[c->i]);
+	if (!server->to[c->i])
+		while (read(c->fd, &byte, 1) > 0)
+			;
+	close(c->fd);
+	return NULL;
+}
+
+static void *serve(void *userdata)
+{
+	struct fake_server *server = userdata;
+	char transport[64], request[64];
+	struct connection *c;
+	int fd, stop;
+
+	snprintf(transport, sizeof(transport), "host:transport:%s",
+		 server->serial);
+	for (;;) {
+		fd = accept(server->fd, NULL, NULL);
+		stop = __atomic_load_n(&server->stop, __ATOMIC_ACQUIRE);
+		if (fd < 0 || stop) {
+			close(fd);
+			break;
+		}
+		if (read_request(fd, request, sizeof(request)) < 0 ||
+		    strcmp(request, transport)) {
+			write(fd, "FAIL0010device not found", 24);
+			strcpy(server->refused, request);
+			close(fd);
+			continue;
+		}
+		write(fd, "OKAY", 4);
+		if (read_request(fd, request, sizeof(request)) < 0) {
+			close(fd);
+			continue;
+		}
+		write(fd, "OKAY", 4);
+		if (!strncmp(request, "exec:ps", 7)) {
+			ASSERT_EQ(strcmp(request, "exec:ps -A 2>/dev/null; ps"),
+				  0);
+			write(fd, FAKE_PS, strlen(FAKE_PS));
+			close(fd);
+			__atomic_add_fetch(&server->ps_requests, 1,
+					   __ATOMIC_RELEASE);
+			continue;
+		}
+		if (server->logcat_count == server->connections) {
+			close(fd);
+			continue;
+		}
+		c = &server->logcat[server->logcat_count];
+		c->server = server;
+		c->i = server->logcat_count++;
+		strcpy(server->requests[c->i][0], transport);
+		strcpy(server->requests[c->i][1], request);
+		c->fd = fd;
+		pthread_create(&c->thread, NULL, stream_logcat, c);
+	}
+	return NULL;
+}
+
+static void start_fake_server(struct fake_server *server)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	char spec[128];
+	FILE *fp;
+
+	fp = fopen(BOOT_CAPTURE, "r");
+	ASSERT_NE(fp, NULL);
+	capture_size = fread(capture, 1, sizeof(capture), fp);
+	fclose(fp);
+
+	strcpy(server->dir, "/tmp/lokatt-test-server-XXXXXX");
+	ASSERT_NE(mkdtemp(server->dir), NULL);
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/adb", server->dir);
+	server->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	ASSERT_GE(server->fd, 0);
+	ASSERT_EQ(bind(server->fd, (struct sockaddr *)&sun, sizeof(sun)), 0);
+	ASSERT_EQ(listen(server->fd, 4), 0);
+	snprintf(spec, sizeof(spec), "localfilesystem:%s", sun.sun_path);
+	setenv("ADB_SERVER_SOCKET", spec, 1);
+	pthread_create(&server->thread, NULL, serve, server);
+}
+
+static void stop_fake_server(struct fake_server *server)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	int i, fd;
+
+	/* wake the server up, to see that it has to stop */
+	__atomic_store_n(&server->stop, 1, __ATOMIC_RELEASE);
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/adb", server->dir);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	connect(fd, (struct sockaddr *)&sun, sizeof(sun));
+	pthread_join(server->thread, NULL);
+	close(fd);
+	for (i = 0; i < server->logcat_count; i++)
+		pthread_join(server->logcat[i].thread, NULL);
+
+	close(server->fd);
+	unsetenv("ADB_SERVER_SOCKET");
+	unlink(sun.sun_path);
+	rmdir(server->dir);
+}
+
+TEST(backend, adb_server)
+{
+	struct fake_server server = {
+		.serial = "serial",
+		.connections = 2,
+	};
+	struct lokatt_device *dev, *file;
+	struct lokatt_filter *filter;
+	struct lokatt_event event, expected;
+	uint64_t id;
+
+	/* as in adb_reconnect, but the server cuts out and comes back */
+	server.to[0] = message_offset(BOOT_CAPTURE, 1000) + 10;
+	server.from[1] = message_offset(BOOT_CAPTURE, 997);
+	start_fake_server(&server);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	file = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(file, NULL);
+
+	dev = lokatt_open_adb_device("serial", NULL);
+	ASSERT_NE(dev, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 1000, filter, &event), 0);
+	ASSERT_EQ(event.type, EVENT_DEVICE_DISCONNECTED);
+	ASSERT_EQ(lokatt_next_event(dev, 1001, filter, &event), 0);
+	ASSERT_EQ(event.type, EVENT_DEVICE_CONNECTED);
+	wait_pnames(file, dev, 0, 1000, 0);
+	wait_pnames(file, dev, 1000, 2703, 2);
+	for (id = 0; id < 2703; id++) {
+		ASSERT_EQ(lokatt_next_event(file, id, filter, &expected), 0);
+		ASSERT_EQ(lokatt_next_event(dev, id < 1000 ? id : id + 2,
+					    filter, &event), 0);
+		ASSERT_EQ(event.type, EVENT_LOGCAT_MESSAGE);
+		ASSERT_EQ(strcmp(event.msg.text, expected.msg.text), 0);
+		check_pname(&event.msg);
+	}
+	lokatt_destroy_filter(filter);
+
+	/* process names are matched by id */
+	filter = lokatt_create_filter(EVENT_LOGCAT_MESSAGE,
+				      "pname == \"system_server\"");
+	ASSERT_NE(filter, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 0, filter, &event), 0);
+	ASSERT_EQ(event.msg.pid, 727);
+	lokatt_destroy_filter(filter);
+	filter = lokatt_create_filter(EVENT_LOGCAT_MESSAGE,
+				      "pname =~ \"systemui$\"");
+	ASSERT_NE(filter, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 0, filter, &event), 0);
+	ASSERT_EQ(event.msg.pid, 893);
+
+	lokatt_close_device(dev);
+	lokatt_close_device(file);
+	stop_fake_server(&server);
+	/* once at first, once after reconnecting */
+	ASSERT_GE(server.ps_requests, 2);
+
+	/* one socket per connection, and no adb client */
+	ASSERT_EQ(waitpid(-1, NULL, WNOHANG), -1);
+	ASSERT_EQ(strcmp(server.requests[0][0], "host:transport:serial"), 0);
+	ASSERT_EQ(strcmp(server.requests[0][1], "exec:logcat -B"), 0);
+	ASSERT_EQ(strcmp(server.requests[1][0], "host:transport:serial"), 0);
+	ASSERT_EQ(strcmp(server.requests[1][1],
+			 "exec:logcat -B -T 1427869624.077606040"), 0);
+
+	lokatt_destroy_filter(filter);
+}
+
+TEST(backend, adb_server_fail)
+{
+	struct fake_server server = {
+		.serial = "serial",
+		.connections = 1,
+	};
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+
+	/* the server doesn't know the device: no fallback to adb */
+	start_fake_server(&server);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	dev = lokatt_open_adb_device("other", NULL);
+	ASSERT_NE(dev, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 0, filter, &event), 0);
+	ASSERT_EQ(event.type, EVENT_DEVICE_DISCONNECTED);
+	lokatt_close_device(dev);
+	stop_fake_server(&server);
+	ASSERT_EQ(strcmp(server.refused, "host:transport:other"), 0);
+	ASSERT_EQ(waitpid(-1, NULL, WNOHANG), -1);
+	lokatt_destroy_filter(filter);
+}
+
+/* a stand-in for the adb server that hangs up on every connection */
+static void *hang_up(void *userdata)
+{
+	int *fd = userdata, conn;
+
+	while ((conn = accept(*fd, NULL, NULL)) >= 0)
+		close(conn);
+	return NULL;
+}
+
+TEST(backend, adb_server_hang_up)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+	char dir[64], spec[128];
+	pthread_t thread;
+	int fd;
+
+	strcpy(dir, "/tmp/lokatt-test-server-XXXXXX");
+	ASSERT_NE(mkdtemp(dir), NULL);
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/adb", dir);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(bind(fd, (struct sockaddr *)&sun, sizeof(sun)), 0);
+	ASSERT_EQ(listen(fd, 4), 0);
+	snprintf(spec, sizeof(spec), "localfilesystem:%s", sun.sun_path);
+	setenv("ADB_SERVER_SOCKET", spec, 1);
+	pthread_create(&thread, NULL, hang_up, &fd);
+
+	/* writing to a closed socket doesn't kill the process: SIGPIPE */
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	dev = lokatt_open_adb_device("serial", NULL);
+	ASSERT_NE(dev, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 0, filter, &event), 0);
+	ASSERT_EQ(event.type, EVENT_DEVICE_DISCONNECTED);
+	/* a few more attempts, with the backoff */
+	usleep(1000 * 1000);
+	lokatt_close_device(dev);
+
+	lokatt_destroy_filter(filter);
+	unsetenv("ADB_SERVER_SOCKET");
+	shutdown(fd, SHUT_RDWR);
+	pthread_join(thread, NULL);
+	close(fd);
+	unlink(sun.sun_path);
+	rmdir(dir);
+}
+
+TEST(backend, adb_server_silent)
+{
+	struct sockaddr_un sun = { .sun_family = AF_UNIX };
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+	struct timespec start;
+	char dir[64], spec[128];
+	int fd;
+
+	/* a server that takes connections, but never answers */
+	strcpy(dir, "/tmp/lokatt-test-server-XXXXXX");
+	ASSERT_NE(mkdtemp(dir), NULL);
+	snprintf(sun.sun_path, sizeof(sun.sun_path), "%s/adb", dir);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	ASSERT_GE(fd, 0);
+	ASSERT_EQ(bind(fd, (struct sockaddr *)&sun, sizeof(sun)), 0);
+	ASSERT_EQ(listen(fd, 4), 0);
+	snprintf(spec, sizeof(spec), "localfilesystem:%s", sun.sun_path);
+	setenv("ADB_SERVER_SOCKET", spec, 1);
+
+	/* opening doesn't wait for it, reading gives up on it */
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	dev = lokatt_open_adb_device("serial", NULL);
+	ASSERT_NE(dev, NULL);
+	ASSERT_LT(elapsed_ms(&start), 500);
+	ASSERT_EQ(lokatt_next_event(dev, 0, filter, &event), 0);
+	ASSERT_EQ(event.type, EVENT_DEVICE_DISCONNECTED);
+	ASSERT_GE(elapsed_ms(&start), 1500);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	lokatt_close_device(dev);
+	ASSERT_LT(elapsed_ms(&start), 500);
+
+	lokatt_destroy_filter(filter);
+	unsetenv("ADB_SERVER_SOCKET");
+	close(fd);
+	unlink(sun.sun_path);
+	rmdir(dir);
+}
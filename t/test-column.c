@@ -0,0 +1,84 @@
+#include <stdlib.h>
+
+#include "liblokatt/column.h"
+
+#include "test.h"
+
+static int compare(int32_t a, int op, int32_t b)
+{
+	switch (op) {
+	case COLUMN_EQ:
+		return a == b;
+	case COLUMN_NE:
+		return a != b;
+	case COLUMN_LT:
+		return a < b;
+	case COLUMN_LE:
+		return a <= b;
+	case COLUMN_GT:
+		return a > b;
+	default:
+		return a >= b;
+	}
+}
+
+TEST(column, compare)
+{
+	static const int32_t pivots[] = { 0, 5, -5, INT32_MIN, INT32_MAX };
+	int32_t values[COLUMN_BLOCK];
+	uint64_t bits;
+	size_t i, j;
+	int op;
+
+	srand(0);
+	for (i = 0; i < 100; i++) {
+		for (j = 0; j < COLUMN_BLOCK; j++)
+			values[j] = rand() % 21 - 10;
+		values[i % COLUMN_BLOCK] = INT32_MIN;
+		values[(i + 1) % COLUMN_BLOCK] = INT32_MAX;
+
+		for (op = COLUMN_EQ; op <= COLUMN_GE; op++) {
+			int32_t pivot = pivots[i % 5];
+
+			bits = column_compare(values, op, pivot);
+			for (j = 0; j < COLUMN_BLOCK; j++)
+				ASSERT_EQ((int)(bits >> j) & 1,
+					  compare(values[j], op, pivot));
+		}
+	}
+}
+
+TEST(column, in_set)
+{
+	/* ids 0, 2, 63 and 64 */
+	const uint64_t set[2] = { 0x8000000000000005ull, 0x1 };
+	uint32_t values[COLUMN_BLOCK];
+	size_t i;
+
+	for (i = 0; i < COLUMN_BLOCK; i++)
+		values[i] = 1;
+	ASSERT_EQ(column_in_set(values, set, 65), 0);
+
+	values[0] = 0;
+	values[5] = 63;
+	values[6] = 64;
+	values[7] = 65;
+	values[8] = 0xffffffff;
+	values[63] = 2;
+	ASSERT_EQ(column_in_set(values, set, 65), 0x8000000000000061ull);
+}
+
+TEST(column, test)
+{
+	uint8_t values[COLUMN_BLOCK];
+	uint64_t bits;
+	size_t i;
+
+	for (i = 0; i < COLUMN_BLOCK; i++)
+		values[i] = 1 << (i % 3);
+	bits = column_test(values, 0x4);
+	for (i = 0; i < COLUMN_BLOCK; i++)
+		ASSERT_EQ((int)(bits >> i) & 1, i % 3 == 2);
+	ASSERT_EQ(column_test(values, 0x7), ~(uint64_t)0);
+	ASSERT_EQ(column_test(values, 0x8), 0);
+}
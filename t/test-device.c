@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "liblokatt/lokatt.h"
+
+#include "test.h"
+
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+
+TEST(device, next_event)
+{
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+	uint64_t id;
+
+	dev = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(dev, NULL);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+
+	ASSERT_EQ(lokatt_next_event(dev, 0, filter, &event), 0);
+	ASSERT_EQ(event.id, 0);
+	ASSERT_EQ(event.type, EVENT_LOGCAT_MESSAGE);
+	ASSERT_EQ(event.msg.tid, 190);
+	ASSERT_EQ(strcmp(event.msg.tag, "installd"), 0);
+	ASSERT_EQ(strcmp(event.msg.text, "installd firing up"), 0);
+
+	for (id = 1; id < 2703; id++) {
+		ASSERT_EQ(lokatt_next_event(dev, id, filter, &event), 0);
+		ASSERT_EQ(event.id, id);
+	}
+
+	lokatt_destroy_filter(filter);
+	lokatt_close_device(dev);
+}
+
+TEST(device, next_events)
+{
+	static struct lokatt_event events[100];
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	size_t i, count;
+	uint64_t id = 0;
+
+	dev = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(dev, NULL);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+
+	while (id < 2703) {
+		ASSERT_EQ(lokatt_next_events(dev, id, filter, events, 100,
+					     &count), 0);
+		ASSERT_GT(count, 0);
+		ASSERT_LE(count, 100);
+		for (i = 0; i < count; i++)
+			ASSERT_EQ(events[i].id, id + i);
+		ASSERT_EQ(strcmp(events[count - 1].msg.tag,
+				 events[count - 1].msg.payload + 1), 0);
+		id += count;
+	}
+	ASSERT_EQ(id, 2703);
+	ASSERT_EQ(strcmp(events[count - 1].msg.tag, "ActivityManager"), 0);
+
+	lokatt_destroy_filter(filter);
+	lokatt_close_device(dev);
+}
+
+TEST(device, next_views)
+{
+	static struct lokatt_view views[100];
+	const struct lokatt_options opts = {
+		.max_events = 1000,
+	};
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+	unsigned long guard;
+	size_t i, count;
+	uint64_t id = 0;
+
+	dev = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(dev, NULL);
+	filter = lokatt_create_filter(EVENT_LOGCAT_MESSAGE,
+				      "tag == \"ActivityManager\"");
+	ASSERT_NE(filter, NULL);
+
+	/* the last event is logged by ActivityManager */
+	while (id < 2703) {
+		ASSERT_EQ(lokatt_next_views(dev, id, filter, views, 100,
+					    &count, &guard), 0);
+		ASSERT_GT(count, 0);
+		for (i = 0; i < count; i++) {
+			ASSERT_GE(views[i].id, id);
+			ASSERT_EQ(lokatt_next_event(dev, views[i].id, filter,
+						    &event), 0);
+			ASSERT_EQ(event.id, views[i].id);
+			ASSERT_EQ(views[i].tag_size, strlen(event.msg.tag));
+			ASSERT_EQ(views[i].text_size, strlen(event.msg.text));
+			ASSERT_EQ(strcmp(views[i].tag, "ActivityManager"), 0);
+			ASSERT_EQ(strcmp(views[i].text, event.msg.text), 0);
+			ASSERT_EQ(views[i].tid, event.msg.tid);
+			ASSERT_EQ(views[i].level, event.msg.level);
+			id = views[i].id + 1;
+		}
+		lokatt_release_views(dev, guard);
+	}
+	ASSERT_EQ(id, 2703);
+	lokatt_close_device(dev);
+
+	/* an evicted id doesn't hand out views, but takes a guard anyway */
+	dev = lokatt_open_file(BOOT_CAPTURE, &opts);
+	ASSERT_NE(dev, NULL);
+	ASSERT_EQ(lokatt_next_views(dev, 2702, filter, views, 100, &count,
+				    &guard), 0);
+	lokatt_release_views(dev, guard);
+	ASSERT_EQ(lokatt_next_views(dev, 0, filter, views, 100, &count,
+				    &guard), LOKATT_EVICTED);
+	lokatt_release_views(dev, guard);
+	ASSERT_EQ(count, 0);
+	ASSERT_EQ(views[0].id, 1703);
+
+	lokatt_destroy_filter(filter);
+	lokatt_close_device(dev);
+}
+
+TEST(device, evicted)
+{
+	const struct lokatt_options opts = {
+		.max_events = 100,
+	};
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+
+	dev = lokatt_open_file(BOOT_CAPTURE, &opts);
+	ASSERT_NE(dev, NULL);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+
+	/* wait for the last event to make sure nothing else is evicted */
+	ASSERT_EQ(lokatt_next_event(dev, 2702, filter, &event), 0);
+	ASSERT_EQ(lokatt_next_event(dev, 0, filter, &event), LOKATT_EVICTED);
+	ASSERT_EQ(event.id, 2603);
+
+	lokatt_destroy_filter(filter);
+	lokatt_close_device(dev);
+}
+
+TEST(device, scan)
+{
+	static const char *specs[] = {
+		NULL,
+		"tag == \"ActivityManager\"",
+		"level >= 5 || text contains \"wifi\"",
+		"tag == \"no-such-tag\"",
+	};
+	struct lokatt_device *dev;
+	struct lokatt_filter *any, *filter;
+	struct lokatt_event event;
+	uint64_t *ids, id;
+	size_t i, j, count;
+
+	dev = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(dev, NULL);
+	any = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(any, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 2702, any, &event), 0);
+
+	for (i = 0; i < sizeof(specs) / sizeof(specs[0]); i++) {
+		filter = lokatt_create_filter(EVENT_ANY, specs[i]);
+		ASSERT_NE(filter, NULL);
+		ASSERT_EQ(lokatt_scan(dev, 0, UINT64_MAX, filter, &ids,
+				      &count), 0);
+
+		/* same matches as checking the events one by one */
+		for (id = 0, j = 0; id < 2703; id++) {
+			ASSERT_EQ(lokatt_next_event(dev, id, any, &event), 0);
+			if (!lokatt_filter_match(filter, &event))
+				continue;
+			ASSERT_LT(j, count);
+			ASSERT_EQ(ids[j], id);
+			j++;
+		}
+		ASSERT_EQ(j, count);
+		free(ids);
+
+		/* sub-range */
+		ASSERT_EQ(lokatt_scan(dev, 1000, 1100, filter, &ids, &count),
+			  0);
+		for (j = 0; j < count; j++) {
+			ASSERT_GE(ids[j], 1000);
+			ASSERT_LT(ids[j], 1100);
+		}
+		free(ids);
+
+		lokatt_destroy_filter(filter);
+	}
+
+	lokatt_destroy_filter(any);
+	lokatt_close_device(dev);
+}
+
+TEST(device, scan_evicted)
+{
+	const struct lokatt_options opts = {
+		.max_events = 100,
+	};
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+	uint64_t *ids;
+	size_t count;
+
+	dev = lokatt_open_file(BOOT_CAPTURE, &opts);
+	ASSERT_NE(dev, NULL);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 2702, filter, &event), 0);
+
+	ASSERT_EQ(lokatt_scan(dev, 0, UINT64_MAX, filter, &ids, &count),
+		  LOKATT_EVICTED);
+	ASSERT_EQ(count, 100);
+	ASSERT_EQ(ids[0], 2603);
+	ASSERT_EQ(ids[count - 1], 2702);
+	free(ids);
+
+	lokatt_destroy_filter(filter);
+	lokatt_close_device(dev);
+}
+
+/* check 'ids' against matching the events in ['begin', 'end') one by one */
+static void check_scan(struct lokatt_device *dev,
+		       const struct lokatt_filter *filter,
+		       uint64_t begin, uint64_t end,
+		       const uint64_t *ids, size_t count)
+{
+	struct lokatt_filter *any;
+	struct lokatt_event event;
+	uint64_t id;
+	size_t i = 0;
+
+	any = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(any, NULL);
+	for (id = begin; id < end; id++) {
+		ASSERT_EQ(lokatt_next_event(dev, id, any, &event), 0);
+		if (!lokatt_filter_match(filter, &event))
+			continue;
+		ASSERT_LT(i, count);
+		ASSERT_EQ(ids[i], id);
+		i++;
+	}
+	ASSERT_EQ(i, count);
+	lokatt_destroy_filter(any);
+}
+
+TEST(device, scan_cache)
+{
+	/* scan out of order, so the cached ranges grow both ways */
+	static const uint64_t ranges[][2] = {
+		{ 1000, 1100 },
+		{ 1050, 1500 },
+		{ 200, 300 },
+		{ 0, 2703 },
+		{ 2000, 2100 },
+	};
+	static const char *specs[] = {
+		"level >= 5 || text contains \"wifi\"",
+		"(level>=5)||(text contains \"wifi\")",
+		"tag == \"ActivityManager\"",
+	};
+	const struct lokatt_options small = {
+		.max_cache_bytes = 1,
+	};
+	const struct lokatt_options *opts[] = { NULL, &small };
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+	uint64_t *ids;
+	size_t i, j, k, count;
+
+	for (i = 0; i < sizeof(opts) / sizeof(opts[0]); i++) {
+		dev = lokatt_open_file(BOOT_CAPTURE, opts[i]);
+		ASSERT_NE(dev, NULL);
+		filter = lokatt_create_filter(EVENT_ANY, NULL);
+		ASSERT_NE(filter, NULL);
+		ASSERT_EQ(lokatt_next_event(dev, 2702, filter, &event), 0);
+		lokatt_destroy_filter(filter);
+
+		for (j = 0; j < sizeof(ranges) / sizeof(ranges[0]); j++) {
+			for (k = 0; k < sizeof(specs) / sizeof(specs[0]); k++) {
+				filter = lokatt_create_filter(EVENT_ANY,
+							      specs[k]);
+				ASSERT_NE(filter, NULL);
+				ASSERT_EQ(lokatt_scan(dev, ranges[j][0],
+						      ranges[j][1], filter,
+						      &ids, &count), 0);
+				check_scan(dev, filter, ranges[j][0],
+					   ranges[j][1], ids, count);
+				free(ids);
+				lokatt_destroy_filter(filter);
+			}
+		}
+
+		lokatt_close_device(dev);
+	}
+}
+
+TEST(device, scan_spilled)
+{
+	static const char *specs[] = {
+		"tag == \"ActivityManager\"",
+		"level >= 5 || text contains \"wifi\"",
+		"tid > 1000 && level == 4",
+	};
+	const struct lokatt_options opts = {
+		.max_bytes = 1,
+		.spill_dir = "/tmp",
+	};
+	char path[] = "/tmp/lokatt-test-XXXXXX", buf[4096];
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+	uint64_t *ids;
+	FILE *in, *out;
+	size_t i, n;
+	int fd;
+
+	/* a few copies of the capture, more than the two chunks kept */
+	fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	out = fdopen(fd, "w");
+	ASSERT_NE(out, NULL);
+	for (i = 0; i < 4; i++) {
+		in = fopen(BOOT_CAPTURE, "r");
+		ASSERT_NE(in, NULL);
+		while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+			ASSERT_EQ(fwrite(buf, 1, n, out), n);
+		fclose(in);
+	}
+	ASSERT_EQ(fclose(out), 0);
+
+	dev = lokatt_open_file(path, &opts);
+	ASSERT_NE(dev, NULL);
+	unlink(path);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 4 * 2703 - 1, filter, &event), 0);
+	lokatt_destroy_filter(filter);
+
+	for (i = 0; i < sizeof(specs) / sizeof(specs[0]); i++) {
+		filter = lokatt_create_filter(EVENT_ANY, specs[i]);
+		ASSERT_NE(filter, NULL);
+		ASSERT_EQ(lokatt_scan(dev, 0, UINT64_MAX, filter, &ids, &n),
+			  0);
+		ASSERT_GT(n, 0);
+		check_scan(dev, filter, 0, 4 * 2703, ids, n);
+		free(ids);
+		lokatt_destroy_filter(filter);
+	}
+
+	lokatt_close_device(dev);
+}
@@ -1,12 +1,21 @@
+#include <fcntl.h>
+#include <regex.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "liblokatt/adb.h"
 #include "liblokatt/filter.h"
+#include "liblokatt/index.h"
+#include "liblokatt/intern.h"
 #include "liblokatt/lokatt.h"
 #include "liblokatt/strbuf.h"
 
 #include "test.h"
 
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+
 TEST(lexer, single_valid_tokens)
 {
 	struct token *tokens;
@@ -495,7 +504,19 @@ TEST(filter, valid_input)
 	ASSERT_NE(oneshot("tag != \"foobar\"", &event), 0);
 	ASSERT_EQ(oneshot("tag != \"PackageManagerService\"", &event), 0);
 
-	/* TODO: add tests for =~ and !~ */
+	ASSERT_NE(oneshot("tag =~ \"Package\"", &event), 0);
+	ASSERT_NE(oneshot("tag =~ \"^Package.*Service$\"", &event), 0);
+	ASSERT_EQ(oneshot("tag =~ \"^Service\"", &event), 0);
+	ASSERT_NE(oneshot("text =~ \"is (the|a) text\\\\.\"", &event), 0);
+
+	ASSERT_NE(oneshot("tag !~ \"^Service\"", &event), 0);
+	ASSERT_EQ(oneshot("tag !~ \"Package\"", &event), 0);
+
+	ASSERT_NE(oneshot("tag contains \"Manager\"", &event), 0);
+	ASSERT_EQ(oneshot("tag contains \"manager\"", &event), 0);
+	ASSERT_NE(oneshot("tag icontains \"manager\"", &event), 0);
+	ASSERT_NE(oneshot("text icontains \"THE TEXT\"", &event), 0);
+	ASSERT_EQ(oneshot("text icontains \"THE TEXTS\"", &event), 0);
 
 	/* logical operations */
 	str = "pid == 1 && tag == \"PackageManagerService\"";
@@ -513,6 +534,85 @@ TEST(filter, valid_input)
 	ASSERT_EQ(oneshot(str, &event), 0);
 }
 
+TEST(filter, pname)
+{
+	struct lokatt_event event = {
+		.type = EVENT_LOGCAT_MESSAGE,
+		.msg = {
+			.pid = 1,
+			.tag = "",
+			.text = "",
+		},
+	};
+	int i;
+
+	/* unknown */
+	ASSERT_EQ(oneshot("pname == \"com.android.systemui\"", &event), 0);
+	ASSERT_NE(oneshot("pname != \"com.android.systemui\"", &event), 0);
+	ASSERT_EQ(oneshot("pname =~ \"systemui\"", &event), 0);
+	ASSERT_EQ(oneshot("pname == \"\"", &event), 0);
+
+	event.msg.pname = "com.android.systemui";
+	ASSERT_NE(oneshot("pname == \"com.android.systemui\"", &event), 0);
+	ASSERT_EQ(oneshot("pname == \"com.android\"", &event), 0);
+	ASSERT_EQ(oneshot("pname != \"com.android.systemui\"", &event), 0);
+	ASSERT_NE(oneshot("pname contains \"android\"", &event), 0);
+	ASSERT_NE(oneshot("pid == 1 && pname == \"com.android.systemui\"",
+			  &event), 0);
+
+	/* the second match of a name uses the memoized result */
+	for (i = 0; i < 2; i++) {
+		struct lokatt_filter *f;
+
+		f = lokatt_create_filter(EVENT_ANY, "pname =~ \"systemui$\"");
+		ASSERT_NE(f, NULL);
+		event.msg.pname = "com.android.systemui";
+		ASSERT_NE(lokatt_filter_match(f, &event), 0);
+		ASSERT_NE(lokatt_filter_match(f, &event), 0);
+		event.msg.pname = "system_server";
+		ASSERT_EQ(lokatt_filter_match(f, &event), 0);
+		ASSERT_EQ(lokatt_filter_match(f, &event), 0);
+		lokatt_destroy_filter(f);
+	}
+	ASSERT_NE(oneshot("pname !~ \"systemui$\"", &event), 0);
+
+	ASSERT_EQ(lokatt_create_filter(EVENT_ANY, "pname == 1"), NULL);
+	ASSERT_EQ(lokatt_create_filter(EVENT_ANY, "pname < \"a\""), NULL);
+}
+
+TEST(filter, literals_not_interned)
+{
+	struct lokatt_event event = {
+		.type = EVENT_LOGCAT_MESSAGE,
+		.msg = {
+			.pid = 1,
+			.tag = "filter-test-tag",
+			.text = "",
+			.pname = "filter-test-pname",
+		},
+	};
+	struct lokatt_filter *f;
+	int i;
+
+	f = lokatt_create_filter(EVENT_ANY,
+				 "tag == \"filter-test-tag\" && "
+				 "pname != \"filter-test-other\"");
+	ASSERT_NE(f, NULL);
+	ASSERT_EQ(intern_find("filter-test-tag"), INTERN_NONE);
+	ASSERT_EQ(intern_find("filter-test-other"), INTERN_NONE);
+
+	/* still matches once the strings have been interned */
+	for (i = 0; i < 2; i++) {
+		ASSERT_NE(lokatt_filter_match(f, &event), 0);
+		event.msg.pname = "filter-test-other";
+		ASSERT_EQ(lokatt_filter_match(f, &event), 0);
+		event.msg.pname = "filter-test-pname";
+		intern("filter-test-tag", 15, NULL);
+		intern("filter-test-other", 17, NULL);
+	}
+	lokatt_destroy_filter(f);
+}
+
 TEST(filter, invalid_input)
 {
 	struct lokatt_filter *f;
@@ -525,4 +625,363 @@ TEST(filter, invalid_input)
 
 	f = lokatt_create_filter(EVENT_ANY, "(pid == 1 || tid != 2 && sec < 3");
 	ASSERT_EQ(f, NULL);
+
+	/* type errors */
+	f = lokatt_create_filter(EVENT_ANY, "pid == \"1\"");
+	ASSERT_EQ(f, NULL);
+
+	f = lokatt_create_filter(EVENT_ANY, "tag == 1");
+	ASSERT_EQ(f, NULL);
+
+	f = lokatt_create_filter(EVENT_ANY, "tag < \"x\"");
+	ASSERT_EQ(f, NULL);
+
+	f = lokatt_create_filter(EVENT_ANY, "pid == 1 && 2");
+	ASSERT_EQ(f, NULL);
+
+	f = lokatt_create_filter(EVENT_ANY, "pid == 1 pid == 2");
+	ASSERT_EQ(f, NULL);
+
+	f = lokatt_create_filter(EVENT_ANY, "");
+	ASSERT_EQ(f, NULL);
+}
+
+TEST(filter, nested_input)
+{
+	const struct lokatt_event event  = {
+		.type = EVENT_LOGCAT_MESSAGE,
+		.id = 0,
+		.msg = {
+			.pid = 1,
+			.tid = 2,
+			.sec = 3,
+			.nsec = 4,
+			.level = LEVEL_WARNING,
+			.tag = "PackageManagerService",
+			.text = "This is the text.",
+		},
+	};
+	const char *str;
+
+	str = "(pid == 0 || tid == 2) && (sec == 3 || (nsec == 0 && pid == 1))";
+	ASSERT_NE(oneshot(str, &event), 0);
+	str = "(pid == 0 || tid == 2) && (sec == 0 || (nsec == 0 && pid == 1))";
+	ASSERT_EQ(oneshot(str, &event), 0);
+	str = "pid == 0 || (tid == 0 || (sec == 0 || (nsec == 0 || "
+		"(level == 0 || (tag == \"x\" || text == \"This is the text.\")"
+		"))))";
+	ASSERT_NE(oneshot(str, &event), 0);
+}
+
+TEST(filter, short_circuit)
+{
+	const struct lokatt_event event  = {
+		.type = EVENT_LOGCAT_MESSAGE,
+		.id = 0,
+		.msg = {
+			.pid = 1,
+			.tid = 2,
+			.sec = 3,
+			.nsec = 4,
+			.level = LEVEL_WARNING,
+			.tag = "PackageManagerService",
+			.text = "This is the text.",
+		},
+	};
+	const char *str;
+
+	/* string comparisons first, to be reordered after integer ones */
+	str = "text == \"x\" || tag == \"x\" || pid == 1";
+	ASSERT_NE(oneshot(str, &event), 0);
+	str = "text == \"x\" || tag == \"x\" || pid == 0";
+	ASSERT_EQ(oneshot(str, &event), 0);
+	str = "text == \"This is the text.\" && tag != \"x\" && pid == 1";
+	ASSERT_NE(oneshot(str, &event), 0);
+	str = "text == \"This is the text.\" && tag != \"x\" && pid == 0";
+	ASSERT_EQ(oneshot(str, &event), 0);
+
+	/* mixed chains, with nested chains of the same operator */
+	str = "tag == \"x\" || pid == 0 && tid == 2 || sec == 3 && nsec == 4";
+	ASSERT_NE(oneshot(str, &event), 0);
+	str = "tag == \"x\" || pid == 0 && tid == 2 || sec == 3 && nsec == 0";
+	ASSERT_EQ(oneshot(str, &event), 0);
+	str = "(text != \"x\" && (tag != \"x\" && (pid == 1 && tid == 2))) "
+		"&& (level == 0 || (sec == 0 || nsec == 4))";
+	ASSERT_NE(oneshot(str, &event), 0);
+	str = "(text != \"x\" && (tag != \"x\" && (pid == 1 && tid == 2))) "
+		"&& (level == 0 || (sec == 0 || nsec == 0))";
+	ASSERT_EQ(oneshot(str, &event), 0);
+}
+
+TEST(filter, regex_literal_prefilter)
+{
+	static const char *patterns[] = {
+		"foo", "^foo", "foo$", "^foo$", "fo+", "fo?o", "fo*bar",
+		"f(oo)?bar", "f(o|x)obar", "foo|bar", "[fb]oo", "fo{2}",
+		"foo\\.bar", "^f.o", "\\(foo", "x[]]foo", "ba+r", "",
+	};
+	static const char *strings[] = {
+		"", "foo", "xfoo", "foox", "fobar", "foobar", "fbar",
+		"fxobar", "boo", "foo.bar", "fooxbar", "(foo", "x]foo",
+		"baaar", "fo",
+	};
+	struct lokatt_event event = {
+		.type = EVENT_LOGCAT_MESSAGE,
+		.msg = {
+			.tag = "",
+		},
+	};
+	char spec[64];
+	size_t i, j;
+	char *p;
+
+	for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+		struct lokatt_filter *f;
+		regex_t re;
+
+		/* backslashes in filter strings need escaping */
+		p = spec + sprintf(spec, "text =~ \"");
+		for (j = 0; patterns[i][j]; j++) {
+			if (patterns[i][j] == '\\')
+				*p++ = '\\';
+			*p++ = patterns[i][j];
+		}
+		strcpy(p, "\"");
+
+		f = lokatt_create_filter(EVENT_ANY, spec);
+		ASSERT_NE(f, NULL);
+		ASSERT_EQ(regcomp(&re, patterns[i], REG_EXTENDED | REG_NOSUB),
+			  0);
+		for (j = 0; j < sizeof(strings) / sizeof(strings[0]); j++) {
+			event.msg.text = strings[j];
+			ASSERT_EQ(lokatt_filter_match(f, &event),
+				  !regexec(&re, strings[j], 0, NULL, 0));
+		}
+		regfree(&re);
+		lokatt_destroy_filter(f);
+	}
+
+	ASSERT_EQ(lokatt_create_filter(EVENT_ANY, "text =~ \"(\""), NULL);
+	ASSERT_EQ(lokatt_create_filter(EVENT_ANY, "pid =~ \"1\""), NULL);
+	ASSERT_EQ(lokatt_create_filter(EVENT_ANY, "pid contains 1"), NULL);
+}
+
+TEST(filter, tag_sets)
+{
+	const char *tags[] = { "a", "b", "c", "d", "not-interned" };
+	struct lokatt_event event = {
+		.type = EVENT_LOGCAT_MESSAGE,
+		.msg = {
+			.pid = 1,
+			.text = "",
+		},
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+		int is_abc = i < 3;
+
+		event.msg.tag = tags[i];
+		ASSERT_EQ(oneshot("tag == \"a\" || tag == \"b\" || "
+				  "tag == \"c\"", &event), is_abc);
+		ASSERT_EQ(oneshot("tag == \"a\" || pid == 0 || "
+				  "(tag == \"b\" || tag == \"c\")",
+				  &event), is_abc);
+		ASSERT_EQ(oneshot("tag != \"a\" && tag != \"b\" && "
+				  "tag != \"c\"", &event), !is_abc);
+		ASSERT_EQ(oneshot("(tag == \"a\" || tag == \"b\" || "
+				  "tag == \"c\") && pid == 1", &event),
+			  is_abc);
+	}
+}
+
+/* names for some of the processes of BOOT_CAPTURE */
+static uint32_t pname_of(int32_t pid)
+{
+	switch (pid) {
+	case 189:
+		return intern("/system/bin/mediaserver", 23, NULL);
+	case 727:
+		return intern("system_server", 13, NULL);
+	default:
+		return INTERN_NONE;
+	}
+}
+
+static int match(const struct lokatt_filter *f, struct index *idx,
+		 uint64_t id)
+{
+	const struct index_event *e = index_get(idx, id);
+	struct lokatt_message msg;
+
+	index_event_to_message(e, &msg);
+	return filter_match_event(f, e->type, &msg, e->tag_id, e->pname_id);
+}
+
+/* seeking with posting lists must find the same events as a full scan */
+TEST(filter, seek)
+{
+	static const char *specs[] = {
+		"tag == \"ActivityManager\"",
+		"tag == \"ActivityManager\" && level == 4",
+		"pid == 578 && tid != 578 && text contains \"a\"",
+		"level == 6",
+		"tid == 190 && tag == \"installd\"",
+		"tag == \"no-such-tag\"",
+		"pid == 1 || tag == \"ActivityManager\"",
+		"pname == \"system_server\"",
+		"pname == \"system_server\" && level == 4",
+		"pname =~ \"^/system\" && tag == \"AudioFlinger\"",
+	};
+	struct adb_reader reader;
+	struct adb_message msg;
+	struct index idx;
+	size_t i;
+	int fd;
+
+	index_init(&idx, 0, 0);
+	fd = open(BOOT_CAPTURE, O_RDONLY);
+	ASSERT_GE(fd, 0);
+	adb_reader_init(&reader, fd);
+	while (adb_reader_next(&reader, &msg) == 0)
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg,
+			     pname_of(msg.pid));
+	index_append(&idx, EVENT_DEVICE_DISCONNECTED, NULL, INTERN_NONE);
+
+	for (i = 0; i < 2 * sizeof(specs) / sizeof(specs[0]); i++) {
+		unsigned int mask = i % 2 ? EVENT_ANY : EVENT_LOGCAT_MESSAGE;
+		struct lokatt_filter *f;
+		uint64_t id, next = 0;
+
+		f = lokatt_create_filter(mask, specs[i / 2]);
+		ASSERT_NE(f, NULL);
+		for (id = 0; id < idx.current_size; id++) {
+			if (!match(f, &idx, id))
+				continue;
+			/* next match when seeking */
+			for (;;) {
+				next = filter_seek(f, &idx, next);
+				ASSERT_LE(next, id);
+				if (match(f, &idx, next))
+					break;
+				next++;
+			}
+			ASSERT_EQ(next, id);
+			next++;
+		}
+		for (;;) {
+			next = filter_seek(f, &idx, next);
+			if (next == idx.current_size)
+				break;
+			ASSERT_EQ(match(f, &idx, next), 0);
+			next++;
+		}
+		lokatt_destroy_filter(f);
+	}
+
+	adb_reader_destroy(&reader);
+	close(fd);
+	index_destroy(&idx);
+}
+
+static int same_key(unsigned int mask_a, const char *spec_a,
+		    unsigned int mask_b, const char *spec_b)
+{
+	struct lokatt_filter *a = lokatt_create_filter(mask_a, spec_a);
+	struct lokatt_filter *b = lokatt_create_filter(mask_b, spec_b);
+	struct strbuf key_a = STRBUF_INIT, key_b = STRBUF_INIT;
+	int retval;
+
+	filter_key(a, &key_a);
+	filter_key(b, &key_b);
+	retval = !strcmp(key_a.buf, key_b.buf);
+	strbuf_destroy(&key_a);
+	strbuf_destroy(&key_b);
+	lokatt_destroy_filter(a);
+	lokatt_destroy_filter(b);
+	return retval;
+}
+
+TEST(filter, key)
+{
+	const unsigned int any = EVENT_ANY, msg = EVENT_LOGCAT_MESSAGE;
+
+	ASSERT_EQ(same_key(any, NULL, any, NULL), 1);
+	ASSERT_EQ(same_key(any, "pid == 1 && tag == \"a b\"",
+			   any, "((pid==1))&&(tag  ==  \"a b\")"), 1);
+	ASSERT_EQ(same_key(any, "pid == 1 || pid == 2 && pid == 3",
+			   any, "pid == 1 || (pid == 2 && pid == 3)"), 1);
+
+	ASSERT_EQ(same_key(any, NULL, msg, NULL), 0);
+	ASSERT_EQ(same_key(any, "pid == 1", any, "pid == 2"), 0);
+	ASSERT_EQ(same_key(any, "pid == 1", any, "tid == 1"), 0);
+	ASSERT_EQ(same_key(any, "tag == \"a\"", any, "tag == \"b\""), 0);
+	ASSERT_EQ(same_key(any, "pid == 1 || pid == 2 && pid == 3",
+			   any, "(pid == 1 || pid == 2) && pid == 3"), 0);
+}
+
+/* the selection on columns must be a superset of the matches, or exact */
+TEST(filter, select)
+{
+	static const struct {
+		const char *spec;
+		int exact;
+	} specs[] = {
+		{ NULL, 1 },
+		{ "level >= 5", 1 },
+		{ "pid == 578 && tid != 578", 1 },
+		{ "tag == \"ActivityManager\" || level < 3", 1 },
+		{ "tag != \"ActivityManager\" && tag != \"installd\"", 1 },
+		{ "sec > 0 && nsec < 500000000 || pid == 190", 1 },
+		/* not interned: compared as a string */
+		{ "tag == \"no-such-tag\"", 0 },
+		{ "level == 4 && text contains \"a\"", 0 },
+		{ "level == 4 || text contains \"a\"", 0 },
+		{ "(pid == 1 || tag =~ \"^A\") && tid > 1000", 0 },
+		{ "pname == \"system_server\"", 1 },
+		{ "pname != \"system_server\" && level == 4", 1 },
+		{ "pname =~ \"^/system\" || pid == 727", 0 },
+	};
+	const struct index_columns *columns;
+	struct adb_reader reader;
+	struct adb_message msg;
+	struct index idx;
+	size_t i;
+	int fd;
+
+	index_init(&idx, 0, 0);
+	fd = open(BOOT_CAPTURE, O_RDONLY);
+	ASSERT_GE(fd, 0);
+	adb_reader_init(&reader, fd);
+	while (adb_reader_next(&reader, &msg) == 0)
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg,
+			     pname_of(msg.pid));
+	index_append(&idx, EVENT_DEVICE_DISCONNECTED, NULL, INTERN_NONE);
+	columns = index_columns(&idx);
+
+	for (i = 0; i < 2 * sizeof(specs) / sizeof(specs[0]); i++) {
+		unsigned int mask = i % 2 ? EVENT_ANY : EVENT_LOGCAT_MESSAGE;
+		struct lokatt_filter *f;
+		uint64_t id, bits = 0;
+
+		f = lokatt_create_filter(mask, specs[i / 2].spec);
+		ASSERT_NE(f, NULL);
+		ASSERT_EQ(filter_select_exact(f), specs[i / 2].exact);
+		for (id = 0; id < idx.current_size; id++) {
+			int selected;
+
+			if (id % 64 == 0)
+				bits = filter_select(f, columns, id);
+			selected = (bits >> (id % 64)) & 1;
+			if (specs[i / 2].exact)
+				ASSERT_EQ(selected, match(f, &idx, id));
+			else if (match(f, &idx, id))
+				ASSERT_EQ(selected, 1);
+		}
+		lokatt_destroy_filter(f);
+	}
+
+	adb_reader_destroy(&reader);
+	close(fd);
+	index_destroy(&idx);
 }
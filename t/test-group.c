@@ -0,0 +1,91 @@
+#include <string.h>
+
+#include "liblokatt/lokatt.h"
+
+#include "test.h"
+
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+#define REGULAR_USAGE_CAPTURE "t/nexus-5-android-5.1-regular-usage.bin"
+
+#define DEVICE_COUNT 8
+
+TEST(group, file_devices)
+{
+	struct lokatt_options opts = { 0 };
+	struct lokatt_device *devs[DEVICE_COUNT], *alone;
+	struct lokatt_filter *filter;
+	struct lokatt_event a, b;
+	int i;
+
+	opts.group = lokatt_create_group();
+	ASSERT_NE(opts.group, NULL);
+	for (i = 0; i < DEVICE_COUNT; i++) {
+		devs[i] = lokatt_open_file(i % 2 ? BOOT_CAPTURE :
+					   REGULAR_USAGE_CAPTURE, &opts);
+		ASSERT_NE(devs[i], NULL);
+	}
+	alone = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(alone, NULL);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+
+	/* blocks until the group's thread has read the whole file */
+	ASSERT_EQ(lokatt_next_event(devs[0], 2443, filter, &a), 0);
+	for (i = 1; i < DEVICE_COUNT; i += 2) {
+		ASSERT_EQ(lokatt_next_event(devs[i], 2702, filter, &a), 0);
+		ASSERT_EQ(lokatt_next_event(alone, 2702, filter, &b), 0);
+		ASSERT_EQ(a.msg.sec, b.msg.sec);
+		ASSERT_EQ(a.msg.nsec, b.msg.nsec);
+		ASSERT_EQ(strcmp(a.msg.text, b.msg.text), 0);
+	}
+
+	lokatt_destroy_filter(filter);
+	lokatt_close_device(alone);
+	for (i = 0; i < DEVICE_COUNT; i++)
+		lokatt_close_device(devs[i]);
+	lokatt_destroy_group(opts.group);
+}
+
+TEST(group, close_while_reading)
+{
+	struct lokatt_options opts = { 0 };
+	struct lokatt_device *dev;
+	int i;
+
+	opts.group = lokatt_create_group();
+	ASSERT_NE(opts.group, NULL);
+	for (i = 0; i < 100; i++) {
+		dev = lokatt_open_file(REGULAR_USAGE_CAPTURE, &opts);
+		ASSERT_NE(dev, NULL);
+		lokatt_close_device(dev);
+	}
+	lokatt_destroy_group(opts.group);
+}
+
+TEST(group, pollable_devices)
+{
+	struct lokatt_options opts = { 0 };
+	struct lokatt_device *devs[2];
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+	int i;
+
+	/* dummy devices trickle messages out, timed by a timer fd */
+	opts.group = lokatt_create_group();
+	ASSERT_NE(opts.group, NULL);
+	for (i = 0; i < 2; i++) {
+		devs[i] = lokatt_open_dummy_device(BOOT_CAPTURE, &opts);
+		ASSERT_NE(devs[i], NULL);
+	}
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	for (i = 0; i < 2; i++) {
+		ASSERT_EQ(lokatt_next_event(devs[i], 1, filter, &event), 0);
+		ASSERT_EQ(event.id, 1);
+	}
+
+	lokatt_destroy_filter(filter);
+	for (i = 0; i < 2; i++)
+		lokatt_close_device(devs[i]);
+	lokatt_destroy_group(opts.group);
+}
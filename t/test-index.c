@@ -0,0 +1,551 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "liblokatt/adb.h"
+#include "liblokatt/index.h"
+#include "liblokatt/intern.h"
+#include "liblokatt/lokatt.h"
+
+#include "test.h"
+
+static char payload[MSG_MAX_PAYLOAD_SIZE];
+
+static void set_payload(struct adb_message *msg, uint8_t level,
+			const char *tag, const char *text)
+{
+	size_t tag_size = strlen(tag) + 1;
+	size_t text_size = strlen(text) + 1;
+
+	payload[0] = level;
+	memcpy(payload + 1, tag, tag_size);
+	memcpy(payload + 1 + tag_size, text, text_size);
+	msg->payload = payload;
+	msg->payload_size = 1 + tag_size + text_size;
+	msg->persistent = 0;
+}
+
+TEST(index, append_and_get)
+{
+	struct index idx;
+	struct adb_message msg;
+	const struct index_event *e;
+
+	index_init(&idx, 0, 0);
+	ASSERT_EQ(index_get(&idx, 0), NULL);
+
+	msg.pid = 1;
+	msg.tid = 2;
+	msg.sec = 3;
+	msg.nsec = 4;
+	set_payload(&msg, LEVEL_INFO, "tag", "text\n\n");
+	index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	index_append(&idx, EVENT_DEVICE_DISCONNECTED, NULL, INTERN_NONE);
+
+	e = index_get(&idx, 0);
+	ASSERT_NE(e, NULL);
+	ASSERT_EQ(e->id, 0);
+	ASSERT_EQ(e->type, EVENT_LOGCAT_MESSAGE);
+	ASSERT_EQ(e->pid, 1);
+	ASSERT_EQ(e->tid, 2);
+	ASSERT_EQ(e->sec, 3);
+	ASSERT_EQ(e->nsec, 4);
+	ASSERT_EQ(e->level, LEVEL_INFO);
+	ASSERT_EQ(strcmp(e->tag, "tag"), 0);
+	ASSERT_NE(e->tag_id, INTERN_NONE);
+	ASSERT_EQ(strcmp(e->text, "text"), 0);
+
+	e = index_get(&idx, 1);
+	ASSERT_NE(e, NULL);
+	ASSERT_EQ(e->id, 1);
+	ASSERT_EQ(e->type, EVENT_DEVICE_DISCONNECTED);
+
+	ASSERT_EQ(index_get(&idx, 2), NULL);
+
+	index_destroy(&idx);
+}
+
+TEST(index, append_many)
+{
+	struct index idx;
+	struct adb_message msg;
+	struct lokatt_event out;
+	char tag[32], text[MSG_MAX_PAYLOAD_SIZE];
+	const struct index_event *e;
+	int i;
+
+	index_init(&idx, 0, 0);
+	memset(text, 'x', sizeof(text));
+	for (i = 0; i < 100000; i++) {
+		snprintf(tag, sizeof(tag), "tag-%d", i);
+		text[i % 2000] = '\0';
+		msg.pid = i;
+		set_payload(&msg, LEVEL_DEBUG, tag, text);
+		text[i % 2000] = 'x';
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	}
+
+	for (i = 0; i < 100000; i++) {
+		e = index_get(&idx, i);
+		ASSERT_NE(e, NULL);
+		ASSERT_EQ(e->pid, i);
+		ASSERT_EQ(strlen(e->text), (size_t)(i % 2000));
+
+		index_event_copy(e, &out);
+		snprintf(tag, sizeof(tag), "tag-%d", i);
+		ASSERT_EQ(out.id, (uint64_t)i);
+		ASSERT_EQ(strcmp(out.msg.tag, tag), 0);
+		ASSERT_EQ(out.msg.tag, out.msg.payload + 1);
+		ASSERT_EQ(strlen(out.msg.text), (size_t)(i % 2000));
+	}
+
+	index_destroy(&idx);
+}
+
+TEST(index, payload_without_nul)
+{
+	struct index idx;
+	struct adb_message msg;
+	struct lokatt_event out;
+	const struct index_event *e;
+
+	index_init(&idx, 0, 0);
+	memset(payload, 'x', sizeof(payload));
+	msg.payload = payload;
+	msg.payload_size = sizeof(payload);
+	msg.persistent = 0;
+	index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+
+	e = index_get(&idx, 0);
+	ASSERT_NE(e, NULL);
+	ASSERT_LT(strlen(e->tag) + strlen(e->text) + 3,
+		  MSG_MAX_PAYLOAD_SIZE + 1);
+	index_event_copy(e, &out);
+
+	index_destroy(&idx);
+}
+
+TEST(index, persistent_payload)
+{
+	struct index idx;
+	struct adb_message msg;
+	const struct index_event *e;
+
+	index_init(&idx, 0, 0);
+
+	/* well-formed payloads are used in place, tags are interned */
+	set_payload(&msg, LEVEL_INFO, "tag", "text");
+	msg.persistent = 1;
+	index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	e = index_get(&idx, 0);
+	ASSERT_EQ(e->tag_id, intern_find("tag"));
+	ASSERT_EQ(strcmp(e->tag, "tag"), 0);
+	ASSERT_EQ(e->text, payload + 5);
+
+	/* payloads that need trailing newlines stripped are copied */
+	set_payload(&msg, LEVEL_INFO, "tag", "text\n");
+	msg.persistent = 1;
+	index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	e = index_get(&idx, 1);
+	ASSERT_NE(e->text, payload + 5);
+	ASSERT_EQ(strcmp(e->text, "text"), 0);
+
+	/* payloads without terminating nul are copied */
+	set_payload(&msg, LEVEL_INFO, "tag", "text");
+	msg.payload_size--;
+	msg.persistent = 1;
+	index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	e = index_get(&idx, 2);
+	ASSERT_NE(e->text, payload + 5);
+	ASSERT_EQ(strcmp(e->text, "text"), 0);
+
+	index_destroy(&idx);
+}
+
+TEST(index, evict_by_event_count)
+{
+	struct index idx;
+	struct adb_message msg;
+	const struct index_event *e;
+	int i;
+
+	index_init(&idx, 1000, 0);
+	set_payload(&msg, LEVEL_DEBUG, "tag", "text");
+	for (i = 0; i < 100000; i++) {
+		msg.pid = i;
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	}
+
+	ASSERT_EQ(idx.first_id, 99000);
+	ASSERT_EQ(idx.current_size, 100000);
+	ASSERT_EQ(index_get(&idx, 0), NULL);
+	ASSERT_EQ(index_get(&idx, 98999), NULL);
+	for (i = 99000; i < 100000; i++) {
+		e = index_get(&idx, i);
+		ASSERT_NE(e, NULL);
+		ASSERT_EQ(e->id, (uint64_t)i);
+		ASSERT_EQ(e->pid, i);
+	}
+	ASSERT_EQ(idx.chunk_count, 1);
+
+	index_destroy(&idx);
+}
+
+TEST(index, evict_by_byte_count)
+{
+	struct index idx;
+	struct adb_message msg;
+	char text[1000];
+	const struct index_event *e;
+	uint64_t first_id = 0;
+	int i;
+
+	index_init(&idx, 0, 1024 * 1024);
+	memset(text, 'x', sizeof(text));
+	text[sizeof(text) - 1] = '\0';
+	set_payload(&msg, LEVEL_DEBUG, "tag", text);
+	for (i = 0; i < 100000; i++) {
+		msg.pid = i;
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+		ASSERT_GE(idx.first_id, first_id);
+		first_id = idx.first_id;
+	}
+
+	ASSERT_GT(idx.first_id, 0);
+	ASSERT_LE(idx.chunk_count * 256 * 1024, 1024 * 1024);
+	ASSERT_EQ(index_get(&idx, idx.first_id - 1), NULL);
+	for (i = idx.first_id; i < 100000; i++) {
+		e = index_get(&idx, i);
+		ASSERT_NE(e, NULL);
+		ASSERT_EQ(e->pid, i);
+		ASSERT_EQ(strlen(e->text), sizeof(text) - 1);
+	}
+
+	index_destroy(&idx);
+}
+
+TEST(index, spill)
+{
+	struct index idx;
+	struct adb_message msg;
+	char text[1000];
+	const struct index_event *e;
+	int i;
+
+	index_init(&idx, 0, 1024 * 1024);
+	ASSERT_EQ(index_spill(&idx, "/tmp"), 0);
+	memset(text, 'x', sizeof(text));
+	for (i = 0; i < 100000; i++) {
+		text[i % sizeof(text)] = '\0';
+		msg.pid = i;
+		set_payload(&msg, LEVEL_DEBUG, i % 2 ? "tag" : "", text);
+		text[i % sizeof(text)] = 'x';
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	}
+	index_append(&idx, EVENT_DEVICE_DISCONNECTED, NULL, INTERN_NONE);
+
+	/* nothing is evicted, but only the budget is kept in memory */
+	ASSERT_EQ(idx.first_id, 0);
+	ASSERT_LE(idx.chunk_count * 256 * 1024, 1024 * 1024);
+	ASSERT_GT(index_resident_id(&idx), 50000);
+
+	/* the posting lists only cover the resident events */
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_PID, 5, 0), 0);
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_PID, 5, idx.resident_id),
+		  index_size(&idx));
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_PID, 99999, idx.resident_id),
+		  99999);
+
+	/* in order, then jumping around to page chunks in and out */
+	for (i = 0; i < 200000; i++) {
+		int id = i < 100000 ? i : (i * 7919) % 100000;
+
+		e = index_get(&idx, id);
+		ASSERT_NE(e, NULL);
+		ASSERT_EQ(e->id, (uint64_t)id);
+		ASSERT_EQ(e->pid, id);
+		ASSERT_EQ(strcmp(e->tag, id % 2 ? "tag" : ""), 0);
+		ASSERT_EQ(strlen(e->text), (size_t)(id % sizeof(text)));
+	}
+	e = index_get(&idx, 100000);
+	ASSERT_NE(e, NULL);
+	ASSERT_EQ(e->type, EVENT_DEVICE_DISCONNECTED);
+	ASSERT_EQ(index_get(&idx, 100001), NULL);
+
+	index_destroy(&idx);
+}
+
+TEST(index, seek)
+{
+	struct index idx;
+	struct adb_message msg;
+	uint64_t id;
+	int i, count = 0;
+
+	index_init(&idx, 1000, 0);
+	set_payload(&msg, LEVEL_DEBUG, "tag", "text");
+	for (i = 0; i < 10000; i++) {
+		msg.pid = i % 7;
+		msg.tid = i;
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+		if (i % 1000 == 999)
+			index_append(&idx, EVENT_DEVICE_CONNECTED, NULL, INTERN_NONE);
+	}
+	/* 10000 messages and 10 other events, the last 1000 are left */
+	ASSERT_EQ(idx.first_id, 9010);
+
+	for (id = index_seek(&idx, INDEX_KEY_PID, 3, idx.first_id);
+	     id < 10010; id = index_seek(&idx, INDEX_KEY_PID, 3, id + 1)) {
+		ASSERT_EQ(index_get(&idx, id)->pid, 3);
+		count++;
+	}
+	ASSERT_EQ(count, 143);
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_TID, 9000, 9010), 10010);
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_TID, 9999, 9010), 10008);
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_TID, 12345, 9010), 10010);
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_TYPE, EVENT_DEVICE_CONNECTED,
+			     9010), 10009);
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_LEVEL, LEVEL_DEBUG, 9500), 9500);
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_TAG, intern_find("tag"), 9500),
+		  9500);
+	/* not appended yet */
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_PID, 3, 20000), 20000);
+
+	index_destroy(&idx);
+}
+
+/* pids 1 and 2 have names, 3 doesn't */
+static uint32_t lookup_pname(void *data, int32_t pid)
+{
+	uint32_t *ids = data;
+
+	return pid < 3 ? ids[pid - 1] : INTERN_NONE;
+}
+
+TEST(index, name_processes)
+{
+	struct index idx;
+	struct adb_message msg;
+	const struct index_event *e;
+	const struct index_columns *c;
+	uint32_t ids[2];
+	uint64_t id;
+	int i, count;
+
+	ids[0] = intern("one", 3, NULL);
+	ids[1] = intern("two", 3, NULL);
+	index_init(&idx, 1000, 0);
+	set_payload(&msg, LEVEL_DEBUG, "tag", "text");
+	/* pid 1 is named as messages come, the others only later */
+	for (i = 0; i < 3000; i++) {
+		msg.pid = i % 3 + 1;
+		msg.tid = i;
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg,
+			     msg.pid == 1 ? ids[0] : INTERN_NONE);
+	}
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_PNAME, ids[1], 2000), 3000);
+
+	/* from the first id still there */
+	index_name_processes(&idx, 0, lookup_pname, ids);
+	c = index_columns(&idx);
+	for (id = 2000; id < 3000; id++) {
+		e = index_get(&idx, id);
+		ASSERT_EQ(index_event_pname_id(e),
+			  e->pid < 3 ? ids[e->pid - 1] : INTERN_NONE);
+		ASSERT_EQ(c->pname_id[id & c->mask], index_event_pname_id(e));
+	}
+	/* the posting lists stay in order */
+	for (i = 0; i < 2; i++) {
+		count = 0;
+		for (id = index_seek(&idx, INDEX_KEY_PNAME, ids[i], 2000);
+		     id < 3000;
+		     id = index_seek(&idx, INDEX_KEY_PNAME, ids[i], id + 1)) {
+			ASSERT_EQ(index_get(&idx, id)->pid, i + 1);
+			count++;
+		}
+		ASSERT_EQ(count, 333);
+	}
+
+	/* named messages are appended to the merged lists */
+	msg.pid = 2;
+	index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, ids[1]);
+	ASSERT_EQ(index_seek(&idx, INDEX_KEY_PNAME, ids[1], 2999), 3000);
+
+	index_destroy(&idx);
+}
+
+static uint64_t seek_time_slow(struct index *idx, int64_t ts, uint64_t id)
+{
+	const struct index_event *e;
+
+	for (; (e = index_get(idx, id)); id++) {
+		if ((int64_t)e->sec * 1000000000 + e->nsec >= ts)
+			break;
+	}
+	return id;
+}
+
+TEST(index, seek_time)
+{
+	struct index idx;
+	struct adb_message msg;
+	uint64_t id;
+	int64_t ts;
+	int i;
+
+	index_init(&idx, 50000, 0);
+	set_payload(&msg, LEVEL_DEBUG, "tag", "text");
+	/* three "boots", with timestamps jittering back and forth */
+	for (i = 0; i < 150000; i++) {
+		msg.sec = (i % 50000) / 100;
+		msg.nsec = (i * 7919 % 1000) * 1000000;
+		index_append(&idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	}
+	ASSERT_EQ(idx.first_id, 100000);
+
+	for (i = 0; i < 2000; i++) {
+		id = idx.first_id + (uint64_t)i * 7 % 50000;
+		ts = (int64_t)(i * 3 % 520) * 1000000000 + i % 1000 * 1000000;
+		ASSERT_EQ(index_seek_time(&idx, ts / 1000000000,
+					  ts % 1000000000, id),
+			  seek_time_slow(&idx, ts, id));
+	}
+
+	/* evicted ids start from the oldest event still available */
+	ASSERT_EQ(index_seek_time(&idx, 0, 0, 0), 100000);
+	ASSERT_EQ(index_seek_time(&idx, 250, 0, 0), 125000);
+	/* no such event */
+	ASSERT_EQ(index_seek_time(&idx, 1000, 0, 0), 150000);
+	ASSERT_EQ(index_seek_time(&idx, 0, 0, 200000), 200000);
+
+	index_destroy(&idx);
+}
+
+static long elapsed_ms(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - since->tv_sec) * 1000 +
+		(now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+static void *append_later(void *arg)
+{
+	struct index *idx = arg;
+	struct adb_message msg;
+
+	usleep(50 * 1000);
+	set_payload(&msg, LEVEL_DEBUG, "tag", "text");
+	index_append(idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	return NULL;
+}
+
+TEST(index, waker)
+{
+	struct index idx[2];
+	struct index_waker w = { 0, 0 };
+	struct timespec start;
+	pthread_t thread;
+	uint32_t seq;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		index_init(&idx[i], 0, 0);
+		index_add_waker(&idx[i], &w);
+	}
+
+	/* an append to either index wakes the waiter up */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	seq = w.seq;
+	pthread_create(&thread, NULL, append_later, &idx[1]);
+	while (__atomic_load_n(&w.seq, __ATOMIC_SEQ_CST) == seq)
+		index_waker_wait(&w, seq, 5000);
+	ASSERT_LT(elapsed_ms(&start), 2500);
+	pthread_join(thread, NULL);
+
+	/* not once removed, and then only the timeout ends the wait */
+	index_remove_waker(&idx[0], &w);
+	seq = w.seq;
+	pthread_create(&thread, NULL, append_later, &idx[0]);
+	pthread_join(thread, NULL);
+	ASSERT_EQ(w.seq, seq);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	index_waker_wait(&w, seq, 100);
+	ASSERT_LT(elapsed_ms(&start), 2500);
+
+	index_remove_waker(&idx[1], &w);
+	for (i = 0; i < 2; i++)
+		index_destroy(&idx[i]);
+}
+
+#define CONCURRENT_EVENTS 200000
+#define CONCURRENT_READERS 4
+
+static void *concurrent_reader(void *arg)
+{
+	struct index *idx = arg;
+	const struct index_event *e;
+	unsigned long epoch;
+	uint64_t id = 0;
+
+	while (id < CONCURRENT_EVENTS) {
+		index_wait(idx, id);
+		epoch = index_read_begin(idx);
+		if (id < index_first_id(idx))
+			id = index_first_id(idx);
+		/* every event has this tag, so seeking never skips any */
+		id = index_seek(idx, INDEX_KEY_TAG, intern_find("tag"), id);
+		while ((e = index_get(idx, id))) {
+			ASSERT_EQ(e->id, id);
+			ASSERT_EQ(e->pid, (int32_t)id);
+			ASSERT_EQ(strcmp(e->tag, "tag"), 0);
+			id++;
+		}
+		index_read_end(idx, epoch);
+	}
+	return NULL;
+}
+
+static void run_concurrent_readers(struct index *idx)
+{
+	struct adb_message msg;
+	pthread_t readers[CONCURRENT_READERS];
+	int i;
+
+	for (i = 0; i < CONCURRENT_READERS; i++)
+		pthread_create(&readers[i], NULL, concurrent_reader, idx);
+
+	set_payload(&msg, LEVEL_DEBUG, "tag", "text");
+	for (i = 0; i < CONCURRENT_EVENTS; i++) {
+		msg.pid = i;
+		index_append(idx, EVENT_LOGCAT_MESSAGE, &msg, INTERN_NONE);
+	}
+
+	for (i = 0; i < CONCURRENT_READERS; i++)
+		pthread_join(readers[i], NULL);
+}
+
+TEST(index, concurrent_readers)
+{
+	struct index idx;
+
+	/* small budget, to exercise eviction while reading */
+	index_init(&idx, 1000, 0);
+	run_concurrent_readers(&idx);
+	index_destroy(&idx);
+}
+
+TEST(index, concurrent_spill_readers)
+{
+	struct index idx;
+
+	/* readers falling behind read spilled chunks back */
+	index_init(&idx, 0, 512 * 1024);
+	ASSERT_EQ(index_spill(&idx, "/tmp"), 0);
+	run_concurrent_readers(&idx);
+	ASSERT_EQ(idx.first_id, 0);
+	index_destroy(&idx);
+}
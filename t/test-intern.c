@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "liblokatt/intern.h"
+
+#include "test.h"
+
+TEST(intern, intern_and_find)
+{
+	const char *a, *b, *c;
+	uint32_t id;
+
+	ASSERT_EQ(intern_find("intern-test-a"), INTERN_NONE);
+
+	id = intern("intern-test-a", 13, &a);
+	ASSERT_NE(id, INTERN_NONE);
+	ASSERT_EQ(strcmp(a, "intern-test-a"), 0);
+	ASSERT_EQ(intern_find("intern-test-a"), id);
+
+	/* same string, same id and copy */
+	ASSERT_EQ(intern("intern-test-abc", 13, &b), id);
+	ASSERT_EQ(a, b);
+
+	ASSERT_NE(intern("intern-test-b", 13, &c), id);
+	ASSERT_NE(a, c);
+}
+
+TEST(intern, many_strings)
+{
+	char str[32];
+	uint32_t ids[10000];
+	int i;
+
+	for (i = 0; i < 10000; i++) {
+		snprintf(str, sizeof(str), "intern-test-%d", i);
+		ids[i] = intern(str, strlen(str), NULL);
+		ASSERT_NE(ids[i], INTERN_NONE);
+	}
+	for (i = 0; i < 10000; i++) {
+		snprintf(str, sizeof(str), "intern-test-%d", i);
+		ASSERT_EQ(intern_find(str), ids[i]);
+		ASSERT_EQ(strcmp(intern_string(ids[i]), str), 0);
+	}
+	ASSERT_EQ(intern_string(INTERN_NONE), NULL);
+	ASSERT_EQ(intern_string(ids[9999] + 1000000), NULL);
+}
+
+TEST(intern, cap)
+{
+	char str[64];
+	uint32_t first, id;
+	int i;
+
+	first = intern_tag("intern-test-tag-0", 17, NULL);
+	ASSERT_NE(first, INTERN_NONE);
+	for (i = 1;; i++) {
+		snprintf(str, sizeof(str), "intern-test-tag-%d", i);
+		if (intern_tag(str, strlen(str), NULL) == INTERN_NONE)
+			break;
+	}
+	ASSERT_GT(i, 10000);
+	ASSERT_EQ(intern_find(str), INTERN_NONE);
+	ASSERT_EQ(intern_tag("intern-test-tag-0", 17, NULL), first);
+
+	/* tags don't take the room left for the rest */
+	id = intern("intern-test-name", 16, NULL);
+	ASSERT_NE(id, INTERN_NONE);
+	ASSERT_EQ(intern_find("intern-test-name"), id);
+	for (;; i++) {
+		snprintf(str, sizeof(str), "intern-test-name-%d", i);
+		if (intern(str, strlen(str), NULL) == INTERN_NONE)
+			break;
+	}
+	ASSERT_EQ(intern_find(str), INTERN_NONE);
+}
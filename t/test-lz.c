@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "liblokatt/lz.h"
+
+#include "test.h"
+
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+
+static size_t round_trip(const char *data, size_t size)
+{
+	char *compressed = malloc(LZ_BOUND(size));
+	char *decompressed = malloc(size + 1);
+	size_t compressed_size, decompressed_size;
+
+	compressed_size = lz_compress(data, size, compressed);
+	ASSERT_LE(compressed_size, LZ_BOUND(size));
+	ASSERT_EQ(lz_decompress(compressed, compressed_size, decompressed,
+				size, &decompressed_size), 0);
+	ASSERT_EQ(decompressed_size, size);
+	ASSERT_EQ(memcmp(data, decompressed, size), 0);
+
+	/* too small a buffer is an error, not an overflow */
+	if (size > 0)
+		ASSERT_EQ(lz_decompress(compressed, compressed_size,
+					decompressed, size - 1,
+					&decompressed_size), -1);
+
+	free(compressed);
+	free(decompressed);
+	return compressed_size;
+}
+
+TEST(lz, round_trip)
+{
+	static char buf[256 * 1024];
+	size_t i;
+
+	round_trip("", 0);
+	round_trip("a", 1);
+	round_trip("abcd", 4);
+	round_trip("aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", 40);
+
+	/* long runs need extended lengths */
+	memset(buf, 'x', sizeof(buf));
+	ASSERT_LT(round_trip(buf, sizeof(buf)), 2048);
+
+	/* random data doesn't compress, but must survive */
+	srand(0);
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+	round_trip(buf, sizeof(buf));
+
+	/* matches further back than the window */
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = (i / 4) % 20000 * 2654435761u >> 24;
+	round_trip(buf, sizeof(buf));
+}
+
+TEST(lz, boot_capture)
+{
+	static char buf[1024 * 1024];
+	FILE *fp = fopen(BOOT_CAPTURE, "rb");
+	size_t size;
+
+	ASSERT_NE(fp, NULL);
+	size = fread(buf, 1, sizeof(buf), fp);
+	fclose(fp);
+	ASSERT_GT(size, 0);
+	/* log data compresses well */
+	ASSERT_LT(round_trip(buf, size), size / 2);
+}
+
+TEST(lz, corrupt)
+{
+	static const char *inputs[] = {
+		"\x10",		/* literal run past the end */
+		"\x00\x01",	/* truncated offset */
+		"\x00\x00\x00",	/* zero offset */
+		"\x10x\x05\x00",	/* offset before the start */
+		"\xf0",		/* truncated length */
+	};
+	static const size_t sizes[] = { 1, 2, 3, 4, 1 };
+	char out[64];
+	size_t i, size;
+
+	for (i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++)
+		ASSERT_EQ(lz_decompress(inputs[i], sizes[i], out, sizeof(out),
+					&size), -1);
+}
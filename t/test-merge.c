@@ -0,0 +1,121 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "liblokatt/lokatt.h"
+
+#include "test.h"
+
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+#define REGULAR_USAGE_CAPTURE "t/nexus-5-android-5.1-regular-usage.bin"
+
+#define DEVICE_COUNT 3
+
+static const char *captures[DEVICE_COUNT] = {
+	BOOT_CAPTURE, REGULAR_USAGE_CAPTURE, BOOT_CAPTURE,
+};
+static const uint64_t sizes[DEVICE_COUNT] = { 2703, 2444, 2703 };
+
+/* open the captures and wait until they have been read in full */
+static void open_devices(struct lokatt_device **devs)
+{
+	struct lokatt_filter *any = lokatt_create_filter(EVENT_ANY, NULL);
+	struct lokatt_event event;
+	size_t i;
+
+	ASSERT_NE(any, NULL);
+	for (i = 0; i < DEVICE_COUNT; i++) {
+		devs[i] = lokatt_open_file(captures[i], NULL);
+		ASSERT_NE(devs[i], NULL);
+		ASSERT_EQ(lokatt_next_event(devs[i], sizes[i] - 1, any,
+					    &event), 0);
+	}
+	lokatt_destroy_filter(any);
+}
+
+static int64_t timestamp(const struct lokatt_event *event)
+{
+	return (int64_t)event->msg.sec * 1000000000 + event->msg.nsec;
+}
+
+TEST(merge, timestamp_order)
+{
+	struct lokatt_device *devs[DEVICE_COUNT];
+	struct lokatt_filter *any;
+	struct lokatt_merge *m;
+	struct lokatt_event event;
+	uint64_t next_id[DEVICE_COUNT] = { 0 }, total = 0;
+	int64_t last_ts = INT64_MIN;
+	size_t i, device, last_device = DEVICE_COUNT;
+
+	open_devices(devs);
+	any = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(any, NULL);
+	m = lokatt_create_merge(devs, DEVICE_COUNT, any, 20);
+	ASSERT_NE(m, NULL);
+
+	for (i = 0; i < DEVICE_COUNT; i++)
+		total += sizes[i];
+	for (; total > 0; total--) {
+		ASSERT_EQ(lokatt_merge_next(m, &event, &device), 0);
+		ASSERT_LT(device, DEVICE_COUNT);
+		ASSERT_EQ(event.id, next_id[device]);
+		next_id[device]++;
+		ASSERT_EQ(event.msg.tag, event.msg.payload + 1);
+
+		/*
+		 * Each device is in its own order, but moving from one device
+		 * to another never goes back in time.
+		 */
+		if (device != last_device)
+			ASSERT_GE(timestamp(&event), last_ts);
+		last_ts = timestamp(&event);
+		last_device = device;
+	}
+	for (i = 0; i < DEVICE_COUNT; i++)
+		ASSERT_EQ(next_id[i], sizes[i]);
+
+	lokatt_destroy_merge(m);
+	lokatt_destroy_filter(any);
+	for (i = 0; i < DEVICE_COUNT; i++)
+		lokatt_close_device(devs[i]);
+}
+
+TEST(merge, filter)
+{
+	struct lokatt_device *devs[DEVICE_COUNT];
+	struct lokatt_filter *filter;
+	struct lokatt_merge *m;
+	struct lokatt_event event;
+	size_t i, count[DEVICE_COUNT], device, n;
+	uint64_t *ids[DEVICE_COUNT];
+
+	open_devices(devs);
+	filter = lokatt_create_filter(EVENT_ANY,
+				      "level >= 5 || text contains \"wifi\"");
+	ASSERT_NE(filter, NULL);
+	for (i = 0; i < DEVICE_COUNT; i++) {
+		ASSERT_EQ(lokatt_scan(devs[i], 0, UINT64_MAX, filter, &ids[i],
+				      &count[i]), 0);
+		ASSERT_GT(count[i], 0);
+	}
+
+	/* the same matches, device by device */
+	m = lokatt_create_merge(devs, DEVICE_COUNT, filter, 20);
+	ASSERT_NE(m, NULL);
+	n = count[0] + count[1] + count[2];
+	memset(count, 0, sizeof(count));
+	for (; n > 0; n--) {
+		ASSERT_EQ(lokatt_merge_next(m, &event, &device), 0);
+		ASSERT_EQ(event.id, ids[device][count[device]]);
+		ASSERT_NE(lokatt_filter_match(filter, &event), 0);
+		count[device]++;
+	}
+
+	lokatt_destroy_merge(m);
+	lokatt_destroy_filter(filter);
+	for (i = 0; i < DEVICE_COUNT; i++) {
+		free(ids[i]);
+		lokatt_close_device(devs[i]);
+	}
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "liblokatt/backend.h"
+#include "liblokatt/intern.h"
+#include "liblokatt/procs.h"
+
+#include "test.h"
+
+/*
+ * A backend with processes 1 to 'count', named procs-test-<pid>, which
+ * takes 'again' more calls to list them.
+ */
+struct fake {
+	int32_t count;
+	int listings;
+	int fail;
+	int again, calls_left;
+};
+
+static int list_processes(void *userdata,
+			  void (*fn)(void *data, int32_t pid, const char *name),
+			  void *data)
+{
+	struct fake *fake = userdata;
+	char name[32];
+	int32_t pid;
+
+	if (!fake->calls_left) {
+		fake->listings++;
+		fake->calls_left = fake->again + 1;
+	}
+	if (--fake->calls_left)
+		return BACKEND_AGAIN;
+	if (fake->fail)
+		return -1;
+	for (pid = 1; pid <= fake->count; pid++) {
+		snprintf(name, sizeof(name), "procs-test-%d", pid);
+		fn(data, pid, name);
+	}
+	return 0;
+}
+
+static struct backend_ops fake_ops = {
+	.list_processes = list_processes,
+};
+
+static int is_named(uint32_t id, int32_t pid)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "procs-test-%d", pid);
+	return id != INTERN_NONE && !strcmp(intern_string(id), name);
+}
+
+TEST(procs, lookup)
+{
+	struct fake fake = { .count = 1000 };
+	struct procs procs;
+	int32_t pid;
+
+	procs_init(&procs, &fake, &fake_ops);
+
+	/* listed in bulk, once */
+	for (pid = 1; pid <= 1000; pid++)
+		ASSERT_EQ(is_named(procs_lookup(&procs, pid), pid), 1);
+	ASSERT_EQ(fake.listings, 1);
+
+	/* an unknown pid lists again, but not right away */
+	fake.count = 1001;
+	ASSERT_EQ(procs_lookup(&procs, 1001), INTERN_NONE);
+	ASSERT_EQ(procs_lookup(&procs, 1001), INTERN_NONE);
+	ASSERT_EQ(fake.listings, 1);
+	usleep(PROCS_REFRESH_MS * 1000);
+	ASSERT_EQ(is_named(procs_lookup(&procs, 1001), 1001), 1);
+	ASSERT_EQ(fake.listings, 2);
+
+	/* a failed listing keeps the names */
+	usleep(PROCS_REFRESH_MS * 1000);
+	fake.fail = 1;
+	ASSERT_EQ(procs_lookup(&procs, 1002), INTERN_NONE);
+	ASSERT_EQ(fake.listings, 3);
+	ASSERT_EQ(is_named(procs_lookup(&procs, 1), 1), 1);
+
+	/* forgetting lists again right away */
+	fake.fail = 0;
+	procs_forget(&procs);
+	ASSERT_EQ(is_named(procs_lookup(&procs, 1), 1), 1);
+	ASSERT_EQ(fake.listings, 4);
+
+	/* lookups don't wait for a listing, which keeps the old names */
+	usleep(PROCS_REFRESH_MS * 1000);
+	fake.again = 2;
+	fake.count = 1002;
+	ASSERT_EQ(procs_lookup(&procs, 1002), INTERN_NONE);
+	ASSERT_EQ(procs_lookup(&procs, 1002), INTERN_NONE);
+	ASSERT_EQ(is_named(procs_lookup(&procs, 1), 1), 1);
+	procs_poll(&procs);
+	ASSERT_EQ(procs_lookup(&procs, 1002), INTERN_NONE);
+	procs_poll(&procs);
+	ASSERT_EQ(is_named(procs_lookup(&procs, 1002), 1002), 1);
+	ASSERT_EQ(fake.listings, 5);
+
+	/* a listing under way when forgetting is out of date */
+	procs_forget(&procs);
+	ASSERT_EQ(procs_lookup(&procs, 1), INTERN_NONE);
+	procs_poll(&procs);
+	procs_forget(&procs);
+	procs_poll(&procs);
+	ASSERT_EQ(procs_lookup(&procs, 1), INTERN_NONE);
+	ASSERT_EQ(fake.listings, 7);
+	procs_poll(&procs);
+	procs_poll(&procs);
+	ASSERT_EQ(is_named(procs_lookup(&procs, 1), 1), 1);
+	ASSERT_EQ(fake.listings, 7);
+
+	procs_destroy(&procs);
+}
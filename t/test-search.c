@@ -0,0 +1,85 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "liblokatt/search.h"
+
+#include "test.h"
+
+TEST(search, find)
+{
+	struct search s;
+
+	search_init(&s, "needle", 0);
+	ASSERT_NE(search_find(&s, "needle"), 0);
+	ASSERT_NE(search_find(&s, "a needle in a haystack"), 0);
+	ASSERT_EQ(search_find(&s, "a needl in a haystack"), 0);
+	ASSERT_EQ(search_find(&s, "NEEDLE"), 0);
+	ASSERT_EQ(search_find(&s, "needl"), 0);
+	ASSERT_EQ(search_find(&s, ""), 0);
+	search_destroy(&s);
+
+	search_init(&s, "x", 0);
+	ASSERT_NE(search_find(&s, "x"), 0);
+	ASSERT_EQ(search_find(&s, "y"), 0);
+	search_destroy(&s);
+
+	search_init(&s, "", 0);
+	ASSERT_NE(search_find(&s, ""), 0);
+	ASSERT_NE(search_find(&s, "anything"), 0);
+	search_destroy(&s);
+}
+
+TEST(search, find_icase)
+{
+	struct search s;
+
+	search_init(&s, "NeeDle", 1);
+	ASSERT_NE(search_find(&s, "a needle in a haystack"), 0);
+	ASSERT_NE(search_find(&s, "A NEEDLE IN A HAYSTACK"), 0);
+	ASSERT_EQ(search_find(&s, "a needl in a haystack"), 0);
+	search_destroy(&s);
+
+	/* only letters are case folded */
+	search_init(&s, "@x[", 1);
+	ASSERT_NE(search_find(&s, "..@X[.."), 0);
+	ASSERT_EQ(search_find(&s, "..`X{.."), 0);
+	search_destroy(&s);
+}
+
+/* needles at every offset, in haystacks of every length up to 100 */
+TEST(search, compare_with_strstr)
+{
+	static const char *needles[] = {
+		"a", "ab", "aab", "abcdefghijklmnopqrstuvwxyz0123456789",
+	};
+	char haystack[128];
+	struct search s, si;
+	size_t i, size, pos;
+
+	for (i = 0; i < sizeof(needles) / sizeof(needles[0]); i++) {
+		size_t n = strlen(needles[i]);
+
+		search_init(&s, needles[i], 0);
+		search_init(&si, needles[i], 1);
+		for (size = 0; size < 100; size++) {
+			memset(haystack, 'b', size);
+			haystack[size] = '\0';
+			ASSERT_EQ(search_find(&s, haystack),
+				  strstr(haystack, needles[i]) != NULL);
+			for (pos = 0; pos + n <= size; pos++) {
+				memset(haystack, 'a', size);
+				memcpy(haystack + pos, needles[i], n);
+				haystack[size - 1] = 'B';
+				ASSERT_EQ(search_find(&s, haystack),
+					  strstr(haystack, needles[i]) !=
+					  NULL);
+				ASSERT_EQ(search_find(&si, haystack),
+					  strcasestr(haystack, needles[i]) !=
+					  NULL);
+			}
+		}
+		search_destroy(&s);
+		search_destroy(&si);
+	}
+}
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "liblokatt/lokatt.h"
+#include "liblokatt/lz.h"
+
+#include "test.h"
+
+#define BOOT_CAPTURE "t/nexus-5-android-5.1-boot.bin"
+
+static struct lokatt_device *open_boot_capture(void)
+{
+	struct lokatt_device *dev;
+	struct lokatt_filter *filter;
+	struct lokatt_event event;
+
+	dev = lokatt_open_file(BOOT_CAPTURE, NULL);
+	ASSERT_NE(dev, NULL);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	ASSERT_EQ(lokatt_next_event(dev, 2702, filter, &event), 0);
+	lokatt_destroy_filter(filter);
+	return dev;
+}
+
+static void save(struct lokatt_device *dev, char *path)
+{
+	int fd;
+
+	strcpy(path, "/tmp/lokatt-test-session-XXXXXX");
+	fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	close(fd);
+	ASSERT_EQ(lokatt_save_session(dev, path), 0);
+}
+
+static int same_event(const struct lokatt_event *a,
+		      const struct lokatt_event *b)
+{
+	return a->type == b->type && a->id == b->id &&
+		a->msg.pid == b->msg.pid && a->msg.tid == b->msg.tid &&
+		a->msg.sec == b->msg.sec && a->msg.nsec == b->msg.nsec &&
+		a->msg.level == b->msg.level &&
+		!strcmp(a->msg.tag, b->msg.tag) &&
+		!strcmp(a->msg.text, b->msg.text);
+}
+
+TEST(session, save_and_open)
+{
+	static struct lokatt_event events[100];
+	struct lokatt_device *dev = open_boot_capture();
+	struct lokatt_filter *filter;
+	struct lokatt_session *s;
+	struct lokatt_event event;
+	struct stat raw, saved;
+	char path[64];
+	size_t i, count;
+	uint64_t id = 0;
+
+	save(dev, path);
+	ASSERT_EQ(stat(BOOT_CAPTURE, &raw), 0);
+	ASSERT_EQ(stat(path, &saved), 0);
+	ASSERT_LT(saved.st_size, raw.st_size / 2);
+
+	s = lokatt_open_session(path);
+	ASSERT_NE(s, NULL);
+	ASSERT_EQ(lokatt_session_first_id(s), 0);
+	ASSERT_EQ(lokatt_session_size(s), 2703);
+
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	for (;;) {
+		ASSERT_EQ(lokatt_session_next_events(s, id, filter, events,
+						     100, &count), 0);
+		if (count == 0)
+			break;
+		for (i = 0; i < count; i++) {
+			ASSERT_EQ(events[i].id, id + i);
+			ASSERT_EQ(lokatt_next_event(dev, id + i, filter,
+						    &event), 0);
+			ASSERT_EQ(same_event(&events[i], &event), 1);
+		}
+		id += count;
+	}
+	ASSERT_EQ(id, 2703);
+
+	lokatt_destroy_filter(filter);
+	lokatt_close_session(s);
+	lokatt_close_device(dev);
+	unlink(path);
+}
+
+TEST(session, filter)
+{
+	static const char *specs[] = {
+		"tag == \"ActivityManager\"",
+		"tag == \"installd\" && level == 4",
+		"tag == \"no-such-tag\"",
+		"level >= 5 || text contains \"wifi\"",
+	};
+	struct lokatt_device *dev = open_boot_capture();
+	struct lokatt_filter *filter;
+	struct lokatt_session *s;
+	struct lokatt_event event;
+	uint64_t *ids, id;
+	char path[64];
+	size_t i, j, count;
+
+	save(dev, path);
+	s = lokatt_open_session(path);
+	ASSERT_NE(s, NULL);
+
+	for (i = 0; i < sizeof(specs) / sizeof(specs[0]); i++) {
+		filter = lokatt_create_filter(EVENT_ANY, specs[i]);
+		ASSERT_NE(filter, NULL);
+		ASSERT_EQ(lokatt_scan(dev, 0, UINT64_MAX, filter, &ids,
+				      &count), 0);
+		for (id = 0, j = 0;; j++) {
+			size_t n;
+
+			ASSERT_EQ(lokatt_session_next_events(s, id, filter,
+							     &event, 1, &n),
+				  0);
+			if (n == 0)
+				break;
+			ASSERT_LT(j, count);
+			ASSERT_EQ(event.id, ids[j]);
+			id = event.id + 1;
+		}
+		ASSERT_EQ(j, count);
+		free(ids);
+		lokatt_destroy_filter(filter);
+	}
+
+	lokatt_close_session(s);
+	lokatt_close_device(dev);
+	unlink(path);
+}
+
+TEST(session, seek_time)
+{
+	struct lokatt_device *dev = open_boot_capture();
+	struct lokatt_filter *filter;
+	struct lokatt_session *s;
+	struct lokatt_event event;
+	char path[64];
+	uint64_t id;
+	int32_t sec;
+
+	save(dev, path);
+	s = lokatt_open_session(path);
+	ASSERT_NE(s, NULL);
+
+	for (sec = 0; sec < 40; sec += 3) {
+		ASSERT_EQ(lokatt_session_seek_time(s, 0, sec, 500000000),
+			  lokatt_seek_time(dev, 0, sec, 500000000));
+		ASSERT_EQ(lokatt_session_seek_time(s, 1500, sec, 0),
+			  lokatt_seek_time(dev, 1500, sec, 0));
+	}
+	ASSERT_EQ(lokatt_session_seek_time(s, 5000, 0, 0), 5000);
+
+	/* times within the capture, across blocks */
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+	for (id = 0; id < 2703; id += 97) {
+		ASSERT_EQ(lokatt_next_event(dev, id, filter, &event), 0);
+		ASSERT_EQ(lokatt_session_seek_time(s, 0, event.msg.sec,
+						   event.msg.nsec),
+			  lokatt_seek_time(dev, 0, event.msg.sec,
+					   event.msg.nsec));
+		ASSERT_EQ(lokatt_session_seek_time(s, 1500, event.msg.sec,
+						   event.msg.nsec + 1),
+			  lokatt_seek_time(dev, 1500, event.msg.sec,
+					   event.msg.nsec + 1));
+	}
+	lokatt_destroy_filter(filter);
+
+	lokatt_close_session(s);
+	lokatt_close_device(dev);
+	unlink(path);
+}
+
+static void put_le(char *p, uint64_t v, int size)
+{
+	for (; size > 0; size--, v >>= 8)
+		*p++ = (char)v;
+}
+
+/*
+ * Write a session of one block with one message, with 'text_size' bytes
+ * of text, by hand: the writer can't make one with more text than a
+ * message holds, but anyone can.
+ */
+static void write_one_message(char *path, size_t text_size)
+{
+	static char raw[64 * 1024], compressed[LZ_BOUND(sizeof(raw))];
+	char header[56], trailer[24];
+	size_t size, compressed_size, i;
+	uint32_t hash = 2166136261u;
+	FILE *fp;
+	int fd;
+
+	size = 24 + 4 + text_size + 1 + 1;
+	ASSERT_LE(size, sizeof(raw));
+	memset(raw, 0, size);
+	raw[0] = EVENT_LOGCAT_MESSAGE;
+	raw[1] = LEVEL_INFO;
+	put_le(raw + 18, 3, 2);
+	put_le(raw + 20, text_size, 2);
+	memcpy(raw + 24, "tag", 3);
+	memset(raw + 28, 'x', text_size);
+	for (i = 0; i < size; i++) {
+		hash ^= (uint8_t)raw[i];
+		hash *= 16777619u;
+	}
+
+	compressed_size = lz_compress(raw, size, compressed);
+	memset(header, 0, sizeof(header));
+	put_le(header, compressed_size, 4);
+	put_le(header + 4, size, 4);
+	put_le(header + 8, 1, 4);
+	put_le(header + 12, EVENT_LOGCAT_MESSAGE, 4);
+	put_le(header + 16, hash, 4);
+	put_le(header + 20, 1, 4);
+	memset(header + 48, 0xff, 8);
+
+	strcpy(path, "/tmp/lokatt-test-session-XXXXXX");
+	fd = mkstemp(path);
+	ASSERT_GE(fd, 0);
+	fp = fdopen(fd, "wb");
+	ASSERT_NE(fp, NULL);
+	fwrite("LOKATTS\0\3\0\0\0\0\0\0\0", 16, 1, fp);
+	fwrite(header, sizeof(header), 1, fp);
+	fwrite(compressed, compressed_size, 1, fp);
+	put_le(trailer, ftell(fp), 8);
+	fwrite("\x10\0\0\0\0\0\0\0", 8, 1, fp);
+	fwrite(header, sizeof(header), 1, fp);
+	put_le(trailer + 8, 1, 4);
+	put_le(trailer + 12, 3, 4);
+	memcpy(trailer + 16, "LOKATTS", 8);
+	fwrite(trailer, sizeof(trailer), 1, fp);
+	ASSERT_EQ(fclose(fp), 0);
+}
+
+TEST(session, corrupt)
+{
+	struct lokatt_device *dev = open_boot_capture();
+	struct lokatt_filter *filter;
+	struct lokatt_session *s;
+	struct lokatt_event event;
+	struct stat st;
+	char path[64];
+	size_t count;
+	uint32_t words;
+	FILE *fp;
+
+	save(dev, path);
+	ASSERT_EQ(stat(path, &st), 0);
+	filter = lokatt_create_filter(EVENT_ANY, NULL);
+	ASSERT_NE(filter, NULL);
+
+	/*
+	 * A damaged block is only noticed when it is read: skip the file
+	 * header and the first block's header, its size in bloom words at 20.
+	 */
+	fp = fopen(path, "r+b");
+	ASSERT_NE(fp, NULL);
+	ASSERT_EQ(fseek(fp, 16 + 20, SEEK_SET), 0);
+	ASSERT_EQ(fread(&words, sizeof(words), 1, fp), 1);
+	ASSERT_EQ(fseek(fp, 16 + 48 + 8 * words + 16, SEEK_SET), 0);
+	ASSERT_EQ(fwrite("\xff\xff\xff\xff", 4, 1, fp), 1);
+	fclose(fp);
+	s = lokatt_open_session(path);
+	ASSERT_NE(s, NULL);
+	ASSERT_EQ(lokatt_session_next_events(s, 0, filter, &event, 1,
+					     &count), -1);
+	lokatt_close_session(s);
+
+	/* a damaged footer isn't opened at all */
+	ASSERT_EQ(truncate(path, st.st_size - 1), 0);
+	ASSERT_EQ(lokatt_open_session(path), NULL);
+	ASSERT_EQ(lokatt_open_session("/nonexistent"), NULL);
+	unlink(path);
+
+	/* sizes past what a message holds, checksum and all */
+	write_one_message(path, MSG_MAX_PAYLOAD_SIZE - 6);
+	s = lokatt_open_session(path);
+	ASSERT_NE(s, NULL);
+	ASSERT_EQ(lokatt_session_next_events(s, 0, filter, &event, 1,
+					     &count), 0);
+	ASSERT_EQ(count, 1);
+	ASSERT_EQ(strlen(event.msg.text), MSG_MAX_PAYLOAD_SIZE - 6);
+	lokatt_close_session(s);
+	unlink(path);
+	write_one_message(path, 6000);
+	s = lokatt_open_session(path);
+	ASSERT_NE(s, NULL);
+	ASSERT_EQ(lokatt_session_next_events(s, 0, filter, &event, 1,
+					     &count), -1);
+	lokatt_close_session(s);
+	unlink(path);
+
+	lokatt_destroy_filter(filter);
+	lokatt_close_device(dev);
+}
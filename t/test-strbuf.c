@@ -77,3 +77,20 @@ TEST(strbuf, add_alloc_automatically)
 
 	strbuf_destroy(&sb);
 }
+
+TEST(strbuf, addf_to_empty)
+{
+	struct strbuf sb = STRBUF_INIT;
+
+	strbuf_addf(&sb, "%d", 1234);
+	ASSERT_STRBUF_EQ(&sb, "1234");
+	ASSERT_EQ(strcmp(strbuf_default_buffer, ""), 0);
+
+	strbuf_destroy(&sb);
+
+	/* exactly fills the buffer */
+	strbuf_init(&sb, 4);
+	strbuf_addf(&sb, "%d", 1234);
+	ASSERT_STRBUF_EQ(&sb, "1234");
+	strbuf_destroy(&sb);
+}